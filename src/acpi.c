@@ -0,0 +1,126 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "acpi.h"
+
+/* root system description pointer */
+struct rsdp {
+	char sig[8];		/* "RSD PTR " */
+	uint8_t checksum;
+	char oem_id[6];
+	uint8_t rev;
+	uint32_t rsdt_addr;
+	/* ACPI 2.0+ fields follow: length, xsdt_addr, ext_checksum */
+} __attribute__((packed));
+
+#define RSDP_SIZE	20
+
+static struct acpi_sdt_hdr *find_rsdt(void);
+
+static struct acpi_sdt_hdr *rsdt;
+static int rsdt_searched;
+
+void *acpi_find_table(const char *sig, int n)
+{
+	int i, num_ent;
+	uint32_t *ent;
+	struct acpi_sdt_hdr *tab;
+
+	if(!rsdt_searched) {
+		rsdt = find_rsdt();
+		rsdt_searched = 1;
+	}
+	if(!rsdt) return 0;
+
+	/* the RSDT holds 32bit physical addresses of all other tables. We don't
+	 * bother with the XSDT, we can't reach tables above 4GB anyway.
+	 */
+	num_ent = (rsdt->len - sizeof *rsdt) / 4;
+	ent = (uint32_t*)(rsdt + 1);
+
+	for(i=0; i<num_ent; i++) {
+		tab = (struct acpi_sdt_hdr*)ent[i];
+		if(memcmp(tab->sig, (char*)sig, 4) != 0) {
+			continue;
+		}
+		if(bios_checksum(tab, tab->len) != 0) {
+			printf("ACPI: ignoring %c%c%c%c table with bad checksum\n", sig[0],
+					sig[1], sig[2], sig[3]);
+			continue;
+		}
+		if(n-- <= 0) {
+			return tab;
+		}
+	}
+	return 0;
+}
+
+void *scan_bios_sig(const char *sig, int siglen, void *start, int size)
+{
+	char *ptr = start;
+	char *end = ptr + size;
+
+	while(ptr < end) {
+		if(memcmp(ptr, (char*)sig, siglen) == 0) {
+			return ptr;
+		}
+		ptr += 16;
+	}
+	return 0;
+}
+
+int bios_checksum(void *ptr, int size)
+{
+	unsigned char *p = ptr, sum = 0;
+
+	while(size-- > 0) {
+		sum += *p++;
+	}
+	return sum;
+}
+
+/* the RSDP is either in the first 1k of the EBDA, or in the BIOS ROM area
+ * between e0000h and fffffh.
+ */
+static struct acpi_sdt_hdr *find_rsdt(void)
+{
+	uint32_t ebda = (uint32_t)*(uint16_t*)0x40e << 4;
+	struct rsdp *rsdp = 0;
+	struct acpi_sdt_hdr *tab;
+
+	if(ebda >= 0x80000 && ebda < 0xa0000) {
+		rsdp = scan_bios_sig("RSD PTR ", 8, (void*)ebda, 1024);
+	}
+	if(!rsdp) {
+		rsdp = scan_bios_sig("RSD PTR ", 8, (void*)0xe0000, 0x20000);
+	}
+	if(!rsdp || bios_checksum(rsdp, RSDP_SIZE) != 0) {
+		return 0;
+	}
+
+	tab = (struct acpi_sdt_hdr*)rsdp->rsdt_addr;
+	if(memcmp(tab->sig, "RSDT", 4) != 0 || bios_checksum(tab, tab->len) != 0) {
+		printf("ACPI: invalid RSDT at %p\n", (void*)tab);
+		return 0;
+	}
+	printf("ACPI: found RSDT at %p (%c%c%c%c%c%c)\n", (void*)tab, rsdp->oem_id[0],
+			rsdp->oem_id[1], rsdp->oem_id[2], rsdp->oem_id[3], rsdp->oem_id[4],
+			rsdp->oem_id[5]);
+	return tab;
+}
@@ -0,0 +1,58 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef ACPI_H_
+#define ACPI_H_
+
+#include <inttypes.h>
+
+/* common header of all ACPI system description tables */
+struct acpi_sdt_hdr {
+	char sig[4];
+	uint32_t len;
+	uint8_t rev;
+	uint8_t checksum;
+	char oem_id[6];
+	char oem_table_id[8];
+	uint32_t oem_rev;
+	uint32_t creator_id;
+	uint32_t creator_rev;
+} __attribute__((packed));
+
+/* generic address structure, used to describe register locations */
+struct acpi_gas {
+	uint8_t space;		/* 0: memory, 1: I/O port */
+	uint8_t bit_width;
+	uint8_t bit_offs;
+	uint8_t access_size;
+	uint64_t addr;
+} __attribute__((packed));
+
+/* find the n-th (usually 0) ACPI table with a matching signature, through the
+ * RSDT. Returns null if there's no ACPI, or no such table.
+ */
+void *acpi_find_table(const char *sig, int n);
+
+/* scan memory for a signature on 16-byte boundaries, used to locate the ACPI
+ * RSDP and the MP floating pointer structure.
+ */
+void *scan_bios_sig(const char *sig, int siglen, void *start, int size);
+
+/* checksum bytes should add up to 0 */
+int bios_checksum(void *ptr, int size);
+
+#endif	/* ACPI_H_ */
@@ -0,0 +1,741 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "apic.h"
+#include "acpi.h"
+#include "intr.h"
+#include "timer.h"
+#include "asmops.h"
+#include "cpuid.h"
+
+#define MSR_APIC_BASE		0x1b
+#define APIC_BASE_ENABLE	0x800
+
+/* local APIC registers, as 32bit word offsets */
+#define LAPIC_ID		(0x20 / 4)
+#define LAPIC_TPR		(0x80 / 4)
+#define LAPIC_EOI		(0xb0 / 4)
+#define LAPIC_SVR		(0xf0 / 4)
+#define LAPIC_ICR_LOW	(0x300 / 4)
+#define LAPIC_ICR_HIGH	(0x310 / 4)
+#define LAPIC_LVT_TIMER	(0x320 / 4)
+#define LAPIC_LINT0		(0x350 / 4)
+#define LAPIC_LINT1		(0x360 / 4)
+#define LAPIC_TMR_INIT	(0x380 / 4)
+#define LAPIC_TMR_CUR	(0x390 / 4)
+#define LAPIC_TMR_DIV	(0x3e0 / 4)
+
+#define SVR_ENABLE		0x100
+#define LVT_MASK		0x10000
+#define LVT_EXTINT		0x700
+#define LVT_NMI			0x400
+#define LVT_TMR_PERIODIC	0x20000
+#define TMR_DIV16		3
+#define ICR_INIT		0x0500
+#define ICR_STARTUP		0x0600
+#define ICR_PENDING		0x1000
+#define ICR_ASSERT		0x4000
+#define ICR_LEVEL		0x8000
+
+/* I/O APIC registers are accessed indirectly, through a select and a data
+ * window register
+ */
+#define IOAPIC_SEL		0
+#define IOAPIC_WIN		(0x10 / 4)
+#define IOAPIC_VER		1
+#define IOAPIC_REDIR(x)	(0x10 + (x) * 2)
+
+#define REDIR_ACTIVE_LOW	0x2000
+#define REDIR_LEVEL			0x8000
+#define REDIR_MASK			0x10000
+
+/* MPS INTI flags, also used by the ACPI interrupt source overrides */
+#define INTI_POL(x)		((x) & 3)
+#define INTI_TRIG(x)	(((x) >> 2) & 3)
+#define INTI_LOW		3
+#define INTI_LEVEL		3
+
+/* IMCR: switches the PIC outputs between the CPU and the APIC bus */
+#define IMCR_ADDR	0x22
+#define IMCR_DATA	0x23
+
+/* ACPI multiple APIC description table */
+struct madt {
+	struct acpi_sdt_hdr hdr;
+	uint32_t lapic_addr;
+	uint32_t flags;
+} __attribute__((packed));
+
+#define MADT_PCAT_COMPAT	1
+
+enum { MADT_LAPIC, MADT_IOAPIC, MADT_ISO, MADT_LAPIC_ADDR = 5 };
+
+struct madt_lapic {
+	uint8_t type, len;
+	uint8_t acpi_id, apic_id;
+	uint32_t flags;
+} __attribute__((packed));
+
+struct madt_ioapic {
+	uint8_t type, len;
+	uint8_t id, rsvd;
+	uint32_t addr;
+	uint32_t gsi_base;
+} __attribute__((packed));
+
+struct madt_iso {
+	uint8_t type, len;
+	uint8_t bus, src;
+	uint32_t gsi;
+	uint16_t flags;
+} __attribute__((packed));
+
+struct madt_lapic_addr {
+	uint8_t type, len;
+	uint16_t rsvd;
+	uint64_t addr;
+} __attribute__((packed));
+
+/* Intel MultiProcessor specification tables */
+struct mp_fps {
+	char sig[4];
+	uint32_t cfg_addr;
+	uint8_t len, rev, checksum;
+	uint8_t feat[5];
+} __attribute__((packed));
+
+struct mp_cfg {
+	char sig[4];
+	uint16_t len;
+	uint8_t rev, checksum;
+	char oem[8], prod[12];
+	uint32_t oem_tab;
+	uint16_t oem_tab_size, num_ent;
+	uint32_t lapic_addr;
+	uint16_t ext_len;
+	uint8_t ext_checksum, rsvd;
+} __attribute__((packed));
+
+enum { MP_PROC, MP_BUS, MP_IOAPIC, MP_IOINT, MP_LINT };
+
+#define MP_PROC_EN		1
+#define MP_IOAPIC_EN	1
+#define MP_INT_INT		0
+#define MP_IMCRP		0x80
+
+struct mp_proc {
+	uint8_t type, apic_id, apic_ver, flags;
+	uint32_t sig, feat;
+	uint32_t rsvd[2];
+} __attribute__((packed));
+
+struct mp_bus {
+	uint8_t type, id;
+	char name[6];
+} __attribute__((packed));
+
+struct mp_ioapic {
+	uint8_t type, id, ver, flags;
+	uint32_t addr;
+} __attribute__((packed));
+
+struct mp_ioint {
+	uint8_t type, int_type;
+	uint16_t flags;
+	uint8_t src_bus, src_irq;
+	uint8_t dst_ioapic, dst_pin;
+} __attribute__((packed));
+
+static int read_madt(void);
+static int read_mptables(void);
+static struct mp_fps *find_mp_fps(void);
+static void add_cpu(int id);
+static struct ioapic *add_ioapic(int id, uint32_t addr, int gsi_base);
+static void set_isa_route(int irq, int gsi, unsigned int inti);
+static struct ioapic *find_gsi(int gsi, int *pin);
+static uint32_t ioapic_read(struct ioapic *io, int reg);
+static void ioapic_write(struct ioapic *io, int reg, uint32_t val);
+static void send_icr(int dest, uint32_t cmd);
+static void route_isa_irqs(void);
+static void set_redir(int irq, int masked);
+static void ioapic_mask(int irq);
+static void ioapic_unmask(int irq);
+static void ioapic_eoi(int irq);
+static void spurious_intr(int inum);
+static void init_lapic_timer(void);
+static void lapic_timer_intr(int inum);
+static void lapic_timer_oneshot(uint64_t delta);
+static void lapic_timer_periodic(unsigned long hz);
+static void lapic_timer_stop(void);
+
+/* defined in intr_asm.S */
+void intr_entry_irq7(void);
+void intr_entry_irq15(void);
+
+static volatile uint32_t *lapic;
+
+/* I/O APIC input of each ISA IRQ, io is null for unrouted IRQs */
+static struct {
+	struct ioapic *io;
+	int pin;
+} irq_pin[16];
+static unsigned int irq_mask;
+
+static uint32_t lapic_ns_mult;
+static unsigned long num_spurious;
+
+static struct irq_controller ioapic_irqctl = {"I/O APIC", ioapic_eoi, ioapic_mask, ioapic_unmask};
+static struct timer_evsrc lapic_evsrc = {"local APIC timer", lapic_timer_oneshot,
+	lapic_timer_periodic, lapic_timer_stop};
+
+
+void init_apic(void)
+{
+	int i;
+
+	for(i=0; i<16; i++) {
+		apic_config.isa_irq[i].gsi = i;
+	}
+
+	if(lapic_enable() == -1) {
+		printf("APIC: no local APIC, using the 8259 PICs\n");
+		return;
+	}
+	interrupt(APIC_SPURIOUS_INTR, spurious_intr);
+
+	if(read_madt() == -1 && read_mptables() == -1) {
+		printf("APIC: no MADT or MP tables, using the 8259 PICs\n");
+	} else {
+		printf("APIC: %d processor(s), %d I/O APIC(s) (from %s)\n", apic_config.num_cpus,
+				apic_config.num_ioapics, apic_config.source);
+		if(apic_config.num_ioapics) {
+			route_isa_irqs();
+		}
+	}
+
+	init_lapic_timer();
+}
+
+int lapic_enable(void)
+{
+	uint64_t base;
+
+	if(lapic) return 0;
+
+	if(!CPU_HAS(APIC) || !CPU_HAS(MSR)) {
+		return -1;
+	}
+	base = rdmsr(MSR_APIC_BASE);
+	if(!(base & APIC_BASE_ENABLE)) {
+		return -1;
+	}
+	lapic = (volatile uint32_t*)((uint32_t)base & 0xfffff000);
+
+	if(!(lapic[LAPIC_SVR] & SVR_ENABLE)) {
+		lapic[LAPIC_LINT0] = LVT_EXTINT;
+		lapic[LAPIC_LINT1] = LVT_NMI;
+	}
+	lapic[LAPIC_TPR] = 0;
+	lapic[LAPIC_SVR] = SVR_ENABLE | APIC_SPURIOUS_INTR;
+	return 0;
+}
+
+int lapic_id(void)
+{
+	return lapic ? lapic[LAPIC_ID] >> 24 : 0;
+}
+
+void lapic_eoi(void)
+{
+	lapic[LAPIC_EOI] = 0;
+}
+
+void lapic_send_ipi(int dest, int inum)
+{
+	send_icr(dest, ICR_ASSERT | inum);
+}
+
+void lapic_send_init(int dest)
+{
+	send_icr(dest, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+	/* de-assert, only needed by the P6 and earlier */
+	send_icr(dest, ICR_INIT | ICR_LEVEL);
+}
+
+void lapic_send_sipi(int dest, uint32_t addr)
+{
+	send_icr(dest, ICR_STARTUP | (addr >> 12));
+}
+
+void lapic_init_ap(void)
+{
+	lapic[LAPIC_TPR] = 0;
+	/* only the boot processor gets the 8259 and NMI inputs */
+	lapic[LAPIC_LINT0] = LVT_MASK;
+	lapic[LAPIC_LINT1] = LVT_MASK;
+	lapic[LAPIC_LVT_TIMER] = LVT_MASK;
+	lapic[LAPIC_SVR] = SVR_ENABLE | APIC_SPURIOUS_INTR;
+}
+
+static void send_icr(int dest, uint32_t cmd)
+{
+	int iflag = get_intr_flag();
+	disable_intr();
+
+	while(lapic[LAPIC_ICR_LOW] & ICR_PENDING);
+	lapic[LAPIC_ICR_HIGH] = (uint32_t)dest << 24;
+	lapic[LAPIC_ICR_LOW] = cmd;
+
+	set_intr_flag(iflag);
+}
+
+/* the BIOS expects the 8259s to be connected, so hand the IRQs back to them,
+ * with the same masks, until the BIOS call returns. The local APIC timer is
+ * stopped too, since its vector is a BIOS vector in real mode, and the BIOS
+ * wouldn't acknowledge it.
+ */
+void apic_bios_enter(void)
+{
+	int i;
+
+	if(get_timer_evsrc() == &lapic_evsrc) {
+		lapic_timer_stop();
+	}
+
+	if(!apic_mode) return;
+
+	for(i=0; i<16; i++) {
+		if(irq_pin[i].io) set_redir(i, 1);
+	}
+	lapic[LAPIC_LINT0] = LVT_EXTINT;
+	if(apic_config.imcr) {
+		outb(0x70, IMCR_ADDR);
+		outb(0, IMCR_DATA);
+	}
+	set_pic_mask(0, irq_mask & 0xfb);
+	set_pic_mask(1, irq_mask >> 8);
+}
+
+void apic_bios_exit(void)
+{
+	int i;
+
+	if(get_timer_evsrc() == &lapic_evsrc) {
+		timer_restart();
+	}
+
+	if(!apic_mode) return;
+
+	set_pic_mask(0, 0xff);
+	set_pic_mask(1, 0xff);
+	if(apic_config.imcr) {
+		outb(0x70, IMCR_ADDR);
+		outb(1, IMCR_DATA);
+	}
+	lapic[LAPIC_LINT0] = LVT_MASK | LVT_EXTINT;
+	for(i=0; i<16; i++) {
+		if(irq_pin[i].io) set_redir(i, irq_mask & (1 << i));
+	}
+}
+
+static int read_madt(void)
+{
+	struct madt *madt;
+	unsigned char *ptr, *end;
+
+	if(!(madt = acpi_find_table("APIC", 0))) {
+		return -1;
+	}
+	apic_config.source = "ACPI";
+	apic_config.lapic_addr = madt->lapic_addr;
+	apic_config.have_pic = madt->flags & MADT_PCAT_COMPAT;
+
+	ptr = (unsigned char*)(madt + 1);
+	end = (unsigned char*)madt + madt->hdr.len;
+	while(ptr + 2 <= end && ptr[1] >= 2) {
+		switch(ptr[0]) {
+		case MADT_LAPIC:
+			{
+				struct madt_lapic *ent = (struct madt_lapic*)ptr;
+				if(ent->flags & 1) {
+					add_cpu(ent->apic_id);
+				}
+			}
+			break;
+
+		case MADT_IOAPIC:
+			{
+				struct madt_ioapic *ent = (struct madt_ioapic*)ptr;
+				add_ioapic(ent->id, ent->addr, ent->gsi_base);
+			}
+			break;
+
+		case MADT_ISO:
+			{
+				struct madt_iso *ent = (struct madt_iso*)ptr;
+				if(ent->bus == 0 && ent->src < 16) {
+					set_isa_route(ent->src, ent->gsi, ent->flags);
+				}
+			}
+			break;
+
+		case MADT_LAPIC_ADDR:
+			apic_config.lapic_addr = ((struct madt_lapic_addr*)ptr)->addr;
+			break;
+
+		default:
+			break;
+		}
+		ptr += ptr[1];
+	}
+	return 0;
+}
+
+static int read_mptables(void)
+{
+	int i, isa_bus = -1;
+	struct mp_fps *fps;
+	struct mp_cfg *mpc;
+	unsigned char *ptr;
+	struct ioapic *io;
+
+	if(!(fps = find_mp_fps())) {
+		return -1;
+	}
+	apic_config.have_pic = 1;
+	apic_config.imcr = fps->feat[1] & MP_IMCRP;
+
+	if(fps->feat[0]) {
+		/* one of the default configurations: 2 processors, one I/O APIC, and
+		 * ISA IRQs connected to the I/O APIC pins with the same number
+		 */
+		apic_config.source = "MP default config";
+		apic_config.lapic_addr = 0xfee00000;
+		add_cpu(0);
+		add_cpu(1);
+		add_ioapic(2, 0xfec00000, 0);
+		return 0;
+	}
+
+	mpc = (struct mp_cfg*)fps->cfg_addr;
+	if(!mpc || memcmp(mpc->sig, "PCMP", 4) != 0 || bios_checksum(mpc, mpc->len) != 0) {
+		return -1;
+	}
+	apic_config.source = "MP tables";
+	apic_config.lapic_addr = mpc->lapic_addr;
+
+	/* entries are sorted by type, so buses and I/O APICs come before the
+	 * interrupt assignments which refer to them
+	 */
+	ptr = (unsigned char*)(mpc + 1);
+	for(i=0; i<mpc->num_ent; i++) {
+		switch(*ptr) {
+		case MP_PROC:
+			{
+				struct mp_proc *ent = (struct mp_proc*)ptr;
+				if(ent->flags & MP_PROC_EN) {
+					add_cpu(ent->apic_id);
+				}
+				ptr += sizeof *ent;
+			}
+			break;
+
+		case MP_BUS:
+			if(memcmp(((struct mp_bus*)ptr)->name, "ISA", 3) == 0) {
+				isa_bus = ((struct mp_bus*)ptr)->id;
+			}
+			ptr += sizeof(struct mp_bus);
+			break;
+
+		case MP_IOAPIC:
+			{
+				struct mp_ioapic *ent = (struct mp_ioapic*)ptr;
+				if(ent->flags & MP_IOAPIC_EN) {
+					add_ioapic(ent->id, ent->addr, -1);
+				}
+				ptr += sizeof *ent;
+			}
+			break;
+
+		case MP_IOINT:
+			{
+				struct mp_ioint *ent = (struct mp_ioint*)ptr;
+				if(ent->int_type == MP_INT_INT && ent->src_bus == isa_bus && ent->src_irq < 16) {
+					for(io=apic_config.ioapic; io<apic_config.ioapic + apic_config.num_ioapics; io++) {
+						if(ent->dst_ioapic == 0xff || ent->dst_ioapic == io->id) {
+							set_isa_route(ent->src_irq, io->gsi_base + ent->dst_pin, ent->flags);
+							break;
+						}
+					}
+				}
+				ptr += sizeof *ent;
+			}
+			break;
+
+		case MP_LINT:
+			ptr += sizeof(struct mp_ioint);
+			break;
+
+		default:
+			/* unknown entry, we can't tell how long it is */
+			return 0;
+		}
+	}
+	return 0;
+}
+
+/* the MP floating pointer structure is in the first 1k of the EBDA, the last
+ * 1k of base memory, or in the BIOS ROM area.
+ */
+static struct mp_fps *find_mp_fps(void)
+{
+	uint32_t ebda = (uint32_t)*(uint16_t*)0x40e << 4;
+	uint32_t basemem = (uint32_t)*(uint16_t*)0x413 << 10;
+	struct mp_fps *fps;
+	void *start[3];
+	int i, size[3];
+
+	start[0] = (void*)ebda;
+	size[0] = ebda >= 0x80000 && ebda < 0xa0000 ? 1024 : 0;
+	start[1] = (void*)(basemem - 1024);
+	size[1] = basemem > 1024 && basemem <= 0xa0000 ? 1024 : 0;
+	start[2] = (void*)0xf0000;
+	size[2] = 0x10000;
+
+	for(i=0; i<3; i++) {
+		void *ptr = start[i];
+		int sz = size[i];
+
+		while(sz > 0 && (fps = scan_bios_sig("_MP_", 4, ptr, sz))) {
+			if(bios_checksum(fps, fps->len * 16) == 0) {
+				return fps;
+			}
+			sz -= (char*)fps + 16 - (char*)ptr;
+			ptr = (char*)fps + 16;
+		}
+	}
+	return 0;
+}
+
+static void add_cpu(int id)
+{
+	if(apic_config.num_cpus < MAX_CPUS) {
+		apic_config.cpu_id[apic_config.num_cpus++] = id;
+	}
+}
+
+/* gsi_base -1 continues after the pins of the previous I/O APIC */
+static struct ioapic *add_ioapic(int id, uint32_t addr, int gsi_base)
+{
+	struct ioapic *io;
+
+	if(apic_config.num_ioapics >= MAX_IOAPICS) {
+		return 0;
+	}
+	io = apic_config.ioapic + apic_config.num_ioapics;
+	io->id = id;
+	io->regs = (volatile uint32_t*)addr;
+	io->num_pins = ((ioapic_read(io, IOAPIC_VER) >> 16) & 0xff) + 1;
+
+	if(gsi_base >= 0) {
+		io->gsi_base = gsi_base;
+	} else if(apic_config.num_ioapics > 0) {
+		io->gsi_base = io[-1].gsi_base + io[-1].num_pins;
+	} else {
+		io->gsi_base = 0;
+	}
+	apic_config.num_ioapics++;
+	return io;
+}
+
+static void set_isa_route(int irq, int gsi, unsigned int inti)
+{
+	struct isa_irq_route *route = apic_config.isa_irq + irq;
+
+	/* "conforms to bus" means active high, edge triggered for ISA */
+	route->gsi = gsi;
+	route->active_low = INTI_POL(inti) == INTI_LOW;
+	route->level = INTI_TRIG(inti) == INTI_LEVEL;
+}
+
+static struct ioapic *find_gsi(int gsi, int *pin)
+{
+	int i;
+	struct ioapic *io = apic_config.ioapic;
+
+	for(i=0; i<apic_config.num_ioapics; i++) {
+		if(gsi >= io->gsi_base && gsi < io->gsi_base + io->num_pins) {
+			*pin = gsi - io->gsi_base;
+			return io;
+		}
+		io++;
+	}
+	return 0;
+}
+
+static uint32_t ioapic_read(struct ioapic *io, int reg)
+{
+	io->regs[IOAPIC_SEL] = reg;
+	return io->regs[IOAPIC_WIN];
+}
+
+static void ioapic_write(struct ioapic *io, int reg, uint32_t val)
+{
+	io->regs[IOAPIC_SEL] = reg;
+	io->regs[IOAPIC_WIN] = val;
+}
+
+/* program the I/O APIC redirection entries for the ISA IRQs with the same
+ * vectors and masks they had on the PICs, and disconnect the PICs.
+ */
+static void route_isa_irqs(void)
+{
+	int i, j, pin, iflag;
+	struct ioapic *io;
+
+	iflag = get_intr_flag();
+	disable_intr();
+
+	irq_mask = get_pic_mask(0) | ((unsigned int)get_pic_mask(1) << 8);
+
+	for(i=0; i<apic_config.num_ioapics; i++) {
+		io = apic_config.ioapic + i;
+		for(j=0; j<io->num_pins; j++) {
+			ioapic_write(io, IOAPIC_REDIR(j), REDIR_MASK);
+		}
+	}
+
+	for(i=0; i<16; i++) {
+		/* IRQ 2 is the PIC cascade, nothing is connected to it */
+		if(i == 2 || !(io = find_gsi(apic_config.isa_irq[i].gsi, &pin))) {
+			continue;
+		}
+		irq_pin[i].io = io;
+		irq_pin[i].pin = pin;
+		ioapic_write(io, IOAPIC_REDIR(pin) + 1, (uint32_t)lapic_id() << 24);
+		set_redir(i, irq_mask & (1 << i));
+	}
+
+	if(apic_config.imcr) {
+		outb(0x70, IMCR_ADDR);
+		outb(1, IMCR_DATA);
+	}
+	set_pic_mask(0, 0xff);
+	set_pic_mask(1, 0xff);
+	lapic[LAPIC_LINT0] = LVT_MASK | LVT_EXTINT;
+
+	/* no more PIC spurious interrupts to filter on IRQ 7 and 15 */
+	set_intr_entry(IRQ_TO_INTR(7), intr_entry_irq7);
+	set_intr_entry(IRQ_TO_INTR(15), intr_entry_irq15);
+
+	set_irq_controller(&ioapic_irqctl);
+	apic_mode = 1;
+
+	set_intr_flag(iflag);
+}
+
+static void set_redir(int irq, int masked)
+{
+	uint32_t val = IRQ_TO_INTR(irq);
+	struct isa_irq_route *route = apic_config.isa_irq + irq;
+
+	if(route->active_low) val |= REDIR_ACTIVE_LOW;
+	if(route->level) val |= REDIR_LEVEL;
+	if(masked) val |= REDIR_MASK;
+
+	ioapic_write(irq_pin[irq].io, IOAPIC_REDIR(irq_pin[irq].pin), val);
+}
+
+static void ioapic_mask(int irq)
+{
+	irq_mask |= 1 << irq;
+	if(irq_pin[irq].io) set_redir(irq, 1);
+}
+
+static void ioapic_unmask(int irq)
+{
+	irq_mask &= ~(1 << irq);
+	if(irq_pin[irq].io) set_redir(irq, 0);
+}
+
+static void ioapic_eoi(int irq)
+{
+	lapic[LAPIC_EOI] = 0;
+}
+
+/* spurious interrupts must not be acknowledged */
+static void spurious_intr(int inum)
+{
+	num_spurious++;
+}
+
+/* measure the local APIC timer frequency against our clock, and make it the
+ * timer interrupt source
+ */
+static void init_lapic_timer(void)
+{
+	uint32_t elapsed;
+
+	lapic[LAPIC_LVT_TIMER] = LVT_MASK;
+	lapic[LAPIC_TMR_DIV] = TMR_DIV16;
+	lapic[LAPIC_TMR_INIT] = 0xffffffff;
+	udelay(10000);
+	elapsed = 0xffffffff - lapic[LAPIC_TMR_CUR];
+	lapic[LAPIC_TMR_INIT] = 0;
+
+	if(!elapsed) return;
+
+	lapic_timer_hz = elapsed * 100;
+	lapic_ns_mult = udiv64((uint64_t)lapic_timer_hz << 32, 1000000000);
+	printf("APIC: timer frequency %lu.%03lu MHz\n", lapic_timer_hz / 1000000,
+			lapic_timer_hz / 1000 % 1000);
+
+	interrupt(APIC_TIMER_INTR, lapic_timer_intr);
+	if(set_timer_evsrc(&lapic_evsrc) == -1) {
+		interrupt(APIC_TIMER_INTR, 0);
+	}
+}
+
+static void lapic_timer_intr(int inum)
+{
+	timer_event();
+	lapic[LAPIC_EOI] = 0;
+}
+
+static void lapic_timer_oneshot(uint64_t delta)
+{
+	uint64_t count = mul_shr(delta, lapic_ns_mult, 32) + 1;
+	if(count > 0xffffffff) count = 0xffffffff;
+
+	lapic[LAPIC_LVT_TIMER] = APIC_TIMER_INTR;
+	lapic[LAPIC_TMR_INIT] = count;
+}
+
+static void lapic_timer_periodic(unsigned long hz)
+{
+	lapic[LAPIC_LVT_TIMER] = APIC_TIMER_INTR | LVT_TMR_PERIODIC;
+	lapic[LAPIC_TMR_INIT] = (lapic_timer_hz + hz / 2) / hz;
+}
+
+static void lapic_timer_stop(void)
+{
+	lapic[LAPIC_LVT_TIMER] = LVT_MASK;
+	lapic[LAPIC_TMR_INIT] = 0;
+}
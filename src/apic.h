@@ -0,0 +1,93 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef APIC_H_
+#define APIC_H_
+
+#include <inttypes.h>
+#include "intr.h"
+#include "config.h"
+
+#define MAX_IOAPICS		4
+
+/* interrupts generated by the local APIC */
+#define APIC_TIMER_INTR		APIC_INTR_BASE
+#define APIC_IPI_INTR		(APIC_INTR_BASE + 1)
+#define APIC_TEST_INTR		(APIC_INTR_BASE + NUM_APIC_INTR - 1)
+#define APIC_SPURIOUS_INTR	255
+
+struct ioapic {
+	int id;
+	volatile uint32_t *regs;
+	int gsi_base, num_pins;
+};
+
+/* where each ISA IRQ is connected to the I/O APICs */
+struct isa_irq_route {
+	int gsi;	/* global system interrupt: I/O APIC gsi_base + pin */
+	int active_low, level;
+};
+
+/* system interrupt configuration, from the ACPI MADT or the MP tables */
+struct apic_config {
+	const char *source;
+	uint32_t lapic_addr;
+	int num_cpus;
+	int cpu_id[MAX_CPUS];	/* local APIC ids of all usable processors */
+	int num_ioapics;
+	struct ioapic ioapic[MAX_IOAPICS];
+	struct isa_irq_route isa_irq[16];
+	int have_pic;	/* 8259 PICs present, which have to be masked */
+	int imcr;		/* has the IMCR, to switch between PIC and APIC mode */
+};
+
+struct apic_config apic_config;
+/* non-zero while IRQs are routed through the I/O APIC */
+int apic_mode;
+/* local APIC timer frequency (bus clock / 16), 0 if not calibrated */
+unsigned long lapic_timer_hz;
+
+/* parse the interrupt configuration tables, switch IRQ routing to the I/O
+ * APIC and the timer to the local APIC timer. Anything missing leaves the
+ * 8259 PICs and the PIT in charge.
+ */
+void init_apic(void);
+
+/* enable the local APIC of the current processor, if the BIOS left it
+ * disabled, in virtual wire mode so that interrupts from the 8259 PICs keep
+ * coming in through LINT0. Returns -1 if there's no usable local APIC.
+ */
+int lapic_enable(void);
+int lapic_id(void);
+void lapic_eoi(void);
+/* send an inter-processor interrupt to the processor with local APIC id dest */
+void lapic_send_ipi(int dest, int inum);
+/* processor startup: INIT, and the startup IPI which starts it in real mode
+ * at addr (4k aligned, below 1MB)
+ */
+void lapic_send_init(int dest);
+void lapic_send_sipi(int dest, uint32_t addr);
+/* set up the local APIC of an application processor */
+void lapic_init_ap(void);
+
+/* route IRQs through the 8259 PICs for the duration of a BIOS call, and back
+ * to the I/O APIC afterwards. Called by int86.
+ */
+void apic_bios_enter(void);
+void apic_bios_exit(void);
+
+#endif	/* APIC_H_ */
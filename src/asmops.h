@@ -77,5 +77,67 @@ static inline uint32_t inl(uint16_t port)
 /* delay for about 1us */
 #define iodelay() outb(0, 0x80)
 
+/* read the time stamp counter. Only available on pentium and later, check
+ * boot_have_tsc (boot.h) before using it.
+ */
+static inline uint64_t rdtsc(void)
+{
+	uint64_t res;
+	asm volatile (
+		"rdtsc\n\t"
+		: "=A" (res));
+	return res;
+}
+
+/* 64bit by 32bit unsigned division, since we don't link with libgcc */
+static inline uint64_t udiv64(uint64_t n, uint32_t d)
+{
+	uint32_t qhi, qlo, rem;
+
+	qhi = (uint32_t)(n >> 32) / d;
+	rem = (uint32_t)(n >> 32) % d;
+	asm (
+		"divl %4\n\t"
+		: "=a" (qlo), "=d" (rem)
+		: "a" ((uint32_t)n), "d" (rem), "rm" (d));
+	return ((uint64_t)qhi << 32) | qlo;
+}
+
+/* (a * m) >> shift, without losing the top bits of the 96bit product. Used
+ * with m as a fixed point scale factor, to avoid 64bit divisions.
+ */
+static inline uint64_t mul_shr(uint64_t a, uint32_t m, int shift)
+{
+	uint64_t lo = (uint64_t)(uint32_t)a * m;
+	uint64_t hi = (a >> 32) * m;
+	return (hi << (32 - shift)) + (lo >> shift);
+}
+
+/* cpuid, rdmsr and wrmsr are not available on all CPUs, see cpuid.h */
+static inline void cpuid(uint32_t leaf, uint32_t *regs)
+{
+	asm volatile (
+		"cpuid\n\t"
+		: "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+		: "a" (leaf), "c" (0));
+}
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+	uint64_t res;
+	asm volatile (
+		"rdmsr\n\t"
+		: "=A" (res)
+		: "c" (msr));
+	return res;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val)
+{
+	asm volatile (
+		"wrmsr\n\t"
+		:: "c" (msr), "A" (val));
+}
+
 
 #endif	/* ASMOPS_H_ */
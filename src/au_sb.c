@@ -21,6 +21,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "asmops.h"
 #include "intr.h"
 #include "dma.h"
+#include "workq.h"
+#include "trace.h"
 
 #define REG_MIXPORT		(base_port + 0x4)
 #define REG_MIXDATA		(base_port + 0x5)
@@ -71,6 +73,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define VER_MINOR(x)	((x) & 0xff)
 
 static void intr_handler();
+static void refill(void *arg);
 static void start_dma_transfer(uint32_t addr, int size);
 static void write_dsp(unsigned char val);
 static unsigned char read_dsp(void);
@@ -89,6 +92,10 @@ static int sb16;
 static void *buffer;
 static int xfer_mode;
 
+/* the buffer is refilled by deferred work, outside the interrupt */
+static struct workq audio_wq;
+static struct work refill_work;
+
 int sb_detect(void)
 {
 	int i, ver;
@@ -124,6 +131,7 @@ int sb_detect(void)
 				printf("sb_detect: old sound blaster dsp. assuming: irq 5, dma 1\n");
 			}
 
+			init_workq(&audio_wq, "audio");
 			return 1;
 		}
 	}
@@ -221,18 +229,29 @@ void sb_volume(int vol)
 }
 
 static void intr_handler()
+{
+	/* acknowledge the interrupt */
+	inb(REG_INTACK);
+
+	trace_instant("sb16 irq");
+	queue_work(&audio_wq, &refill_work, refill, 0);
+}
+
+static void refill(void *arg)
 {
 	int size;
 
+	trace_begin("audio refill");
+
 	/* ask for more data */
 	if(!(size = audio_callback(buffer, 65536))) {
 		sb_stop();
-		return;
+	} else {
+		start_dma_transfer((uint32_t)buffer, size);
 	}
-	start_dma_transfer((uint32_t)buffer, size);
 
-	/* acknowledge the interrupt */
-	inb(REG_INTACK);
+	trace_counter("audio buffer", size);
+	trace_end();
 }
 
 static void start_dma_transfer(uint32_t addr, int size)
@@ -1,7 +1,20 @@
 #ifndef BOOT_H_
 #define BOOT_H_
 
+#include <inttypes.h>
+
 extern unsigned char low_mem_buffer[];
 extern int boot_drive_number;
 
+/* timestamps taken by the second stage boot loader (see bootprof.h) */
+enum {
+	BOOT_TSC_ENTRY,		/* boot2 entry */
+	BOOT_TSC_MEMDET,	/* A20 enabled and memory map detected */
+	BOOT_TSC_LOADED,	/* main program loaded (and unpacked) at 1MB */
+
+	NUM_BOOT_TSC
+};
+extern int boot_have_tsc;
+extern uint64_t boot_tsc[NUM_BOOT_TSC];
+
 #endif	/* BOOT_H_ */
@@ -37,6 +37,16 @@ boot:
 
 	mov %dl, drive_number
 
+	# check for the BIOS extended disk access functions (int 13h, 42h)
+	mov $0x41, %ah
+	mov $0x55aa, %bx
+	int $0x13
+	jc 0f
+	cmp $0xaa55, %bx
+	jnz 0f
+	and $1, %cl
+	mov %cl, have_ext
+0:
 	call get_drive_chs
 
 	mov $loading_msg, %si
@@ -59,7 +69,6 @@ boot:
 	mov $boot2_addr, %bx
 	shr $4, %bx
 	mov %bx, %es
-	xor %bx, %bx
 	call read_sectors
 	jmp boot2_addr
 
@@ -74,6 +83,8 @@ num_cylinders: .short 80
 num_heads: .short 2
 	.global heads_mask
 heads_mask: .byte 1
+	.global have_ext
+have_ext: .byte 0
 
 get_drive_chs:
 	mov $driveno_msg, %si
@@ -122,42 +133,54 @@ ok:	xor %eax, %eax
 	.set ARG_SIDX, 4
 
 # read_sectors(first, num)
+# es:0 must point to the destination, which must not cross a 64k boundary
 read_sectors:
 	push %bp
 	mov %sp, %bp
 
-	mov ARG_SIDX(%bp), %ax
-	xor %cx, %cx
-
-	jmp 1f
-0:	push %ax
-	call read_sector
-	pop %ax
-	inc %ax
-	inc %cx
-1:	cmp ARG_NSECT(%bp), %cx
+0:	call read_chunk
+	add %ax, ARG_SIDX(%bp)
+	sub %ax, ARG_NSECT(%bp)
 	jnz 0b
 
 	pop %bp
 	ret
 
-# read_sector(sidx)
-read_sector:
-	push %bp
-	mov %sp, %bp
-	push %cx
-	push %dx
-
+# reads as many sectors as possible up to the end of the current track, with
+# a single BIOS call. Uses the read_sectors stack frame, and returns the
+# number of sectors read in ax.
+read_chunk:
 	movw $3, read_retries
 
 read_try:
 	# calculate the track (sidx / sectors_per_track)
-	mov 4(%bp), %ax
+	mov ARG_SIDX(%bp), %ax
 
 	xor %dx, %dx
 	mov sect_per_track, %cx
 	div %cx
-	mov %ax, %cx
+	# count: min(sectors left in the track, sectors left to read)
+	sub %dx, %cx
+	cmp ARG_NSECT(%bp), %cx
+	jb 0f
+	mov ARG_NSECT(%bp), %cx
+0:	push %cx
+
+	cmpb $0, have_ext
+	jz 0f
+	# extended read, with the disk address packet on the stack
+	pushl $0
+	pushw $0
+	pushw ARG_SIDX(%bp)
+	push %es
+	pushw $0
+	push %cx
+	pushw $16
+	mov %sp, %si
+	mov $0x42, %ah
+	jmp 1f
+
+0:	mov %ax, %cx
 	# save the remainder
 	push %dx
 	# head in dh
@@ -178,10 +201,17 @@ read_try:
 	inc %al
 	or %al, %cl
 
-	# ah = 2 (read), al = 1 sectors
-	mov $0x0201, %ax
-	movb drive_number, %dl
+	# ah = 2 (read), al = count, to es:0
+	pop %ax
+	push %ax
+	mov $2, %ah
+	xor %bx, %bx
+
+1:	movb drive_number, %dl
 	int $0x13
+	# drop the packet if any, and get the count back, without touching CF
+	lea -4(%bp), %sp
+	pop %ax
 	jnc read_ok
 
 	# abort after 3 attempts
@@ -194,23 +224,20 @@ read_try:
 	jmp read_try
 
 read_fail:
-	mov 4(%bp), %ax
+	mov ARG_SIDX(%bp), %ax
 	jmp abort_read
 
 read_ok:
+	# advance es past the sectors read
+	push %ax
+	shl $5, %ax
+	mov %es, %dx
+	add %ax, %dx
+	mov %dx, %es
+
 	mov $46, %ax
 	call print_char
-
-	# increment es:bx accordingly (advance es if bx overflows)
-	add $512, %bx
-	jnc 0f
-	mov %es, %ax
-	add $4096, %ax
-	mov %ax, %es
-
-0:	pop %dx
-	pop %cx
-	pop %bp
+	pop %ax
 	ret
 
 str_read_error: .asciz "rderr:"
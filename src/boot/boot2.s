@@ -22,6 +22,10 @@
 
 	.set main_load_addr, 0x100000
 	.set drive_number, 0x7bec
+	# "LZ4K": the main program is LZ4-compressed (see tools/lz4/lz4img.c)
+	.set LZ4K_MAGIC, 0x4b345a4c
+	# max sectors per BIOS read call (32k), some BIOSes can't do more than 127
+	.set MAX_READ_SECT, 64
 
 	# make sure any BIOS call didn't re-enable interrupts
 	cli
@@ -30,6 +34,11 @@
 	mov drive_number, %al
 	mov %eax, boot_drive_number
 
+	# first boot profile timestamp (see bootprof.h)
+	call detect_tsc
+	xor %ebx, %ebx
+	call stamp_tsc
+
 	call setup_serial
 
 	# enter unreal mode
@@ -45,9 +54,13 @@
 
 	# detect available memory
 	call detect_memory
+	mov $1, %ebx
+	call stamp_tsc
 
 	# load the whole program into memory starting at 1MB
 	call load_main
+	mov $2, %ebx
+	call stamp_tsc
 
 	# load initial GDT
 	lgdt (gdt_lim)
@@ -154,16 +167,31 @@ unreal:
 mainsz_msg: .asciz "Main program size: "
 mainsz_msg2: .asciz " ("
 mainsz_msg3: .asciz " sectors)\n"
+mainz_msg: .asciz "Compressed main program, uncompressed size: "
 
 first_sect: .long 0
 sect_left: .long 0
 cur_track: .long 0
 trk_sect: .long 0
 dest_ptr: .long 0
+lz4_src: .long 0
+lz4_size: .long 0
+ldbuf: .long 0
 
 load_main:
 	movl $main_load_addr, dest_ptr
 
+	# pick a load buffer which reads of up to MAX_READ_SECT sectors won't
+	# cross a 64k boundary with, as required for floppy DMA
+	mov $buffer, %eax
+	mov %eax, %ecx
+	and $0xffff, %ecx
+	cmp $0x10000 - MAX_READ_SECT * 512, %ecx
+	jbe 0f
+	add $0xffff, %eax
+	and $0xffff0000, %eax
+0:	mov %eax, ldbuf
+
 	# calculate first sector
 	mov $_boot2_size, %eax
 	add $511, %eax
@@ -180,10 +208,44 @@ load_main:
 	# remainder is sector within track
 	mov %edx, trk_sect
 
+	# read the first sector, to see if the main program is compressed
+	pushl $1
+	call read_track
+	add $4, %esp
+
+	movl $0, lz4_size
+	mov ldbuf, %ebx
+	cmpl $LZ4K_MAGIC, (%ebx)
+	jnz 0f
+
+	# compressed: header is magic, compressed size, uncompressed size. Load
+	# it right after where the uncompressed program will end up, and
+	# decompress it to main_load_addr afterwards.
+	mov $mainz_msg, %esi
+	call putstr
+	mov 8(%ebx), %eax
+	mov %eax, lz4_size
+	call print_num
+	mov $10, %al
+	call putchar
+
+	mov lz4_size, %eax
+	add $main_load_addr + 0xfff, %eax
+	and $0xfffff000, %eax
+	mov %eax, dest_ptr
+	mov %eax, lz4_src
+
 	mov $mainsz_msg, %esi
+	call putstr
+	mov ldbuf, %ebx
+	mov 4(%ebx), %eax
+	add $12, %eax
+	jmp 1f
+
+0:	mov $mainsz_msg, %esi
 	call putstr
 	mov $_main_size, %eax
-	mov %eax, %ecx
+1:	mov %eax, %ecx
 	call print_num
 
 	mov $mainsz_msg2, %esi
@@ -198,21 +260,32 @@ load_main:
 	mov $mainsz_msg3, %esi
 	call putstr
 
-	# read a whole track into the buffer (or partial first track)
+	# read as much as possible with each call: the rest of the track with
+	# CHS reads, or MAX_READ_SECT sectors with extended LBA reads
 ldloop:
-	movzxw sect_per_track, %ecx
-	sub trk_sect, %ecx
-	push %ecx
+	mov sect_left, %ecx
+	cmp $MAX_READ_SECT, %ecx
+	jbe 0f
+	mov $MAX_READ_SECT, %ecx
+0:	cmpb $0, have_ext
+	jnz 0f
+	movzxw sect_per_track, %eax
+	sub trk_sect, %eax
+	cmp %eax, %ecx
+	jbe 0f
+	mov %eax, %ecx
+0:	push %ecx
 	call read_track
 
 	# debug: print the first 32bits of the track
-	#mov buffer, %eax
+	#mov ldbuf, %eax
+	#mov (%eax), %eax
 	#call print_num
 	#mov $10, %al
 	#call putchar
 
 	# copy to high memory
-	mov $buffer, %esi
+	mov ldbuf, %esi
 	mov dest_ptr, %edi
 	mov (%esp), %ecx
 	shl $9, %ecx
@@ -220,9 +293,16 @@ ldloop:
 	shr $2, %ecx
 	addr32 rep movsl
 
+	# advance to the next sector, which might be in the next track(s)
+	mov (%esp), %ecx
+	add trk_sect, %ecx
+	movzxw sect_per_track, %eax
+0:	cmp %eax, %ecx
+	jb 1f
+	sub %eax, %ecx
 	incl cur_track
-	# other than the first track which might be partial, all the rest start from 0
-	movl $0, trk_sect
+	jmp 0b
+1:	mov %ecx, trk_sect
 
 	pop %ecx
 	sub %ecx, sect_left
@@ -244,8 +324,91 @@ ldloop:
 	mov $10, %ax
 	call putchar
 
+	cmpl $0, lz4_size
+	jz 0f
+	call unpack_main
+0:
 	ret
 
+unpack_msg: .asciz "Decompressing main program ... "
+unpack_fail_msg: .asciz "failed, size: "
+
+	# decompress the LZ4 block loaded at lz4_src to main_load_addr
+unpack_main:
+	mov $unpack_msg, %esi
+	call putstr
+
+	cld
+	mov lz4_src, %esi
+	mov 4(%esi), %ebp
+	add $12, %esi
+	# ebp: end of the compressed data
+	add %esi, %ebp
+	mov $main_load_addr, %edi
+
+lz4_loop:
+	cmp %ebp, %esi
+	jae lz4_done
+	movzbl (%esi), %ebx
+	inc %esi
+
+	# copy literals, length in the top 4 bits of the token
+	mov %ebx, %ecx
+	shr $4, %ecx
+	call lz4_len
+	addr32 rep movsb
+
+	# the last sequence has only literals
+	cmp %ebp, %esi
+	jae lz4_done
+
+	# match offset in edx, length in the low 4 bits of the token (+4)
+	movzwl (%esi), %edx
+	add $2, %esi
+	mov %ebx, %ecx
+	and $0xf, %ecx
+	call lz4_len
+	add $4, %ecx
+
+	# byte by byte copy from the already decompressed data. Matches may
+	# overlap the destination, which repeats the last offset bytes.
+	push %esi
+	mov %edi, %esi
+	sub %edx, %esi
+	addr32 rep movsb
+	pop %esi
+	jmp lz4_loop
+
+lz4_done:
+	sub $main_load_addr, %edi
+	cmp lz4_size, %edi
+	jnz unpack_fail
+	mov $rdok_msg, %esi
+	call putstr
+	ret
+
+unpack_fail:
+	mov $unpack_fail_msg, %esi
+	call putstr
+	mov %edi, %eax
+	call print_num
+	mov $10, %al
+	call putchar
+0:	hlt
+	jmp 0b
+
+	# lengths of 15 are followed by extra bytes added to them, until one
+	# is not 255
+lz4_len:
+	cmp $15, %ecx
+	jnz 1f
+0:	movzbl (%esi), %eax
+	inc %esi
+	add %eax, %ecx
+	cmp $255, %eax
+	jz 0b
+1:	ret
+
 rdtrk_msg: .asciz "Reading track: "
 rdcyl_msg: .asciz " - cyl: "
 rdhead_msg: .asciz " head: "
@@ -254,19 +417,61 @@ rdlast_msg: .asciz " ... "
 rdok_msg: .asciz "OK\n"
 rdfail_msg: .asciz "failed\n"
 
+rdlba_msg: .asciz "Reading LBA: "
+rdcount_msg: .asciz " count: "
+
 read_retries: .short 0
 
+	# disk address packet for extended reads
+	.align 4
+dap:	.byte 16, 0
+dap_count: .short 0
+dap_offs: .short 0
+dap_seg: .short 0
+dap_lba: .long 0, 0
+
+	# read_track(count): reads count sectors starting from cur_track/trk_sect
+	# into the load buffer.
 read_track:
 	# set es to the start of the destination buffer to allow reading in
 	# full 64k chunks if necessary
-	mov $buffer, %bx
-	shr $4, %bx
+	mov ldbuf, %ebx
+	shr $4, %ebx
 	mov %bx, %es
 	xor %ebx, %ebx
 
 	movw $3, read_retries
 
 read_try:
+	cmpb $0, have_ext
+	jz read_try_chs
+
+	# extended read: LBA is cur_track * sect_per_track + trk_sect
+	mov $rdlba_msg, %esi
+	call putstr
+	mov cur_track, %eax
+	movzxw sect_per_track, %ecx
+	mul %ecx
+	add trk_sect, %eax
+	mov %eax, dap_lba
+	call print_num
+	mov $rdcount_msg, %esi
+	call putstr
+	movzwl 2(%esp), %eax
+	mov %ax, dap_count
+	call print_num
+	mov $rdlast_msg, %esi
+	call putstr
+
+	mov %es, dap_seg
+	mov $dap, %si
+	mov $0x42, %ah
+	movb drive_number, %dl
+	int $0x13
+	jnc read_ok
+	jmp read_err
+
+read_try_chs:
 	# print track
 	mov $rdtrk_msg, %esi
 	call putstr
@@ -323,6 +528,7 @@ read_try:
 	int $0x13
 	jnc read_ok
 
+read_err:
 	# abort after 3 attempts
 	decw read_retries
 	jz read_fail
@@ -603,6 +809,41 @@ kbc_wait_write:
 numbuf: .space 16
 
 
+	# sets boot_have_tsc if the CPU has a time stamp counter
+detect_tsc:
+	# CPUID is available if we can toggle the ID flag (bit 21) in EFLAGS
+	pushfl
+	pop %eax
+	mov %eax, %ecx
+	xor $0x200000, %eax
+	push %eax
+	popfl
+	pushfl
+	pop %eax
+	push %ecx
+	popfl
+	xor %ecx, %eax
+	jz 0f
+	# CPUID 1: TSC feature flag in edx bit 4
+	mov $1, %eax
+	# cpuid (not accepted by the assembler with -march=i386)
+	.byte 0x0f, 0xa2
+	and $0x10, %edx
+	jz 0f
+	movl $1, boot_have_tsc
+0:	ret
+
+	# store a timestamp in boot_tsc[ebx], if we have a TSC
+stamp_tsc:
+	cmpl $0, boot_have_tsc
+	jz 0f
+	# rdtsc
+	.byte 0x0f, 0x31
+	mov %eax, boot_tsc(,%ebx,8)
+	mov %edx, boot_tsc + 4(,%ebx,8)
+0:	ret
+
+
 detect_memory:
 	mov $memdet_e820_msg, %esi
 	call putstr
@@ -795,6 +1036,12 @@ boot_mem_map: .space 128
 boot_drive_number:
 	.long 0
 
+	# boot profile timestamps taken by the second stage loader
+	.global boot_have_tsc
+boot_have_tsc: .long 0
+	.global boot_tsc
+boot_tsc: .space 8 * 3
+
 	# buffer used by the track loader ... to load tracks.
 	.align 16
 buffer:
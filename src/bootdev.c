@@ -23,6 +23,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "panic.h"
 #include "timer.h"
 #include "floppy.h"
+#include "trace.h"
 
 #define FLOPPY_MOTOR_OFF_TIMEOUT	4000
 #define DBG_RESET_ON_FAIL
@@ -48,10 +49,13 @@ static int bios_rw_sect_lba(int dev, uint64_t lba, int nsect, int op, void *buf)
 static int bios_rw_sect_chs(int dev, struct chs *chs, int nsect, int op, void *buf);
 static int get_drive_chs(int dev, struct chs *chs);
 static void calc_chs(uint64_t lba, struct chs *chs);
+static void motors_off(void *ctx);
+static int read_range(uint64_t lba, int nsect, void *buf);
 
 static int have_bios_ext;
 static int bdev_is_floppy;
 static int num_cyl, num_heads, num_track_sect;
+static struct alarm motor_alarm;
 
 void bdev_init(void)
 {
@@ -94,8 +98,7 @@ int bdev_read_sect(uint64_t lba, void *buf)
 	struct chs chs;
 
 	if(bdev_is_floppy) {
-		cancel_alarm(floppy_motors_off);
-		set_alarm(FLOPPY_MOTOR_OFF_TIMEOUT, floppy_motors_off);
+		set_alarm(&motor_alarm, FLOPPY_MOTOR_OFF_TIMEOUT, motors_off, 0);
 	}
 
 	if(have_bios_ext) {
@@ -120,8 +123,7 @@ int bdev_write_sect(uint64_t lba, void *buf)
 	struct chs chs;
 
 	if(bdev_is_floppy) {
-		cancel_alarm(floppy_motors_off);
-		set_alarm(FLOPPY_MOTOR_OFF_TIMEOUT, floppy_motors_off);
+		set_alarm(&motor_alarm, FLOPPY_MOTOR_OFF_TIMEOUT, motors_off, 0);
 	}
 
 	if(have_bios_ext) {
@@ -133,13 +135,23 @@ int bdev_write_sect(uint64_t lba, void *buf)
 }
 
 int bdev_read_range(uint64_t lba, int nsect, void *buf)
+{
+	int res;
+
+	trace_begin("bdev_read_range");
+	trace_counter("bdev_read_range sectors", nsect);
+	res = read_range(lba, nsect, buf);
+	trace_end();
+	return res;
+}
+
+static int read_range(uint64_t lba, int nsect, void *buf)
 {
 	int i;
 	struct chs chs;
 
 	if(bdev_is_floppy) {
-		cancel_alarm(floppy_motors_off);
-		set_alarm(FLOPPY_MOTOR_OFF_TIMEOUT, floppy_motors_off);
+		set_alarm(&motor_alarm, FLOPPY_MOTOR_OFF_TIMEOUT, motors_off, 0);
 	}
 
 	if(have_bios_ext) {
@@ -173,8 +185,7 @@ int bdev_write_range(uint64_t lba, int nsect, void *buf)
 	struct chs chs;
 
 	if(bdev_is_floppy) {
-		cancel_alarm(floppy_motors_off);
-		set_alarm(FLOPPY_MOTOR_OFF_TIMEOUT, floppy_motors_off);
+		set_alarm(&motor_alarm, FLOPPY_MOTOR_OFF_TIMEOUT, motors_off, 0);
 	}
 
 	if(have_bios_ext) {
@@ -323,3 +334,8 @@ static void calc_chs(uint64_t lba, struct chs *chs)
 	chs->cyl = trk / num_heads;
 	chs->head = trk % num_heads;
 }
+
+static void motors_off(void *ctx)
+{
+	floppy_motors_off();
+}
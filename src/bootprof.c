@@ -0,0 +1,87 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include "bootprof.h"
+#include "boot.h"
+#include "asmops.h"
+#include "timer.h"
+
+static const char *boot_tsc_name[] = {
+	"boot2 entry",
+	"A20 and memory detection",
+	"main program load"
+};
+
+void bprof_init(void)
+{
+	int i;
+
+	if(!(boot_profile.have_tsc = boot_have_tsc)) {
+		return;
+	}
+
+	for(i=0; i<NUM_BOOT_TSC; i++) {
+		boot_profile.phase[i].name = boot_tsc_name[i];
+		boot_profile.phase[i].tsc = boot_tsc[i];
+	}
+	boot_profile.num_phases = NUM_BOOT_TSC;
+
+	bprof_mark("protected mode switch");
+}
+
+void bprof_mark(const char *name)
+{
+	struct bprof_phase *ph;
+
+	if(!boot_profile.have_tsc || boot_profile.num_phases >= BPROF_MAX_PHASES) {
+		return;
+	}
+	ph = boot_profile.phase + boot_profile.num_phases++;
+	ph->name = name;
+	ph->tsc = rdtsc();
+}
+
+void bprof_print(void)
+{
+	int i, pct;
+	unsigned long kcyc, total, usec;
+	uint64_t dt;
+	struct bprof_phase *ph = boot_profile.phase;
+
+	if(!boot_profile.have_tsc) {
+		printf("bootprof: no TSC, boot profile not available\n");
+		return;
+	}
+	if(boot_profile.num_phases < 2) return;
+
+	/* no 64bit division, count in units of 1024 cycles */
+	total = (ph[boot_profile.num_phases - 1].tsc - ph[0].tsc) >> 10;
+
+	/* usec are only known after the TSC is calibrated by init_timer */
+	printf("bootprof:  Kcycles      usec  pct  phase\n");
+	for(i=1; i<boot_profile.num_phases; i++) {
+		dt = ph[i].tsc - ph[i - 1].tsc;
+		kcyc = dt >> 10;
+		usec = cpu_freq_hz ? udiv64(cycles_to_ns(dt), 1000) : 0;
+		pct = total ? kcyc * 100 / total : 0;
+		printf("bootprof: %8lu  %8lu  %3d%c  %s\n", kcyc, usec, pct, '%', ph[i].name);
+	}
+	dt = ph[boot_profile.num_phases - 1].tsc - ph[0].tsc;
+	usec = cpu_freq_hz ? udiv64(cycles_to_ns(dt), 1000) : 0;
+	printf("bootprof: %8lu  %8lu  100%c  total\n", total, usec, '%');
+}
@@ -0,0 +1,52 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef BOOTPROF_H_
+#define BOOTPROF_H_
+
+#include <inttypes.h>
+
+#define BPROF_MAX_PHASES	32
+
+/* each phase ends at the timestamp tsc, and starts at the previous one */
+struct bprof_phase {
+	const char *name;
+	uint64_t tsc;
+};
+
+/* boot time profile, from the entry of the second stage boot loader up to the
+ * end of kernel initialization. Without a TSC (pre-pentium CPUs), have_tsc is
+ * 0 and no phases are recorded.
+ */
+struct boot_profile {
+	int have_tsc;
+	int num_phases;
+	struct bprof_phase phase[BPROF_MAX_PHASES];
+};
+
+struct boot_profile boot_profile;
+
+/* import the boot loader timestamps. Must be called first thing in the kernel */
+void bprof_init(void);
+/* mark the end of a boot phase */
+void bprof_mark(const char *name);
+/* prints the boot profile, one "bootprof:" line per phase, in Kcycles and in
+ * microseconds if the TSC frequency is known.
+ */
+void bprof_print(void);
+
+#endif	/* BOOTPROF_H_ */
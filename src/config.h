@@ -20,6 +20,42 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 /* frequency of generated timer ticks in hertz */
 #define TICK_FREQ_HZ		250
+/* instead of interrupting at TICK_FREQ_HZ, program the PIT in one-shot mode to
+ * fire at the next pending alarm. Needs a TSC, otherwise the timer falls back
+ * to periodic ticks.
+ */
+#define TIMER_TICKLESS
+/* route interrupts through the I/O APIC and use the local APIC timer, when
+ * available. Otherwise the 8259 PICs and the PIT are used.
+ */
+#define USE_APIC
+
+/* keep per-interrupt counts and handler times (see intr.h) */
+#define INTR_STATS
+
+/* size of the sampling profiler buffer in kilobytes (see prof.h), and the
+ * maximum number of addresses recorded in each sample with PROF_BACKTRACE.
+ * Backtraces need frame pointers, keep -fno-omit-frame-pointer in the
+ * Makefile when building with optimizations.
+ */
+#define PROF_BUF_SIZE		256
+#define PROF_MAX_DEPTH		16
+
+/* number of events kept by each processor's trace buffer (see trace.h), must
+ * be a power of two
+ */
+#define TRACE_BUF_SIZE		8192
+
+/* maximum number of processors started by init_smp */
+#define MAX_CPUS			16
+
+/* size of the FAT sector cache of each mounted FAT filesystem in kilobytes */
+#define FAT_CACHE_SIZE		64
+/* prefetch the part of the FAT covering a file when it's opened */
+#define FAT_PREFETCH
+
+/* number of entries in the path lookup cache */
+#define DCACHE_SIZE			512
 
 #define CON_TEXTMODE
 #define CON_SERIAL
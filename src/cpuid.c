@@ -0,0 +1,91 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include "cpuid.h"
+#include "asmops.h"
+
+#define FLAGS_ID	0x200000
+
+static int toggle_flag(uint32_t mask);
+
+void init_cpuid(void)
+{
+	uint32_t regs[4];
+
+	memset(&cpu_info, 0, sizeof cpu_info);
+
+	/* CPUID is available if we can toggle the ID flag in EFLAGS */
+	if(!toggle_flag(FLAGS_ID)) {
+		cpu_info.family = 4;	/* could be a 386 as well, doesn't matter */
+		return;
+	}
+	cpu_info.have_cpuid = 1;
+
+	cpuid(0, regs);
+	cpu_info.max_leaf = regs[0];
+	memcpy(cpu_info.vendor, regs + 1, 4);
+	memcpy(cpu_info.vendor + 4, regs + 3, 4);
+	memcpy(cpu_info.vendor + 8, regs + 2, 4);
+
+	if(cpu_info.max_leaf >= 1) {
+		cpuid(1, regs);
+		cpu_info.stepping = regs[0] & 0xf;
+		cpu_info.model = (regs[0] >> 4) & 0xf;
+		cpu_info.family = (regs[0] >> 8) & 0xf;
+		if(cpu_info.family == 0xf) {
+			cpu_info.family += (regs[0] >> 20) & 0xff;
+		}
+		if(cpu_info.family >= 6) {
+			cpu_info.model |= (regs[0] >> 12) & 0xf0;
+		}
+		cpu_info.feat_ecx = regs[2];
+		cpu_info.feat = regs[3];
+	}
+
+	cpuid(0x80000000, regs);
+	if((regs[0] & 0xffff0000) == 0x80000000) {
+		cpu_info.max_extleaf = regs[0];
+		if(regs[0] >= 0x80000007) {
+			cpuid(0x80000007, regs);
+			cpu_info.feat_pm = regs[3];
+		}
+	}
+}
+
+/* try to toggle a bit in EFLAGS, returns non-zero if it can be changed */
+static int toggle_flag(uint32_t mask)
+{
+	uint32_t diff;
+
+	asm volatile (
+		"pushf\n\t"
+		"pop %%eax\n\t"
+		"mov %%eax, %%ecx\n\t"
+		"xor %1, %%eax\n\t"
+		"push %%eax\n\t"
+		"popf\n\t"
+		"pushf\n\t"
+		"pop %%eax\n\t"
+		"push %%ecx\n\t"
+		"popf\n\t"
+		"xor %%ecx, %%eax\n\t"
+		: "=&a" (diff)
+		: "r" (mask)
+		: "ecx", "cc");
+	return diff & mask;
+}
@@ -0,0 +1,50 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef CPUID_H_
+#define CPUID_H_
+
+#include <inttypes.h>
+
+/* cpuid leaf 1 feature flags in edx */
+#define CPUID_FEAT_FPU		0x00000001
+#define CPUID_FEAT_TSC		0x00000010
+#define CPUID_FEAT_MSR		0x00000020
+#define CPUID_FEAT_APIC		0x00000200
+#define CPUID_FEAT_SSE2		0x04000000
+/* cpuid leaf 0x80000007 edx: TSC runs at a constant rate */
+#define CPUID_FEAT_INVTSC	0x00000100
+
+struct cpu_info {
+	int have_cpuid;
+	uint32_t max_leaf, max_extleaf;
+	char vendor[13];
+	int family, model, stepping;
+	uint32_t feat, feat_ecx;	/* leaf 1 edx and ecx */
+	uint32_t feat_pm;			/* leaf 0x80000007 edx (power management) */
+};
+
+struct cpu_info cpu_info;
+
+/* detect CPUID and fill cpu_info. Without CPUID (386 and early 486), only the
+ * family is set.
+ */
+void init_cpuid(void);
+
+#define CPU_HAS(f)	(cpu_info.feat & CPUID_FEAT_##f)
+
+#endif	/* CPUID_H_ */
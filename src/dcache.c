@@ -0,0 +1,275 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "dcache.h"
+#include "config.h"
+
+#define HTAB_SIZE	(DCACHE_SIZE * 2)
+
+struct dcache_entry {
+	struct filesys *fs;
+	intptr_t parent;
+	unsigned int hash;
+	int negative;
+	int size;
+	char name[DCACHE_NAME_MAX + 1];
+	unsigned char data[DCACHE_DATA_SIZE];
+
+	struct dcache_entry *next;				/* hash chain, or free list */
+	struct dcache_entry *lru_prev, *lru_next;
+};
+
+static unsigned int calc_hash(struct filesys *fs, intptr_t parent, const char *name);
+static struct dcache_entry *find(struct filesys *fs, intptr_t parent, const char *name, unsigned int hash);
+static void unlink_entry(struct dcache_entry *ent);
+static void lru_remove(struct dcache_entry *ent);
+static void lru_push(struct dcache_entry *ent);
+
+/* entries are allocated from a fixed pool, the least recently used is evicted
+ * when it runs out.
+ */
+static struct dcache_entry pool[DCACHE_SIZE];
+static struct dcache_entry *htab[HTAB_SIZE];
+static struct dcache_entry *freelist;
+static struct dcache_entry *lru_head, *lru_tail;	/* head is most recent */
+static int initialized;
+
+static struct dcache_stats stats;
+
+static void init(void)
+{
+	int i;
+
+	for(i=0; i<DCACHE_SIZE - 1; i++) {
+		pool[i].next = pool + i + 1;
+	}
+	freelist = pool;
+	initialized = 1;
+}
+
+int dcache_lookup(struct filesys *fs, intptr_t parent, const char *name, void *data)
+{
+	struct dcache_entry *ent;
+
+	if(!initialized) init();
+
+	stats.lookups++;
+	if(!(ent = find(fs, parent, name, calc_hash(fs, parent, name)))) {
+		return DCACHE_MISS;
+	}
+
+	lru_remove(ent);
+	lru_push(ent);
+
+	if(ent->negative) {
+		stats.neg_hits++;
+		return DCACHE_NEGATIVE;
+	}
+	stats.hits++;
+	if(data) {
+		memcpy(data, ent->data, ent->size);
+	}
+	return DCACHE_HIT;
+}
+
+void dcache_add(struct filesys *fs, intptr_t parent, const char *name, const void *data, int size)
+{
+	unsigned int hash;
+	struct dcache_entry *ent;
+
+	if(strlen(name) > DCACHE_NAME_MAX || size > DCACHE_DATA_SIZE) {
+		return;
+	}
+	if(!initialized) init();
+
+	hash = calc_hash(fs, parent, name);
+	if((ent = find(fs, parent, name, hash))) {
+		lru_remove(ent);
+	} else {
+		if(freelist) {
+			ent = freelist;
+			freelist = ent->next;
+			stats.num_entries++;
+		} else {
+			ent = lru_tail;
+			lru_remove(ent);
+			unlink_entry(ent);
+			stats.evictions++;
+		}
+		ent->fs = fs;
+		ent->parent = parent;
+		ent->hash = hash;
+		strcpy(ent->name, name);
+
+		ent->next = htab[hash % HTAB_SIZE];
+		htab[hash % HTAB_SIZE] = ent;
+	}
+
+	if(data) {
+		ent->negative = 0;
+		ent->size = size;
+		memcpy(ent->data, data, size);
+	} else {
+		ent->negative = 1;
+	}
+	lru_push(ent);
+}
+
+void dcache_remove(struct filesys *fs, intptr_t parent, const char *name)
+{
+	struct dcache_entry *ent;
+
+	if(!initialized) return;
+
+	if((ent = find(fs, parent, name, calc_hash(fs, parent, name)))) {
+		lru_remove(ent);
+		unlink_entry(ent);
+		ent->next = freelist;
+		freelist = ent;
+		stats.num_entries--;
+	}
+}
+
+void dcache_purge_dir(struct filesys *fs, intptr_t parent)
+{
+	struct dcache_entry *ent, *next;
+
+	if(!initialized) return;
+
+	ent = lru_head;
+	while(ent) {
+		next = ent->lru_next;
+		if(ent->fs == fs && ent->parent == parent) {
+			lru_remove(ent);
+			unlink_entry(ent);
+			ent->next = freelist;
+			freelist = ent;
+			stats.num_entries--;
+		}
+		ent = next;
+	}
+}
+
+void dcache_purge_fs(struct filesys *fs)
+{
+	struct dcache_entry *ent, *next;
+
+	if(!initialized) return;
+
+	ent = lru_head;
+	while(ent) {
+		next = ent->lru_next;
+		if(ent->fs == fs) {
+			lru_remove(ent);
+			unlink_entry(ent);
+			ent->next = freelist;
+			freelist = ent;
+			stats.num_entries--;
+		}
+		ent = next;
+	}
+}
+
+void dcache_get_stats(struct dcache_stats *st)
+{
+	*st = stats;
+}
+
+void dcache_print_stats(void)
+{
+	unsigned long hits = stats.hits + stats.neg_hits;
+
+	printf("dcache: %d/%d entries, %lu lookups, %lu hits (%lu negative), %lu evictions\n",
+			stats.num_entries, DCACHE_SIZE, stats.lookups, hits, stats.neg_hits,
+			stats.evictions);
+	if(stats.lookups) {
+		printf("dcache: hit rate %lu%%\n", hits * 100 / stats.lookups);
+	}
+}
+
+static unsigned int calc_hash(struct filesys *fs, intptr_t parent, const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	h = (h ^ (unsigned int)(intptr_t)fs) * 16777619u;
+	h = (h ^ (unsigned int)parent) * 16777619u;
+	while(*name) {
+		h = (h ^ (unsigned char)tolower(*name++)) * 16777619u;
+	}
+	return h;
+}
+
+static struct dcache_entry *find(struct filesys *fs, intptr_t parent, const char *name, unsigned int hash)
+{
+	struct dcache_entry *ent = htab[hash % HTAB_SIZE];
+
+	while(ent) {
+		if(ent->hash == hash && ent->fs == fs && ent->parent == parent &&
+				strcasecmp(ent->name, name) == 0) {
+			return ent;
+		}
+		ent = ent->next;
+	}
+	return 0;
+}
+
+/* remove from the hash chain */
+static void unlink_entry(struct dcache_entry *ent)
+{
+	struct dcache_entry dummy, *prev;
+
+	dummy.next = htab[ent->hash % HTAB_SIZE];
+	prev = &dummy;
+	while(prev->next) {
+		if(prev->next == ent) {
+			prev->next = ent->next;
+			break;
+		}
+		prev = prev->next;
+	}
+	htab[ent->hash % HTAB_SIZE] = dummy.next;
+}
+
+static void lru_remove(struct dcache_entry *ent)
+{
+	if(ent->lru_prev) {
+		ent->lru_prev->lru_next = ent->lru_next;
+	} else {
+		lru_head = ent->lru_next;
+	}
+	if(ent->lru_next) {
+		ent->lru_next->lru_prev = ent->lru_prev;
+	} else {
+		lru_tail = ent->lru_prev;
+	}
+	ent->lru_prev = ent->lru_next = 0;
+}
+
+static void lru_push(struct dcache_entry *ent)
+{
+	ent->lru_prev = 0;
+	ent->lru_next = lru_head;
+	if(lru_head) {
+		lru_head->lru_prev = ent;
+	} else {
+		lru_tail = ent;
+	}
+	lru_head = ent;
+}
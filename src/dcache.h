@@ -0,0 +1,65 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef DCACHE_H_
+#define DCACHE_H_
+
+#include <stddef.h>
+#include "fs.h"
+
+/* Path lookup cache, shared by all filesystems. Maps a (filesystem, parent
+ * directory, name) triple to a small filesystem-specific blob describing the
+ * child, which lets open skip searching the parent directory. The parent key
+ * is whatever identifies a directory in that filesystem (node pointer, first
+ * cluster, etc). Negative entries record names known not to exist.
+ * Names are compared case-insensitively.
+ */
+
+#define DCACHE_NAME_MAX		47	/* longer names are not cached */
+#define DCACHE_DATA_SIZE	48
+
+enum {
+	DCACHE_MISS = -1,
+	DCACHE_NEGATIVE = 0,
+	DCACHE_HIT = 1
+};
+
+struct dcache_stats {
+	unsigned long lookups, hits, neg_hits;
+	unsigned long evictions;
+	int num_entries;
+};
+
+/* returns DCACHE_HIT and copies the cached data to data (if not null),
+ * DCACHE_NEGATIVE if the name is known not to exist, or DCACHE_MISS.
+ * data must have room for as many bytes as were passed to dcache_add.
+ */
+int dcache_lookup(struct filesys *fs, intptr_t parent, const char *name, void *data);
+/* add or replace an entry. A null data pointer adds a negative entry */
+void dcache_add(struct filesys *fs, intptr_t parent, const char *name, const void *data, int size);
+
+/* invalidation, must be called by filesystems when names are added, removed
+ * or renamed, or the data stored for them becomes stale.
+ */
+void dcache_remove(struct filesys *fs, intptr_t parent, const char *name);
+void dcache_purge_dir(struct filesys *fs, intptr_t parent);
+void dcache_purge_fs(struct filesys *fs);
+
+void dcache_get_stats(struct dcache_stats *st);
+void dcache_print_stats(void);
+
+#endif	/* DCACHE_H_ */
@@ -26,10 +26,15 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 struct filesys *fsfat_create(int dev, uint64_t start, uint64_t size);
 struct filesys *fsmem_create(int dev, uint64_t start, uint64_t size);
+struct filesys *fspak_create(int dev, uint64_t start, uint64_t size);
 
+/* probed in order. PAK comes last, since probing a block device for it costs
+ * a page allocation and a sector read on every FAT mount otherwise.
+ */
 static struct filesys *(*createfs[])(int, uint64_t, uint64_t) = {
 	fsmem_create,
-	fsfat_create
+	fsfat_create,
+	fspak_create
 };
 
 struct filesys *fs_mount(int dev, uint64_t start, uint64_t size, struct fs_node *parent)
@@ -230,6 +235,28 @@ int fs_write(struct fs_node *node, void *buf, int sz)
 	return fsop->write(node, buf, sz);
 }
 
+void *fs_map(struct fs_node *node, long offs, long len)
+{
+	struct fs_operations *fsop = node->fs->fsop;
+
+	if(node->type != FSNODE_FILE || !fsop->map) {
+		errno = EINVAL;
+		return 0;
+	}
+	return fsop->map(node, offs, len);
+}
+
+int fs_unmap(struct fs_node *node, void *ptr)
+{
+	struct fs_operations *fsop = node->fs->fsop;
+
+	if(node->type != FSNODE_FILE || !fsop->unmap) {
+		errno = EINVAL;
+		return -1;
+	}
+	return fsop->unmap(node, ptr);
+}
+
 int fs_rewinddir(struct fs_node *node)
 {
 	struct fs_operations *fsop = node->fs->fsop;
@@ -26,12 +26,14 @@ enum {
 	DEV_FLOPPY1		= 1,
 	DEV_HDD0		= 0x80,
 	DEV_HDD1		= 0x81,
-	DEV_MEMDISK		= 0x10000
+	DEV_MEMDISK		= 0x10000,
+	DEV_MEMPAK		= 0x10001	/* asset archive in memory, start is its address */
 };
 
 enum {
 	FSTYPE_MEM,
 	FSTYPE_FAT,
+	FSTYPE_PAK,
 
 	NUM_FSTYPES
 };
@@ -67,6 +69,9 @@ struct fs_operations {
 
 	int (*rename)(struct fs_node *node, const char *name);
 	int (*remove)(struct fs_node *node);
+
+	void *(*map)(struct fs_node *node, long offs, long len);
+	int (*unmap)(struct fs_node *node, void *ptr);
 };
 
 struct filesys {
@@ -94,6 +99,13 @@ struct fs_dirent {
 struct filesys *rootfs;
 struct fs_node *cwdnode;	/* current working directory node */
 
+/* asset archive linked into the kernel image (see tools/mkpak). To mount it:
+ * fs_mount(DEV_MEMPAK, (intptr_t)pak_start, pak_end - pak_start, node). An
+ * archive stored as a file on another filesystem can be mounted the same way,
+ * through a pointer returned by fs_map.
+ */
+extern char pak_start[], pak_end[];
+
 struct filesys *fs_mount(int dev, uint64_t start, uint64_t size, struct fs_node *parent);
 
 int fs_chdir(const char *path);
@@ -111,6 +123,13 @@ long fs_tell(struct fs_node *node);
 int fs_read(struct fs_node *node, void *buf, int sz);
 int fs_write(struct fs_node *node, void *buf, int sz);
 
+/* map len bytes of a file starting from offs (len <= 0 maps up to the end of
+ * the file) and return a pointer to the data in memory, which must not be
+ * modified. While a file is mapped, writes to it fail with EBUSY.
+ */
+void *fs_map(struct fs_node *node, long offs, long len);
+int fs_unmap(struct fs_node *node, void *ptr);
+
 int fs_rewinddir(struct fs_node *node);
 struct fs_dirent *fs_readdir(struct fs_node *node);
 
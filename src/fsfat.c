@@ -26,6 +26,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "bootdev.h"
 #include "boot.h"
 #include "panic.h"
+#include "config.h"
+#include "timer.h"
+#include "dcache.h"
+#include "mem.h"
 
 #define MAX_NAME	195
 
@@ -42,30 +46,98 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define ATTR_ARCHIVE	0x20
 #define ATTR_LFN	0xf
 
+#define LFN_LAST	0x40
+#define LFN_CHARS	13
+
+/* directories with fewer entries than this are searched linearly */
+#define DIR_HASH_MIN	16
+
+/* bitmap helpers, used for the free cluster map and the dirty FAT sector map */
+#define BM_TEST(bm, x)	((bm)[(x) >> 5] & (1 << ((x) & 0x1f)))
+#define BM_SET(bm, x)	((bm)[(x) >> 5] |= (1 << ((x) & 0x1f)))
+#define BM_CLR(bm, x)	((bm)[(x) >> 5] &= ~(1 << ((x) & 0x1f)))
+
+/* The FAT is accessed through a cache of FAT_WIN_SECT-sector windows, loaded on
+ * demand. The total size of the cache is set by FAT_CACHE_SIZE in config.h.
+ */
+#define FAT_WIN_SECT	8
+#define FAT_WIN_SIZE	(FAT_WIN_SECT * 512)
+#define FAT_NUM_WIN		(FAT_CACHE_SIZE * 1024 / FAT_WIN_SIZE)
+
+/* dirty file data is buffered up to this size before being flushed to disk */
+#define MAX_WRBUF_SIZE	(1024 * 1024)
+
+/* FSInfo sector signatures and free cluster count offset */
+#define FSINFO_SIG1		0x41615252
+#define FSINFO_SIG2		0x61417272
+#define FSINFO_SIG1_OFFS	0
+#define FSINFO_SIG2_OFFS	484
+#define FSINFO_FREE_OFFS	488
+
 
 enum { FAT12, FAT16, FAT32, EXFAT };
 static const char *typestr[] = { "fat12", "fat16", "fat32", "exfat" };
+/* end-of-chain markers written when terminating a cluster chain */
+static const uint32_t eoc_mark[] = { 0xfff, 0xffff, 0x0fffffff, 0x0fffffff };
 
 struct fat_dirent;
 struct fat_dir;
 
+struct fat_mapping {
+	uint32_t first_clust;
+	char *data;
+	long size;
+	int npages;
+	int ref;
+	struct fat_mapping *next;
+};
+
+struct fat_window {
+	int32_t idx;		/* window index in the FAT, -1 if unused */
+	int nsect;
+	uint32_t dirty;		/* one bit per sector, set if it needs writing */
+	unsigned int last_use;
+	unsigned char *data;
+};
+
 struct fatfs {
+	struct filesys *fs;
 	int type;
 	int dev;
 	uint64_t start_sect;
 	uint32_t size;
 	int cluster_size;
 	int fat_size;
+	int num_fats;
 	uint32_t fat_sect;
 	uint32_t root_sect;
 	int root_size;
+	uint32_t root_clust;	/* FAT32 root directory cluster, 0 for FAT12/16 */
 	uint32_t first_data_sect;
 	uint32_t num_data_sect;
 	uint32_t num_clusters;
+	uint32_t fsinfo_sect;
 	char label[12];
 
-	void *fat;
+	struct fat_window *fatwin, *last_win;
+	int num_win;
+	unsigned int win_clock;
+	int fat_dirty_any;
+
+	/* free cluster map, one bit per cluster, set if allocated. Built the first
+	 * time we need to allocate or free clusters.
+	 */
+	uint32_t *freemap;
+	uint32_t num_free;
+	uint32_t num_resv;	/* clusters reserved by buffered writes */
+
+	struct fat_mapping *maps;	/* files mapped with fs_map */
+
 	struct fat_dir *rootdir;
+	/* directories loaded by get_dir, shared by everyone using them */
+	struct fat_dir *dirs;
+	/* open files, to keep handles to the same directory entry consistent */
+	struct fat_file *files;
 	unsigned int clust_mask;
 	int clust_shift;
 };
@@ -138,18 +210,60 @@ struct fat_lfnent {
 	uint16_t part3[2];
 } __attribute__((packed));
 
+/* location of a directory entry on disk: first cluster of the directory it
+ * belongs to (0 for the FAT12/16 root directory), index of the short entry,
+ * and number of LFN entries preceding it. idx is -1 for the root directory
+ * and for removed files.
+ */
+struct dent_loc {
+	uint32_t dir_clust;
+	int idx, nlfn;
+};
 
 struct fat_dir {
 	struct fatfs *fatfs;
 
 	struct fat_dirent *ent;
-	int max_nent;
+	int max_nent;		/* number of entries loaded so far */
+	int32_t next_clust;	/* next cluster to load, -1 when fully loaded */
+
+	/* directories are parsed incrementally, as more clusters are loaded */
+	int parsed, prev_ent;
+	int parse_done;		/* reached the end of directory marker */
 
 	struct fs_dirent *fsent;
-	int fsent_size;
-	int cur_ent;
+	int fsent_size, fsent_max;
+
+	/* all entry names are stored in this one buffer */
+	char *names;
+	int names_size, names_max;
 
+	/* case-insensitive name hash index: htab holds the first fsent index of
+	 * each bucket (or -1), and hnext chains entries in the same bucket.
+	 */
+	int *htab, *hnext;
+	unsigned int htab_mask;
+
+	uint32_t first_clust;	/* 0 for the FAT12/16 root directory */
+	struct dent_loc loc;
+
+	/* there's only one copy of each loaded directory, in the fatfs dirs list,
+	 * which is freed when the last reference goes away.
+	 */
 	int ref;
+	struct fat_dir *next;
+};
+
+/* directory nodes returned by open, each with its own readdir position */
+struct fat_dirnode {
+	struct fat_dir *dir;
+	int cur_ent;
+};
+
+/* what we keep in the path lookup cache for each name */
+struct fat_dcache_data {
+	struct fat_dirent ent;
+	struct dent_loc loc;
 };
 
 struct fat_file {
@@ -160,6 +274,21 @@ struct fat_file {
 
 	char *clustbuf;
 	int buf_valid;
+
+	struct dent_loc loc;
+	char *name;			/* name of the entry, for path lookup cache updates */
+	int dent_dirty;
+	int64_t disk_size;	/* size of the file data already written to disk */
+	int num_clust;		/* clusters in the chain, -1 if not counted yet */
+	int32_t last_clust;
+	int num_resv;		/* clusters reserved for buffered data */
+
+	/* delayed allocation write buffer, holds [wr_start, wr_start + wr_len) */
+	char *wrbuf;
+	int64_t wr_start;
+	int wr_len, wr_size;
+
+	struct fat_file *next;
 };
 
 
@@ -176,23 +305,78 @@ static int rewinddir(struct fs_node *node);
 static struct fs_dirent *readdir(struct fs_node *node);
 static int rename(struct fs_node *node, const char *name);
 static int remove(struct fs_node *node);
+static void *map(struct fs_node *node, long offs, long len);
+static int unmap(struct fs_node *node, void *ptr);
+
+static struct fat_mapping *find_mapping(struct fatfs *fatfs, uint32_t first_clust);
+static int read_chain(struct fatfs *fatfs, int32_t clust, int count, void *buf);
 
 static struct fat_dir *load_dir(struct fatfs *fs, struct fat_dirent *dent);
+static int grow_dir_ents(struct fat_dir *dir, int nent);
+static int load_dir_cluster(struct fat_dir *dir);
+static int load_dir_more(struct fat_dir *dir);
+static int load_dir_all(struct fat_dir *dir);
+static void add_fsent(struct fat_dir *dir, const char *name, struct fat_dirent *dent);
 static void parse_dir_entries(struct fat_dir *dir);
-static void free_dir(struct fat_dir *dir);
-
-static struct fat_file *init_file(struct fatfs *fatfs, struct fat_dirent *dent);
-static void free_file(struct fat_file *file);
+static void reparse_dir(struct fat_dir *dir);
+static void free_dir_entries(struct fat_dir *dir);
+static struct fat_dir *find_loaded_dir(struct fatfs *fatfs, uint32_t clust);
+static void unlink_dir(struct fatfs *fatfs, struct fat_dir *dir);
+static struct fat_dir *get_dir(struct fatfs *fatfs, uint32_t clust);
+static void put_dir(struct fatfs *fatfs, struct fat_dir *dir);
+
+static struct fat_file *init_file(struct fatfs *fatfs, struct fat_dirent *dent, struct dent_loc *loc,
+		const char *name);
+static void set_file_name(struct fat_file *file, const char *name);
+static void free_file(struct fatfs *fatfs, struct fat_file *file);
+static struct fat_file *find_other_file(struct fatfs *fatfs, struct fat_file *file);
+static int flush_file(struct fatfs *fatfs, struct fat_file *file);
+static int write_back(struct fatfs *fatfs, struct fat_file *file);
+static int reserve_clusters(struct fatfs *fatfs, struct fat_file *file, int64_t size);
+static void release_resv(struct fatfs *fatfs, struct fat_file *file);
+static int write_file_data(struct fatfs *fatfs, struct fat_file *file);
+static int write_dirent(struct fatfs *fatfs, struct fat_file *file);
+static void sync_cur_clust(struct fatfs *fatfs, struct fat_file *file);
+
+static int create_entry(struct fatfs *fatfs, struct fat_dir *dir, const char *name, int attr);
+static int add_dir_entry(struct fatfs *fatfs, struct fat_dir *dir, const char *name, struct fat_dirent *ent);
+static int delete_entries(struct fatfs *fatfs, struct fat_dir *dir, struct dent_loc *loc);
+static int find_free_slots(struct fat_dir *dir, int count);
+static int extend_dir(struct fatfs *fatfs, struct fat_dir *dir);
+static int write_dir_ents(struct fatfs *fatfs, struct fat_dir *dir, int first, int count);
+static int init_dir_cluster(struct fatfs *fatfs, uint32_t clust, uint32_t parent);
+static int make_short_name(struct fat_dir *dir, const char *name, char *sname);
+static int count_lfn(struct fat_dir *dir, int idx);
+static uint32_t dent_cluster(struct fatfs *fatfs, struct fat_dirent *dent);
 
 static int read_sectors(int dev, uint64_t sidx, int count, void *sect);
+static int write_sectors(int dev, uint64_t sidx, int count, void *sect);
+static uint64_t clust_to_sect(struct fatfs *fatfs, uint32_t addr);
 static int read_cluster(struct fatfs *fatfs, uint32_t addr, void *clust);
+static int write_clusters(struct fatfs *fatfs, uint32_t addr, int count, void *clust);
 static int dent_filename(struct fat_dirent *dent, struct fat_dirent *prev, char *buf);
+static unsigned int name_hash(const char *name);
+static void build_dir_index(struct fat_dir *dir);
+static void index_entry(struct fat_dir *dir, int idx);
 static struct fs_dirent *find_entry(struct fat_dir *dir, const char *name);
+static struct fs_dirent *find_entry_linear(struct fat_dir *dir, const char *name, int start);
 
+static void init_fat_cache(struct fatfs *fatfs);
+static struct fat_window *get_fat_window(struct fatfs *fatfs, int32_t widx);
+static int write_fat_window(struct fatfs *fatfs, struct fat_window *win);
+static unsigned char *fat_ptr(struct fatfs *fatfs, uint32_t offs, int wr);
+static void prefetch_fat(struct fatfs *fatfs, uint32_t clust, uint32_t count);
 static uint32_t read_fat(struct fatfs *fatfs, uint32_t addr);
+static void write_fat(struct fatfs *fatfs, uint32_t addr, uint32_t val);
+static int flush_fat(struct fatfs *fatfs);
 static int32_t next_cluster(struct fatfs *fatfs, int32_t addr);
 static int32_t find_cluster(struct fatfs *fatfs, int count, int32_t clust);
 
+static void build_freemap(struct fatfs *fatfs);
+static uint32_t find_free_run(struct fatfs *fatfs, uint32_t count, uint32_t *runlen);
+static int32_t alloc_clusters(struct fatfs *fatfs, int count, int32_t last, int32_t *lastp);
+static void free_chain(struct fatfs *fatfs, int32_t clust);
+
 /* static void dbg_printdir(struct fat_dirent *dir, int max_entries); */
 static void clean_trailws(char *s);
 
@@ -206,7 +390,9 @@ static struct fs_operations fs_fat_ops = {
 
 	rewinddir, readdir,
 
-	rename, remove
+	rename, remove,
+
+	map, unmap
 };
 
 static unsigned char sectbuf[512];
@@ -223,6 +409,10 @@ struct filesys *fsfat_create(int dev, uint64_t start, uint64_t size)
 	struct bparam_ext16 *bpb16;
 	struct bparam_ext32 *bpb32;
 
+	if(dev >= DEV_MEMDISK) {
+		return 0;	/* not a BIOS drive */
+	}
+
 	max_sect_once = ((unsigned char*)0xa0000 - low_mem_buffer) / 512;
 	/* some BIOS implementations have a maximum limit of 127 sectors */
 	if(max_sect_once > 127) max_sect_once = 127;
@@ -250,6 +440,7 @@ struct filesys *fsfat_create(int dev, uint64_t start, uint64_t size)
 	fatfs->size = bpb->num_sectors ? bpb->num_sectors : bpb->num_sectors32;
 	fatfs->cluster_size = bpb->cluster_size;
 	fatfs->fat_size = bpb->fat_size ? bpb->fat_size : bpb32->fat_size;
+	fatfs->num_fats = bpb->num_fats;
 	fatfs->fat_sect = bpb->reserved_sect;
 	fatfs->root_sect = fatfs->fat_sect + fatfs->fat_size * bpb->num_fats;
 	fatfs->root_size = (bpb->num_dirent * sizeof(struct fat_dirent) + 511) / 512;
@@ -276,6 +467,8 @@ struct filesys *fsfat_create(int dev, uint64_t start, uint64_t size)
 	case EXFAT:
 		fatfs->root_sect = bpb32->root_clust / fatfs->cluster_size;
 		fatfs->root_size = 0;
+		fatfs->root_clust = bpb32->root_clust;
+		fatfs->fsinfo_sect = bpb32->fsinfo_sect;
 		memcpy(fatfs->label, bpb32->label, sizeof bpb32->label);
 		break;
 
@@ -288,20 +481,8 @@ struct filesys *fsfat_create(int dev, uint64_t start, uint64_t size)
 		*endp-- = 0;
 	}
 
-	/* read the FAT */
-	if(!(fatfs->fat = malloc(fatfs->fat_size * 512))) {
-		panic("FAT: failed to allocate memory for the FAT (%lu bytes)\n", (unsigned long)fatfs->fat_size * 512);
-	}
-	ptr = fatfs->fat;
-	num_read = 0;
-	while(num_read < fatfs->fat_size) {
-		int count = fatfs->fat_size - num_read;
-		if(count > max_sect_once) count = max_sect_once;
-
-		read_sectors(dev, fatfs->start_sect + fatfs->fat_sect + num_read, count, ptr);
-		ptr += count * 512;
-		num_read += count;
-	}
+	/* the FAT itself is loaded lazily, a window at a time, by read_fat */
+	init_fat_cache(fatfs);
 
 	/* open root directory */
 	if(fatfs->type == FAT32) {
@@ -314,10 +495,13 @@ struct filesys *fsfat_create(int dev, uint64_t start, uint64_t size)
 		}
 
 	} else {
-		if(!(rootdir = malloc(sizeof *rootdir))) {
+		if(!(rootdir = calloc(1, sizeof *rootdir))) {
 			panic("FAT: failed to allocate root directory structure\n");
 		}
 		rootdir->fatfs = fatfs;
+		rootdir->loc.idx = -1;
+		rootdir->next_clust = -1;
+		rootdir->prev_ent = -1;
 
 		rootdir->max_nent = fatfs->root_size * 512 / sizeof(struct fat_dirent);
 		if(!(rootdir->ent = malloc(fatfs->root_size * 512))) {
@@ -337,8 +521,11 @@ struct filesys *fsfat_create(int dev, uint64_t start, uint64_t size)
 
 		parse_dir_entries(rootdir);
 	}
+	/* the filesystem holds a reference to the root directory, which keeps it
+	 * loaded until it's destroyed
+	 */
 	rootdir->ref = 1;
-	fatfs->rootdir = rootdir;
+	fatfs->rootdir = fatfs->dirs = rootdir;
 
 	/* assume cluster_size is a power of two */
 	fatfs->clust_mask = (fatfs->cluster_size * 512) - 1;
@@ -355,6 +542,7 @@ struct filesys *fsfat_create(int dev, uint64_t start, uint64_t size)
 	fs->name = fatfs->label;
 	fs->fsop = &fs_fat_ops;
 	fs->data = fatfs;
+	fatfs->fs = fs;
 
 
 	printf("opened %s filesystem dev: %x, start: %lld\n", typestr[fatfs->type], fatfs->dev, start);
@@ -368,6 +556,20 @@ struct filesys *fsfat_create(int dev, uint64_t start, uint64_t size)
 static void destroy(struct filesys *fs)
 {
 	struct fatfs *fatfs = fs->data;
+
+	flush_fat(fatfs);
+	dcache_purge_fs(fs);
+
+	while(fatfs->maps) {
+		struct fat_mapping *m = fatfs->maps;
+		fatfs->maps = m->next;
+		free_ppages(ADDR_TO_PAGE(m->data), m->npages);
+		free(m);
+	}
+
+	free(fatfs->freemap);
+	free(fatfs->fatwin->data);
+	free(fatfs->fatwin);
 	free(fatfs);
 	free(fs);
 }
@@ -376,10 +578,14 @@ static struct fs_node *open(struct filesys *fs, const char *path, unsigned int f
 {
 	char name[MAX_NAME];
 	struct fatfs *fatfs = fs->data;
-	struct fat_dir *dir, *newdir;
+	struct fat_dir *dir;
+	struct fat_dirnode *dnode;
 	struct fs_dirent *dent;
-	struct fat_dirent *fatdent;
+	struct fat_dcache_data cdata;
+	struct dent_loc loc;
 	struct fs_node *node;
+	uint32_t dir_clust;
+	int idx, created, is_dir = 1;
 
 	if(path[0] == '/') {
 		dir = fatfs->rootdir;
@@ -388,11 +594,17 @@ static struct fs_node *open(struct filesys *fs, const char *path, unsigned int f
 		if(cwdnode->fs->type != FSTYPE_FAT) {
 			return 0;
 		}
-		dir = cwdnode->data;
+		dir = ((struct fat_dirnode*)cwdnode->data)->dir;
 	}
+	dir->ref++;
+	/* directories are identified by their first cluster in the path lookup
+	 * cache, and only loaded when we have to search them.
+	 */
+	dir_clust = dir->first_clust;
+	loc.idx = -1;
 
 	while(*path) {
-		if(!dir) {
+		if(!is_dir) {
 			/* we have more path components, yet the last one wasn't a dir */
 			errno = ENOTDIR;
 			return 0;
@@ -404,53 +616,104 @@ static struct fs_node *open(struct filesys *fs, const char *path, unsigned int f
 			continue;
 		}
 
-		if(!(dent = find_entry(dir, name))) {
-			errno = ENOENT;
-			return 0;
-		}
-		fatdent = dent->data;
+		created = 0;
+		switch(dcache_lookup(fs, dir_clust, name, &cdata)) {
+		case DCACHE_HIT:
+			break;
 
-		if((fatdent->first_cluster_low | fatdent->first_cluster_high) == 0) {
-			if(fatdent->attr & ATTR_DIR) {
-				/* ".." entries back to the root directory seem to have a 0
-				 * cluster address as a special case
-				 */
-				newdir = fatfs->rootdir;
+		case DCACHE_NEGATIVE:
+			if(*path || !(flags & FSO_CREATE)) {
+				put_dir(fatfs, dir);
+				errno = ENOENT;
+				return 0;
+			}
+			/* fall through to create it */
+		default:
+			if(!dir && !(dir = get_dir(fatfs, dir_clust))) {
+				errno = EIO;
+				return 0;
+			}
+			if(!(dent = find_entry(dir, name))) {
+				if(*path || !(flags & FSO_CREATE)) {
+					dcache_add(fs, dir_clust, name, 0, 0);
+					put_dir(fatfs, dir);
+					errno = ENOENT;
+					return 0;
+				}
+				if((idx = create_entry(fatfs, dir, name, (flags & FSO_DIR) ? ATTR_DIR : ATTR_ARCHIVE)) == -1) {
+					put_dir(fatfs, dir);
+					return 0;
+				}
+				created = 1;
 			} else {
-				return 0;	/* but we can't have 0-address files (right?) */
+				idx = (struct fat_dirent*)dent->data - dir->ent;
 			}
-		} else {
-			newdir = (fatdent->attr & ATTR_DIR) ? load_dir(fatfs, fatdent) : 0;
+
+			/* keep a copy of the entry and its location, the directory we found
+			 * it in is released below.
+			 */
+			cdata.ent = dir->ent[idx];
+			cdata.loc.dir_clust = dir_clust;
+			cdata.loc.idx = idx;
+			cdata.loc.nlfn = count_lfn(dir, idx);
+			dcache_add(fs, dir_clust, name, &cdata, sizeof cdata);
+		}
+
+		if(!*path && !created && (flags & FSO_EXCL)) {
+			put_dir(fatfs, dir);
+			errno = EEXIST;
+			return 0;
+		}
+		put_dir(fatfs, dir);
+		dir = 0;
+
+		loc = cdata.loc;
+		if(strcmp(name, "..") == 0) {
+			loc.idx = -1;	/* can't rename or remove through .. */
 		}
-		if(dir != fatfs->rootdir && dir != cwdnode->data) {
-			free_dir(dir);
+
+		if((is_dir = cdata.ent.attr & ATTR_DIR)) {
+			/* ".." entries back to the root directory seem to have a 0
+			 * cluster address as a special case
+			 */
+			if(!(dir_clust = dent_cluster(fatfs, &cdata.ent))) {
+				dir_clust = fatfs->root_clust;
+			}
 		}
-		dir = newdir;
 	}
 
 
+	if(is_dir && !dir && !(dir = get_dir(fatfs, dir_clust))) {
+		errno = EIO;
+		return 0;
+	}
+
 	if(!(node = malloc(sizeof *node))) {
 		panic("FAT: open failed to allocate fs_node structure\n");
 	}
 	node->fs = fs;
-	if(dir) {
-		if(dir == fatfs->rootdir) {
-			if(!(newdir = malloc(sizeof *newdir))) {
-				panic("FAT: failed to allocate directory structure\n");
-			}
-			*newdir = *dir;
-			dir = newdir;
-			dir->ref = 0;
+	node->mnt = 0;
+	if(is_dir) {
+		if(!(dnode = malloc(sizeof *dnode))) {
+			panic("FAT: failed to allocate directory node\n");
+		}
+		/* the node keeps the reference to dir */
+		dnode->dir = dir;
+		dnode->cur_ent = 0;
+		if(loc.idx >= 0) {
+			dir->loc = loc;
 		}
 		node->type = FSNODE_DIR;
-		node->data = dir;
-		dir->cur_ent = 0;
-		dir->ref++;
+		node->data = dnode;
 	} else {
 		node->type = FSNODE_FILE;
-		if(!(node->data = init_file(fatfs, fatdent))) {
+		if(!(node->data = init_file(fatfs, &cdata.ent, &loc, name))) {
 			panic("FAT: failed to allocate file entry structure\n");
 		}
+#ifdef FAT_PREFETCH
+		prefetch_fat(fatfs, ((struct fat_file*)node->data)->first_clust,
+				((uint32_t)cdata.ent.size_bytes >> fatfs->clust_shift) + 1);
+#endif
 	}
 
 	return node;
@@ -458,13 +721,19 @@ static struct fs_node *open(struct filesys *fs, const char *path, unsigned int f
 
 static void close(struct fs_node *node)
 {
+	struct fatfs *fatfs = node->fs->data;
+
 	switch(node->type) {
 	case FSNODE_FILE:
-		free_file(node->data);
+		/* the current cluster doesn't matter anymore, skip flush_file's sync */
+		write_back(fatfs, node->data);
+		release_resv(fatfs, node->data);
+		free_file(fatfs, node->data);
 		break;
 
 	case FSNODE_DIR:
-		free_dir(node->data);
+		put_dir(fatfs, ((struct fat_dirnode*)node->data)->dir);
+		free(node->data);
 		break;
 
 	default:
@@ -518,13 +787,21 @@ static int seek(struct fs_node *node, int offs, int whence)
 
 	if(new_pos < 0) new_pos = 0;
 
+	/* while there's buffered data, cur_clust is recalculated after flushing */
+	if(file->wr_len > 0) {
+		file->cur_pos = new_pos;
+		return 0;
+	}
+
 	cur_clust_idx = file->cur_pos >> fatfs->clust_shift;
 	new_clust_idx = new_pos >> fatfs->clust_shift;
 	/* if the new position does not fall in the same cluster as the previous one
 	 * re-calculate cur_clust
 	 */
-	if(new_clust_idx != cur_clust_idx) {
-		if(new_clust_idx < cur_clust_idx) {
+	if(new_clust_idx != cur_clust_idx || file->cur_clust < 0) {
+		if(!file->first_clust) {
+			file->cur_clust = -1;
+		} else if(new_clust_idx < cur_clust_idx || file->cur_clust < 0) {
 			file->cur_clust = find_cluster(fatfs, new_clust_idx, file->first_clust);
 		} else {
 			file->cur_clust = find_cluster(fatfs, new_clust_idx - cur_clust_idx, file->cur_clust);
@@ -563,7 +840,11 @@ static int read(struct fs_node *node, void *buf, int sz)
 	fatfs = node->fs->data;
 	file = node->data;
 
-	if(file->cur_clust < 0) {
+	if(file->wr_len > 0 && flush_file(fatfs, file) == -1) {
+		return -1;
+	}
+
+	if(file->cur_clust < 0 || file->cur_pos >= file->ent.size_bytes) {
 		return 0;	/* EOF */
 	}
 
@@ -607,213 +888,1480 @@ static int read(struct fs_node *node, void *buf, int sz)
 	return num_read;
 }
 
+/* Writes are buffered in memory, and clusters are only allocated when the
+ * buffer is flushed (on close, or when it grows too large, or when a
+ * non-adjacent part of the file is written/read). By then we know how much
+ * space is needed, and can allocate it as a single contiguous run.
+ */
 static int write(struct fs_node *node, void *buf, int sz)
 {
-	return -1;	/* TODO */
+	struct fatfs *fatfs;
+	struct fat_file *file;
+	int64_t end, wr_end;
+	int offs, newsz;
+	char *tmp;
+
+	if(!node || !buf || sz < 0 || node->type != FSNODE_FILE) {
+		return -1;
+	}
+
+	fatfs = node->fs->data;
+	file = node->data;
+
+	if(file->loc.idx < 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	if(file->ent.attr & ATTR_RO) {
+		errno = EPERM;
+		return -1;
+	}
+	if(find_mapping(fatfs, file->first_clust)) {
+		errno = EBUSY;	/* can't modify files while they're mapped */
+		return -1;
+	}
+	if(!sz) return 0;
+
+	end = file->cur_pos + sz;
+	if(end > 0xffffffff) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	/* only a single contiguous range is buffered. Writing past the end of the
+	 * buffer is fine only if the buffer extends to the end of the file, in
+	 * which case the gap is filled with zeros.
+	 */
+	if(file->wr_len > 0) {
+		wr_end = file->wr_start + file->wr_len;
+		if(file->cur_pos < file->wr_start || (file->cur_pos > wr_end &&
+					wr_end < file->ent.size_bytes)) {
+			if(flush_file(fatfs, file) == -1) {
+				return -1;
+			}
+		}
+	}
+
+	if(reserve_clusters(fatfs, file, end) == -1) {
+		return -1;
+	}
+
+	if(!file->wr_len) {
+		file->wr_start = file->cur_pos;
+		if(file->wr_start > file->ent.size_bytes) {
+			file->wr_start = file->ent.size_bytes;
+		}
+	}
+	offs = file->cur_pos - file->wr_start;
+
+	if(offs + sz > file->wr_size) {
+		newsz = file->wr_size ? file->wr_size : fatfs->cluster_size * 512;
+		while(newsz < offs + sz) newsz <<= 1;
+		if(!(tmp = realloc(file->wrbuf, newsz))) {
+			errno = ENOMEM;
+			return -1;
+		}
+		file->wrbuf = tmp;
+		file->wr_size = newsz;
+	}
+	if(offs > file->wr_len) {
+		memset(file->wrbuf + file->wr_len, 0, offs - file->wr_len);
+	}
+	memcpy(file->wrbuf + offs, buf, sz);
+	if(offs + sz > file->wr_len) {
+		file->wr_len = offs + sz;
+	}
+
+	file->cur_pos = end;
+	if(end > file->ent.size_bytes) {
+		file->ent.size_bytes = end;
+		file->dent_dirty = 1;
+	}
+
+	if(file->wr_len >= MAX_WRBUF_SIZE) {
+		if(flush_file(fatfs, file) == -1) {
+			return -1;
+		}
+	}
+	return sz;
 }
 
 static int rewinddir(struct fs_node *node)
 {
-	struct fat_dir *dir;
+	struct fat_dirnode *dnode;
 
 	if(node->type != FSNODE_DIR) {
 		return -1;
 	}
 
-	dir = node->data;
-	dir->cur_ent = 0;
+	dnode = node->data;
+	dnode->cur_ent = 0;
 	return 0;
 }
 
 static struct fs_dirent *readdir(struct fs_node *node)
 {
+	struct fat_dirnode *dnode;
 	struct fat_dir *dir;
 
 	if(node->type != FSNODE_DIR) {
 		return 0;
 	}
 
-	dir = node->data;
-	if(dir->cur_ent >= dir->fsent_size) {
-		return 0;
+	dnode = node->data;
+	dir = dnode->dir;
+	while(dnode->cur_ent >= dir->fsent_size) {
+		if(!load_dir_more(dir)) {
+			return 0;
+		}
 	}
 
-	return dir->fsent + dir->cur_ent++;
+	return dir->fsent + dnode->cur_ent++;
 }
 
 static int rename(struct fs_node *node, const char *name)
 {
-	return -1;	/* TODO */
-}
-
-static int remove(struct fs_node *node)
-{
-	errno = EPERM;
-	return -1;	/* TODO */
-}
-
-static struct fat_dir *load_dir(struct fatfs *fs, struct fat_dirent *dent)
-{
-	int32_t addr;
+	int idx, res = -1;
+	struct fatfs *fatfs = node->fs->data;
+	struct dent_loc *loc;
 	struct fat_dir *dir;
-	char *buf = 0;
-	int bufsz = 0;
+	struct fs_dirent *dent;
+	struct fat_dirent ent;
+	struct fat_file *f;
 
-	if(!(dent->attr & ATTR_DIR)) return 0;
+	if(node->type == FSNODE_FILE) {
+		struct fat_file *file = node->data;
+		if(flush_file(fatfs, file) == -1) {
+			return -1;
+		}
+		loc = &file->loc;
+	} else {
+		loc = &((struct fat_dirnode*)node->data)->dir->loc;
+	}
+	if(loc->idx < 0) {
+		errno = EPERM;
+		return -1;
+	}
 
-	addr = dent->first_cluster_low;
-	if(fs->type >= FAT32) {
-		addr |= (uint32_t)dent->first_cluster_high << 16;
+	if(!(dir = get_dir(fatfs, loc->dir_clust))) {
+		return -1;
+	}
+	if(load_dir_all(dir) == -1) {
+		put_dir(fatfs, dir);
+		errno = EIO;
+		return -1;
 	}
 
-	do {
-		int prevsz = bufsz;
-		bufsz += fs->cluster_size * 512;
-		if(!(buf = realloc(buf, bufsz))) {
-			panic("FAT: failed to allocate cluster buffer (%d bytes)\n", bufsz);
-		}
+	/* allow changing the case of the existing name */
+	if((dent = find_entry(dir, name)) && dent->data != dir->ent + loc->idx) {
+		errno = EEXIST;
+		goto end;
+	}
 
-		if(read_cluster(fs, addr, buf + prevsz) == -1) {
-			printf("load_dir: failed to read cluster: %lu\n", (unsigned long)addr);
-			free(buf);
-			return 0;
+	/* add the new entries first, and only then delete the old ones */
+	ent = dir->ent[loc->idx];
+	if((idx = add_dir_entry(fatfs, dir, name, &ent)) == -1) {
+		goto end;
+	}
+	if(delete_entries(fatfs, dir, loc) == -1) {
+		goto end;
+	}
+	/* all handles to a renamed file follow it to the new entry */
+	for(f=fatfs->files; f; f=f->next) {
+		if(f->loc.idx == loc->idx && f->loc.dir_clust == loc->dir_clust) {
+			set_file_name(f, name);
+			if(&f->loc != loc) {
+				f->loc.idx = idx;
+				f->loc.nlfn = count_lfn(dir, idx);
+			}
 		}
-	} while((addr = next_cluster(fs, addr)) >= 0);
-
-	if(!(dir = malloc(sizeof *dir))) {
-		panic("FAT: failed to allocate directory structure\n");
 	}
-	dir->fatfs = fs;
-	dir->ent = (struct fat_dirent*)buf;
-	dir->max_nent = bufsz / sizeof *dir->ent;
-	dir->cur_ent = 0;
-	dir->ref = 0;
+	loc->idx = idx;
+	loc->nlfn = count_lfn(dir, idx);
+	res = 0;
 
-	parse_dir_entries(dir);
-	return dir;
+end:
+	put_dir(fatfs, dir);
+	return res;
 }
 
-static void parse_dir_entries(struct fat_dir *dir)
+static int remove(struct fs_node *node)
 {
-	int i;
-	struct fat_dirent *dent, *prev_dent;
-	struct fs_dirent *eptr;
-	char entname[MAX_NAME];
-
-	/* create an fs_dirent array with one element for each actual entry
-	 * (disregarding volume labels, and LFN entries).
-	 */
-	if(!(dir->fsent = malloc(dir->max_nent * sizeof *dir->fsent))) {
-		panic("FAT: failed to allocate dirent array\n");
+	int i, res;
+	int32_t clust;
+	struct fatfs *fatfs = node->fs->data;
+	struct fat_file *file = 0;
+	struct fat_dir *dir, *pdir;
+	struct dent_loc *loc;
+
+	if(node->type == FSNODE_FILE) {
+		file = node->data;
+		loc = &file->loc;
+		if(loc->idx < 0) {
+			errno = ENOENT;
+			return -1;
+		}
+		/* other handles would keep writing to the freed entry and clusters */
+		if(find_other_file(fatfs, file)) {
+			errno = EBUSY;
+			return -1;
+		}
+		/* drop any buffered data, no point in writing it out */
+		file->wr_len = 0;
+		release_resv(fatfs, file);
+		clust = file->first_clust;
+	} else {
+		dir = ((struct fat_dirnode*)node->data)->dir;
+		loc = &dir->loc;
+		if(dir == fatfs->rootdir || loc->idx < 0) {
+			errno = EBUSY;
+			return -1;
+		}
+		if(load_dir_all(dir) == -1) {
+			errno = EIO;
+			return -1;
+		}
+		for(i=0; i<dir->fsent_size; i++) {
+			if(strcmp(dir->fsent[i].name, ".") != 0 && strcmp(dir->fsent[i].name, "..") != 0) {
+				errno = ENOTEMPTY;
+				return -1;
+			}
+		}
+		clust = dir->first_clust;
 	}
-	eptr = dir->fsent;
-	dent = dir->ent;
-	prev_dent = dent - 1;
 
-	for(i=0; i<dir->max_nent; i++) {
-		if(DENT_IS_NULL(dent)) break;
+	if(!(pdir = get_dir(fatfs, loc->dir_clust))) {
+		return -1;
+	}
+	if(load_dir_all(pdir) == -1) {
+		res = -1;
+		errno = EIO;
+	} else {
+		res = delete_entries(fatfs, pdir, loc);
+	}
+	put_dir(fatfs, pdir);
+	if(res == -1) {
+		return -1;
+	}
 
-		if(!DENT_IS_UNUSED(dent) && dent->attr != ATTR_VOLID && dent->attr != ATTR_LFN) {
-			if(dent_filename(dent, prev_dent, entname) > 0) {
-				if(!(eptr->name = malloc(strlen(entname) + 1))) {
-					panic("FAT: failed to allocate dirent name\n");
-				}
-				strcpy(eptr->name, entname);
-				eptr->data = dent;
-				eptr->type = (dent->attr & ATTR_DIR) ? FSNODE_DIR : FSNODE_FILE;
-				eptr->fsize = dent->size_bytes;
-				eptr++;
-			}
+	if(clust >= 2) {
+		struct fat_mapping *m;
+		if((m = find_mapping(fatfs, clust))) {
+			/* existing mappings stay valid, but the cluster might be reused */
+			m->first_clust = 0;
 		}
-		if(dent->attr != ATTR_LFN) {
-			prev_dent = dent;
+		if(!file) {
+			/* the cluster might be reused for another directory, so make sure
+			 * nobody gets this one from get_dir again
+			 */
+			dcache_purge_dir(node->fs, clust);
+			unlink_dir(fatfs, dir);
 		}
-		dent++;
+		free_chain(fatfs, clust);
 	}
-	dir->fsent_size = eptr - dir->fsent;
-	dir->cur_ent = 0;
-}
-
-static void free_dir(struct fat_dir *dir)
-{
-	int i;
-	struct fat_dir *root = dir->fatfs->rootdir;
-
-	if(dir) {
-		if(--dir->ref > 0) return;
+	if(flush_fat(fatfs) == -1) {
+		return -1;
+	}
+	loc->idx = -1;
 
-		if(dir->ent != root->ent) {
-			free(dir->ent);
-			if(dir->fsent) {
-				for(i=0; i<dir->fsent_size; i++) {
-					free(dir->fsent[i].name);
-				}
-				free(dir->fsent);
-			}
-		}
-		free(dir);
+	if(file) {
+		file->first_clust = 0;
+		file->cur_clust = -1;
+		file->buf_valid = 0;
+		file->ent.size_bytes = 0;
+		file->disk_size = 0;
+		file->num_clust = 0;
+		file->last_clust = 0;
+		file->dent_dirty = 0;
 	}
+	return 0;
 }
 
-static struct fat_file *init_file(struct fatfs *fatfs, struct fat_dirent *dent)
+/* Files are mapped by loading the whole file into consecutive physical pages,
+ * shared by everyone mapping the same file, and freed when the last mapping
+ * goes away.
+ */
+static void *map(struct fs_node *node, long offs, long len)
 {
+	struct fatfs *fatfs;
 	struct fat_file *file;
+	struct fat_mapping *m;
+	int pg, npages, nclust;
 
-	if(!(file = calloc(1, sizeof *file))) {
-		panic("FAT: failed to allocate file structure\n");
+	if(!node || node->type != FSNODE_FILE) {
+		errno = EINVAL;
+		return 0;
 	}
-	if(!(file->clustbuf = malloc(fatfs->cluster_size * 512))) {
-		panic("FAT: failed to allocate file cluster buffer\n");
+	fatfs = node->fs->data;
+	file = node->data;
+
+	if(file->wr_len > 0 && flush_file(fatfs, file) == -1) {
+		return 0;
+	}
+	if(len <= 0) {
+		len = file->ent.size_bytes - offs;
+	}
+	if(offs < 0 || len <= 0 || offs + len > file->ent.size_bytes) {
+		errno = EINVAL;
+		return 0;
 	}
-	file->ent = *dent;
-	file->first_clust = dent->first_cluster_low | ((int32_t)dent->first_cluster_high << 16);
-	file->cur_clust = file->first_clust;
-	return file;
-}
 
-static void free_file(struct fat_file *file)
-{
-	if(file) {
-		free(file->clustbuf);
-		free(file);
+	if(!(m = find_mapping(fatfs, file->first_clust))) {
+		nclust = (file->ent.size_bytes + fatfs->clust_mask) >> fatfs->clust_shift;
+		npages = BYTES_TO_PAGES(nclust * fatfs->cluster_size * 512);
+		if((pg = alloc_ppages(npages, MEM_HEAP)) == -1) {
+			errno = ENOMEM;
+			return 0;
+		}
+		if(!(m = malloc(sizeof *m))) {
+			panic("FAT: failed to allocate mapping structure\n");
+		}
+		m->first_clust = file->first_clust;
+		m->data = PAGE_TO_PTR(pg);
+		m->size = file->ent.size_bytes;
+		m->npages = npages;
+		m->ref = 0;
+
+		if(read_chain(fatfs, file->first_clust, nclust, m->data) == -1) {
+			free_ppages(pg, npages);
+			free(m);
+			errno = EIO;
+			return 0;
+		}
+		m->next = fatfs->maps;
+		fatfs->maps = m;
 	}
+
+	m->ref++;
+	return m->data + offs;
 }
 
-static int read_sectors(int dev, uint64_t sidx, int count, void *sect)
+static int unmap(struct fs_node *node, void *ptr)
 {
-	if(dev == -1 || dev == boot_drive_number) {
-		if(bdev_read_range(sidx, count, sect) == -1) {
-			return -1;
+	struct fatfs *fatfs = node->fs->data;
+	struct fat_mapping dummy, *prev, *m;
+
+	dummy.next = fatfs->maps;
+	prev = &dummy;
+	while(prev->next) {
+		m = prev->next;
+		if((char*)ptr >= m->data && (char*)ptr < m->data + m->size) {
+			if(--m->ref <= 0) {
+				prev->next = m->next;
+				free_ppages(ADDR_TO_PAGE(m->data), m->npages);
+				free(m);
+			}
+			fatfs->maps = dummy.next;
+			return 0;
 		}
-		return 0;
+		prev = m;
 	}
 
-	printf("BUG: reading sectors from drives other than the boot drive not implemented yet\n");
+	errno = EINVAL;
 	return -1;
 }
 
-static int read_cluster(struct fatfs *fatfs, uint32_t addr, void *clust)
+static struct fat_mapping *find_mapping(struct fatfs *fatfs, uint32_t first_clust)
 {
-	char *ptr = clust;
-	uint64_t saddr = (uint64_t)(addr - 2) * fatfs->cluster_size + fatfs->first_data_sect + fatfs->start_sect;
+	struct fat_mapping *m = fatfs->maps;
 
-	if(read_sectors(fatfs->dev, saddr, fatfs->cluster_size, ptr) == -1) {
-		return -1;
+	if(!first_clust) return 0;
+
+	while(m) {
+		if(m->first_clust == first_clust) {
+			return m;
+		}
+		m = m->next;
 	}
 	return 0;
 }
 
-static int dent_filename(struct fat_dirent *dent, struct fat_dirent *prev, char *buf)
+/* read count clusters of a chain, with a single request for each run of
+ * clusters which are consecutive on disk.
+ */
+static int read_chain(struct fatfs *fatfs, int32_t clust, int count, void *buf)
 {
-	int len = 0;
+	int32_t start, next;
+	int run;
 	char *ptr = buf;
-	struct fat_lfnent *lfn = (struct fat_lfnent*)(dent - 1);
 
-	if(lfn > (struct fat_lfnent*)prev && lfn->attr == ATTR_LFN) {
-		/* found a long filename entry, use that */
-		do {
-			uint16_t ustr[14], *uptr = ustr;
-			memcpy(uptr, lfn->part1, sizeof lfn->part1);
+	while(count > 0 && clust >= 2) {
+		start = clust;
+		run = 1;
+		while(run < count && (next = next_cluster(fatfs, clust)) == clust + 1) {
+			clust = next;
+			run++;
+		}
+		if(read_sectors(fatfs->dev, clust_to_sect(fatfs, start), run * fatfs->cluster_size, ptr) == -1) {
+			return -1;
+		}
+		ptr += run * fatfs->cluster_size * 512;
+		count -= run;
+		clust = next_cluster(fatfs, clust);
+	}
+	return count > 0 ? -1 : 0;
+}
+
+static struct fat_dir *load_dir(struct fatfs *fs, struct fat_dirent *dent)
+{
+	int32_t addr;
+	struct fat_dir *dir;
+
+	if(!(dent->attr & ATTR_DIR)) return 0;
+
+	addr = dent->first_cluster_low;
+	if(fs->type >= FAT32) {
+		addr |= (uint32_t)dent->first_cluster_high << 16;
+	}
+
+	if(!(dir = calloc(1, sizeof *dir))) {
+		panic("FAT: failed to allocate directory structure\n");
+	}
+	dir->fatfs = fs;
+	dir->first_clust = addr;
+	dir->next_clust = addr;
+	dir->prev_ent = -1;
+	dir->loc.idx = -1;
+
+	/* only the first cluster is loaded now, the rest are loaded and parsed
+	 * as readdir and find_entry need them.
+	 */
+	if(load_dir_cluster(dir) == -1) {
+		free(dir);
+		return 0;
+	}
+	return dir;
+}
+
+/* grow the entry array to hold nent entries, fixing up the fs_dirent pointers
+ * into it if it moves.
+ */
+static int grow_dir_ents(struct fat_dir *dir, int nent)
+{
+	int i;
+	struct fat_dirent *tmp;
+
+	if(!(tmp = realloc(dir->ent, nent * sizeof *dir->ent))) {
+		return -1;
+	}
+	if(tmp != dir->ent) {
+		for(i=0; i<dir->fsent_size; i++) {
+			dir->fsent[i].data = tmp + ((struct fat_dirent*)dir->fsent[i].data - dir->ent);
+		}
+		dir->ent = tmp;
+	}
+	return 0;
+}
+
+/* load and parse the next cluster of the directory. Returns 1 if a cluster was
+ * loaded, 0 if the whole directory is already loaded, or -1 on error.
+ */
+static int load_dir_cluster(struct fat_dir *dir)
+{
+	struct fatfs *fatfs = dir->fatfs;
+	int nent = fatfs->cluster_size * 512 / sizeof *dir->ent;
+
+	if(dir->next_clust < 0) {
+		return 0;
+	}
+
+	if(grow_dir_ents(dir, dir->max_nent + nent) == -1) {
+		panic("FAT: failed to allocate directory buffer (%d entries)\n", dir->max_nent + nent);
+	}
+	if(read_cluster(fatfs, dir->next_clust, dir->ent + dir->max_nent) == -1) {
+		printf("load_dir: failed to read cluster: %lu\n", (unsigned long)dir->next_clust);
+		return -1;
+	}
+	dir->max_nent += nent;
+	dir->next_clust = next_cluster(fatfs, dir->next_clust);
+
+	parse_dir_entries(dir);
+	return 1;
+}
+
+/* load more entries if the end of the directory hasn't been reached yet.
+ * Returns 1 if more entries may be available, 0 otherwise.
+ */
+static int load_dir_more(struct fat_dir *dir)
+{
+	if(dir->parse_done) {
+		return 0;
+	}
+	return load_dir_cluster(dir) > 0;
+}
+
+/* load the rest of the directory, needed before modifying it */
+static int load_dir_all(struct fat_dir *dir)
+{
+	int res;
+
+	while((res = load_dir_cluster(dir)) > 0);
+	return res;
+}
+
+/* append an entry to the fs_dirent array, storing its name in the directory
+ * name arena.
+ */
+static void add_fsent(struct fat_dir *dir, const char *name, struct fat_dirent *dent)
+{
+	int i, len, newsz;
+	char *tmp;
+	struct fs_dirent *eptr;
+
+	if(dir->fsent_size >= dir->fsent_max) {
+		newsz = dir->fsent_max ? dir->fsent_max * 2 : DIR_HASH_MIN;
+		if(!(eptr = realloc(dir->fsent, newsz * sizeof *dir->fsent))) {
+			panic("FAT: failed to allocate dirent array\n");
+		}
+		dir->fsent = eptr;
+		if(!(dir->hnext = realloc(dir->hnext, newsz * sizeof *dir->hnext))) {
+			panic("FAT: failed to allocate directory hash chains\n");
+		}
+		dir->fsent_max = newsz;
+	}
+
+	len = strlen(name) + 1;
+	if(dir->names_size + len > dir->names_max) {
+		newsz = dir->names_max ? dir->names_max : 256;
+		while(newsz < dir->names_size + len) newsz <<= 1;
+		if(!(tmp = realloc(dir->names, newsz))) {
+			panic("FAT: failed to allocate directory name arena\n");
+		}
+		if(tmp != dir->names) {
+			for(i=0; i<dir->fsent_size; i++) {
+				dir->fsent[i].name = tmp + (dir->fsent[i].name - dir->names);
+			}
+			dir->names = tmp;
+		}
+		dir->names_max = newsz;
+	}
+
+	eptr = dir->fsent + dir->fsent_size++;
+	eptr->name = dir->names + dir->names_size;
+	memcpy(eptr->name, name, len);
+	dir->names_size += len;
+
+	eptr->data = dent;
+	eptr->type = (dent->attr & ATTR_DIR) ? FSNODE_DIR : FSNODE_FILE;
+	eptr->fsize = dent->size_bytes;
+
+	index_entry(dir, dir->fsent_size - 1);
+}
+
+/* parse the entries loaded since the last call, adding one fs_dirent for each
+ * actual entry (disregarding volume labels, and LFN entries).
+ */
+static void parse_dir_entries(struct fat_dir *dir)
+{
+	int i;
+	struct fat_dirent *dent;
+	char entname[MAX_NAME];
+
+	for(i=dir->parsed; i<dir->max_nent; i++) {
+		dent = dir->ent + i;
+		if(DENT_IS_NULL(dent)) {
+			dir->parse_done = 1;
+			break;
+		}
+
+		if(!DENT_IS_UNUSED(dent) && dent->attr != ATTR_VOLID && dent->attr != ATTR_LFN) {
+			if(dent_filename(dent, dir->ent + dir->prev_ent, entname) > 0) {
+				add_fsent(dir, entname, dent);
+			}
+		}
+		if(dent->attr != ATTR_LFN) {
+			dir->prev_ent = i;
+		}
+	}
+	dir->parsed = i;
+}
+
+/* re-create the fs_dirent array after modifying the directory entries */
+static void reparse_dir(struct fat_dir *dir)
+{
+	dir->fsent_size = 0;
+	dir->names_size = 0;
+	dir->parsed = 0;
+	dir->prev_ent = -1;
+	dir->parse_done = 0;
+	free(dir->htab);
+	dir->htab = 0;
+
+	parse_dir_entries(dir);
+}
+
+static void free_dir_entries(struct fat_dir *dir)
+{
+	free(dir->fsent);
+	free(dir->names);
+	free(dir->htab);
+	free(dir->hnext);
+	dir->fsent = 0;
+	dir->names = 0;
+	dir->htab = dir->hnext = 0;
+	dir->fsent_size = dir->fsent_max = 0;
+}
+
+/* return the directory starting at clust if it's loaded, without loading it
+ * or taking a reference.
+ */
+static struct fat_dir *find_loaded_dir(struct fatfs *fatfs, uint32_t clust)
+{
+	struct fat_dir *dir = fatfs->dirs;
+
+	while(dir) {
+		if(dir->first_clust == clust) {
+			return dir;
+		}
+		dir = dir->next;
+	}
+	return 0;
+}
+
+static void unlink_dir(struct fatfs *fatfs, struct fat_dir *dir)
+{
+	struct fat_dir **prev = &fatfs->dirs;
+
+	while(*prev) {
+		if(*prev == dir) {
+			*prev = dir->next;
+			break;
+		}
+		prev = &(*prev)->next;
+	}
+	dir->next = 0;
+}
+
+/* get a reference to the directory starting at clust, loading it if nobody
+ * else is using it. Release it with put_dir.
+ */
+static struct fat_dir *get_dir(struct fatfs *fatfs, uint32_t clust)
+{
+	struct fat_dir *dir;
+	struct fat_dirent ent;
+
+	if((dir = find_loaded_dir(fatfs, clust))) {
+		dir->ref++;
+		return dir;
+	}
+
+	memset(&ent, 0, sizeof ent);
+	ent.attr = ATTR_DIR;
+	ent.first_cluster_low = clust;
+	ent.first_cluster_high = clust >> 16;
+	if(!(dir = load_dir(fatfs, &ent))) {
+		return 0;
+	}
+	dir->ref = 1;
+	dir->next = fatfs->dirs;
+	fatfs->dirs = dir;
+	return dir;
+}
+
+static void put_dir(struct fatfs *fatfs, struct fat_dir *dir)
+{
+	if(!dir || --dir->ref > 0) {
+		return;
+	}
+
+	unlink_dir(fatfs, dir);
+	free(dir->ent);
+	free_dir_entries(dir);
+	free(dir);
+}
+
+static struct fat_file *init_file(struct fatfs *fatfs, struct fat_dirent *dent, struct dent_loc *loc,
+		const char *name)
+{
+	struct fat_file *file;
+
+	if(!(file = calloc(1, sizeof *file))) {
+		panic("FAT: failed to allocate file structure\n");
+	}
+	if(!(file->clustbuf = malloc(fatfs->cluster_size * 512))) {
+		panic("FAT: failed to allocate file cluster buffer\n");
+	}
+	file->ent = *dent;
+	file->first_clust = dent->first_cluster_low | ((int32_t)dent->first_cluster_high << 16);
+	file->cur_clust = file->first_clust ? file->first_clust : -1;
+	file->loc = *loc;
+	set_file_name(file, name);
+	file->disk_size = dent->size_bytes;
+	file->num_clust = -1;
+
+	file->next = fatfs->files;
+	fatfs->files = file;
+	return file;
+}
+
+static void free_file(struct fatfs *fatfs, struct fat_file *file)
+{
+	struct fat_file **prev = &fatfs->files;
+
+	if(file) {
+		while(*prev && *prev != file) {
+			prev = &(*prev)->next;
+		}
+		if(*prev) *prev = file->next;
+
+		free(file->name);
+		free(file->wrbuf);
+		free(file->clustbuf);
+		free(file);
+	}
+}
+
+static void set_file_name(struct fat_file *file, const char *name)
+{
+	free(file->name);
+	if(!(file->name = malloc(strlen(name) + 1))) {
+		panic("FAT: failed to allocate file name\n");
+	}
+	strcpy(file->name, name);
+}
+
+/* find another open handle to the same directory entry as file */
+static struct fat_file *find_other_file(struct fatfs *fatfs, struct fat_file *file)
+{
+	struct fat_file *f = fatfs->files;
+
+	while(f) {
+		if(f != file && f->loc.idx >= 0 && f->loc.idx == file->loc.idx &&
+				f->loc.dir_clust == file->loc.dir_clust) {
+			return f;
+		}
+		f = f->next;
+	}
+	return 0;
+}
+
+/* write_back, then find the current cluster again, since cur_pos might be in
+ * clusters which were just allocated.
+ */
+static int flush_file(struct fatfs *fatfs, struct fat_file *file)
+{
+	int res, wrote = file->wr_len > 0;
+
+	res = write_back(fatfs, file);
+	if(wrote) {
+		sync_cur_clust(fatfs, file);
+	}
+	return res;
+}
+
+/* write out any buffered data, allocating clusters for it as necessary, and
+ * update the directory entry and the FAT.
+ */
+static int write_back(struct fatfs *fatfs, struct fat_file *file)
+{
+	int need, res = 0;
+	int32_t clust, last;
+
+	if(!file->wr_len && !file->dent_dirty) {
+		return 0;
+	}
+
+	if(file->wr_len > 0) {
+		if(file->num_clust < 0) {
+			/* count the clusters already allocated to the file */
+			file->num_clust = 0;
+			file->last_clust = 0;
+			if((clust = file->first_clust) >= 2) {
+				do {
+					file->last_clust = clust;
+					file->num_clust++;
+				} while((clust = next_cluster(fatfs, clust)) >= 0);
+			}
+		}
+
+		need = ((int64_t)file->ent.size_bytes + fatfs->clust_mask) >> fatfs->clust_shift;
+		if(need > file->num_clust) {
+			clust = alloc_clusters(fatfs, need - file->num_clust, file->last_clust, &last);
+			if(clust == -1) {
+				/* shouldn't happen since we reserved space in write */
+				printf("FAT: failed to allocate %d clusters\n", need - file->num_clust);
+				file->ent.size_bytes = file->disk_size;
+				file->wr_len = 0;
+				release_resv(fatfs, file);
+				errno = ENOSPC;
+				return -1;
+			}
+			if(!file->first_clust) {
+				file->first_clust = clust;
+				file->ent.first_cluster_low = clust;
+				file->ent.first_cluster_high = clust >> 16;
+			}
+			file->last_clust = last;
+			file->num_clust = need;
+			file->dent_dirty = 1;
+		}
+		release_resv(fatfs, file);
+
+		if(write_file_data(fatfs, file) == -1) {
+			res = -1;
+		}
+		file->disk_size = file->ent.size_bytes;
+		file->wr_len = 0;
+	}
+
+	if(file->dent_dirty && file->loc.idx >= 0) {
+		if(write_dirent(fatfs, file) == -1) {
+			res = -1;
+		}
+		file->dent_dirty = 0;
+	}
+	if(flush_fat(fatfs) == -1) {
+		res = -1;
+	}
+	return res;
+}
+
+/* reserve enough free clusters to grow the file to size bytes */
+static int reserve_clusters(struct fatfs *fatfs, struct fat_file *file, int64_t size)
+{
+	int32_t clust;
+	int need, extra;
+
+	if(!fatfs->freemap) {
+		build_freemap(fatfs);
+	}
+	if(file->num_clust < 0) {
+		file->num_clust = 0;
+		file->last_clust = 0;
+		if((clust = file->first_clust) >= 2) {
+			do {
+				file->last_clust = clust;
+				file->num_clust++;
+			} while((clust = next_cluster(fatfs, clust)) >= 0);
+		}
+	}
+
+	need = (size + fatfs->clust_mask) >> fatfs->clust_shift;
+	extra = need - file->num_clust - file->num_resv;
+	if(extra > 0) {
+		if(extra > fatfs->num_free - fatfs->num_resv) {
+			errno = ENOSPC;
+			return -1;
+		}
+		fatfs->num_resv += extra;
+		file->num_resv += extra;
+	}
+	return 0;
+}
+
+static void release_resv(struct fatfs *fatfs, struct fat_file *file)
+{
+	fatfs->num_resv -= file->num_resv;
+	file->num_resv = 0;
+}
+
+/* write the contents of the write buffer to the file clusters. Whole clusters
+ * which are consecutive on disk are written directly from the write buffer with
+ * a single call, partial clusters are merged with the existing data first.
+ */
+static int write_file_data(struct fatfs *fatfs, struct fat_file *file)
+{
+	int32_t clust, last;
+	int64_t pos = file->wr_start;
+	int64_t end = file->wr_start + file->wr_len;
+	char *src = file->wrbuf;
+	int offs, len, nclust;
+	int csize = fatfs->cluster_size * 512;
+
+	clust = find_cluster(fatfs, pos >> fatfs->clust_shift, file->first_clust);
+
+	while(pos < end) {
+		if(clust < 2) {
+			printf("FAT: BUG: write past the end of the cluster chain\n");
+			return -1;
+		}
+
+		offs = pos & fatfs->clust_mask;
+		if(offs || end - pos < csize) {
+			len = csize - offs;
+			if(len > end - pos) len = end - pos;
+
+			if(pos - offs < file->disk_size) {
+				if(read_cluster(fatfs, clust, file->clustbuf) == -1) {
+					return -1;
+				}
+			} else {
+				memset(file->clustbuf, 0, csize);
+			}
+			memcpy(file->clustbuf + offs, src, len);
+			file->buf_valid = 0;
+
+			if(write_clusters(fatfs, clust, 1, file->clustbuf) == -1) {
+				return -1;
+			}
+			last = clust;
+
+		} else {
+			nclust = 1;
+			last = clust;
+			while(end - pos >= (int64_t)(nclust + 1) * csize &&
+					next_cluster(fatfs, last) == last + 1) {
+				last++;
+				nclust++;
+			}
+			len = nclust * csize;
+
+			if(write_clusters(fatfs, clust, nclust, src) == -1) {
+				return -1;
+			}
+		}
+
+		pos += len;
+		src += len;
+		if(pos < end) {
+			clust = next_cluster(fatfs, last);
+		}
+	}
+	return 0;
+}
+
+/* update the size and first cluster fields of the file's directory entry */
+static int write_dirent(struct fatfs *fatfs, struct fat_file *file)
+{
+	uint32_t offs;
+	uint64_t sidx;
+	int32_t clust;
+	struct fat_dirent *dent;
+	struct fat_dir *dir;
+	struct fs_dirent *fsent;
+
+	offs = file->loc.idx * sizeof *dent;
+	if(!file->loc.dir_clust) {
+		sidx = fatfs->start_sect + fatfs->root_sect + offs / 512;
+	} else {
+		clust = find_cluster(fatfs, offs >> fatfs->clust_shift, file->loc.dir_clust);
+		if(clust < 0) return -1;
+		sidx = clust_to_sect(fatfs, clust) + (offs & fatfs->clust_mask) / 512;
+	}
+
+	if(read_sectors(fatfs->dev, sidx, 1, sectbuf) == -1) {
+		return -1;
+	}
+	dent = (struct fat_dirent*)(sectbuf + (offs & 511));
+	dent->first_cluster_low = file->ent.first_cluster_low;
+	dent->first_cluster_high = file->ent.first_cluster_high;
+	dent->size_bytes = file->ent.size_bytes;
+	if(write_sectors(fatfs->dev, sidx, 1, sectbuf) == -1) {
+		return -1;
+	}
+
+	/* the path lookup cache keeps a copy of the entry */
+	dcache_remove(fatfs->fs, file->loc.dir_clust, file->name);
+
+	/* keep the directory in sync, if it's loaded. Only the size and cluster
+	 * changed, so the parsed names and the hash index are still valid.
+	 */
+	if((dir = find_loaded_dir(fatfs, file->loc.dir_clust)) && file->loc.idx < dir->max_nent) {
+		dir->ent[file->loc.idx] = *dent;
+		if(file->loc.idx < dir->parsed && (fsent = find_entry(dir, file->name)) &&
+				fsent->data == dir->ent + file->loc.idx) {
+			fsent->fsize = dent->size_bytes;
+		}
+	}
+	return 0;
+}
+
+static void sync_cur_clust(struct fatfs *fatfs, struct fat_file *file)
+{
+	if(file->first_clust) {
+		file->cur_clust = find_cluster(fatfs, file->cur_pos >> fatfs->clust_shift, file->first_clust);
+	} else {
+		file->cur_clust = -1;
+	}
+	file->buf_valid = 0;
+}
+
+/* create a new file or directory entry named name in dir. Returns the index of
+ * the new short entry in dir->ent.
+ */
+static int create_entry(struct fatfs *fatfs, struct fat_dir *dir, const char *name, int attr)
+{
+	int idx;
+	int32_t clust = 0;
+	struct fat_dirent ent;
+
+	memset(&ent, 0, sizeof ent);
+	ent.attr = attr;
+
+	if(attr & ATTR_DIR) {
+		if(!fatfs->freemap) {
+			build_freemap(fatfs);
+		}
+		if(fatfs->num_free - fatfs->num_resv < 1) {
+			errno = ENOSPC;
+			return -1;
+		}
+		if((clust = alloc_clusters(fatfs, 1, 0, 0)) == -1) {
+			return -1;
+		}
+		if(init_dir_cluster(fatfs, clust, dir->first_clust) == -1) {
+			free_chain(fatfs, clust);
+			return -1;
+		}
+		ent.first_cluster_low = clust;
+		ent.first_cluster_high = clust >> 16;
+	}
+
+	if((idx = add_dir_entry(fatfs, dir, name, &ent)) == -1) {
+		if(clust) {
+			free_chain(fatfs, clust);
+		}
+	}
+	if(flush_fat(fatfs) == -1) {
+		return -1;
+	}
+	return idx;
+}
+
+/* add an entry to dir, with the long name name and a generated short name.
+ * All fields other than the short name are copied from ent.
+ */
+static int add_dir_entry(struct fatfs *fatfs, struct fat_dir *dir, const char *name, struct fat_dirent *ent)
+{
+	int i, j, len, nlfn, idx;
+	char sname[11];
+	unsigned char csum;
+	struct fat_lfnent *lfn;
+	const char *ptr;
+
+	len = strlen(name);
+	if(!len || len >= MAX_NAME || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	for(ptr=name; *ptr; ptr++) {
+		if((unsigned char)*ptr < 32 || strchr("\\/:*?\"<>|", *ptr)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	/* we need all the entries, to check for short name collisions and free
+	 * slots, and to append to the end of the cluster chain
+	 */
+	if(load_dir_all(dir) == -1) {
+		errno = EIO;
+		return -1;
+	}
+
+	nlfn = make_short_name(dir, name, sname) ? 0 : (len + LFN_CHARS - 1) / LFN_CHARS;
+
+	while((idx = find_free_slots(dir, nlfn + 1)) == -1) {
+		if(extend_dir(fatfs, dir) == -1) {
+			return -1;
+		}
+	}
+
+	csum = 0;
+	for(i=0; i<11; i++) {
+		csum = ((csum & 1) << 7) + (csum >> 1) + (unsigned char)sname[i];
+	}
+
+	/* LFN entries are stored in reverse order before the short entry */
+	for(i=0; i<nlfn; i++) {
+		uint16_t ustr[LFN_CHARS];
+
+		ptr = name + i * LFN_CHARS;
+		for(j=0; j<LFN_CHARS; j++) {
+			if(ptr + j < name + len) {
+				ustr[j] = (unsigned char)ptr[j];
+			} else {
+				ustr[j] = ptr + j == name + len ? 0 : 0xffff;
+			}
+		}
+
+		lfn = (struct fat_lfnent*)(dir->ent + idx + nlfn - 1 - i);
+		memset(lfn, 0, sizeof *lfn);
+		lfn->seq = (i + 1) | (i == nlfn - 1 ? LFN_LAST : 0);
+		lfn->attr = ATTR_LFN;
+		lfn->csum = csum;
+		memcpy(lfn->part1, ustr, sizeof lfn->part1);
+		memcpy(lfn->part2, ustr + 5, sizeof lfn->part2);
+		memcpy(lfn->part3, ustr + 11, sizeof lfn->part3);
+	}
+
+	dir->ent[idx + nlfn] = *ent;
+	memcpy(dir->ent[idx + nlfn].name, sname, 11);
+
+	/* drop any negative path lookup cache entry for the new name */
+	dcache_remove(fatfs->fs, dir->first_clust, name);
+
+	if(write_dir_ents(fatfs, dir, idx, nlfn + 1) == -1) {
+		return -1;
+	}
+	reparse_dir(dir);
+	return idx + nlfn;
+}
+
+/* mark the short entry and its LFN entries as unused */
+static int delete_entries(struct fatfs *fatfs, struct fat_dir *dir, struct dent_loc *loc)
+{
+	int i, first = loc->idx - loc->nlfn;
+
+	for(i=0; i<dir->fsent_size; i++) {
+		if(dir->fsent[i].data == dir->ent + loc->idx) {
+			dcache_remove(fatfs->fs, dir->first_clust, dir->fsent[i].name);
+			break;
+		}
+	}
+
+	for(i=first; i<=loc->idx; i++) {
+		dir->ent[i].name[0] = (char)DIRENT_UNUSED;
+	}
+	if(write_dir_ents(fatfs, dir, first, loc->nlfn + 1) == -1) {
+		return -1;
+	}
+	reparse_dir(dir);
+	return 0;
+}
+
+/* find count consecutive unused entries. Everything after the first null
+ * entry is also free.
+ */
+static int find_free_slots(struct fat_dir *dir, int count)
+{
+	int i, run = 0;
+
+	for(i=0; i<dir->max_nent; i++) {
+		if(DENT_IS_NULL(dir->ent + i)) {
+			if(dir->max_nent - i + run >= count) {
+				return i - run;
+			}
+			break;
+		}
+		if(DENT_IS_UNUSED(dir->ent + i)) {
+			if(++run >= count) {
+				return i - run + 1;
+			}
+		} else {
+			run = 0;
+		}
+	}
+	return -1;
+}
+
+/* add a zeroed cluster at the end of a directory */
+static int extend_dir(struct fatfs *fatfs, struct fat_dir *dir)
+{
+	int csize = fatfs->cluster_size * 512;
+	int32_t clust, last;
+
+	if(!dir->first_clust) {
+		errno = ENOSPC;	/* FAT12/16 root directory can't grow */
+		return -1;
+	}
+	if(!fatfs->freemap) {
+		build_freemap(fatfs);
+	}
+	if(fatfs->num_free - fatfs->num_resv < 1) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	last = dir->first_clust;
+	while((clust = next_cluster(fatfs, last)) >= 0) {
+		last = clust;
+	}
+
+	if(grow_dir_ents(dir, dir->max_nent + csize / sizeof *dir->ent) == -1) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memset(dir->ent + dir->max_nent, 0, csize);
+
+	if((clust = alloc_clusters(fatfs, 1, last, 0)) == -1) {
+		return -1;
+	}
+	if(write_clusters(fatfs, clust, 1, dir->ent + dir->max_nent) == -1) {
+		return -1;
+	}
+	dir->max_nent += csize / sizeof *dir->ent;
+	return 0;
+}
+
+/* write the sectors containing the entries [first, first + count) of dir */
+static int write_dir_ents(struct fatfs *fatfs, struct fat_dir *dir, int first, int count)
+{
+	int sect, nsect, n, run_len;
+	uint32_t offs, end;
+	uint64_t lba, run_lba = 0;
+	int32_t clust;
+	char *ptr, *run_ptr = 0;
+
+	offs = first * sizeof *dir->ent;
+	end = (first + count) * sizeof *dir->ent;
+	sect = offs / 512;
+	nsect = (end - 1) / 512 - sect + 1;
+	ptr = (char*)dir->ent + sect * 512;
+
+	if(!dir->first_clust) {
+		return write_sectors(fatfs->dev, fatfs->start_sect + fatfs->root_sect + sect, nsect, ptr);
+	}
+
+	/* coalesce sectors which are also consecutive on disk into a single write */
+	clust = find_cluster(fatfs, sect / fatfs->cluster_size, dir->first_clust);
+	run_len = 0;
+	while(nsect > 0) {
+		if(clust < 0) return -1;
+
+		lba = clust_to_sect(fatfs, clust) + sect % fatfs->cluster_size;
+		n = fatfs->cluster_size - sect % fatfs->cluster_size;
+		if(n > nsect) n = nsect;
+
+		if(run_len && run_lba + run_len == lba) {
+			run_len += n;
+		} else {
+			if(run_len && write_sectors(fatfs->dev, run_lba, run_len, run_ptr) == -1) {
+				return -1;
+			}
+			run_lba = lba;
+			run_len = n;
+			run_ptr = ptr;
+		}
+
+		ptr += n * 512;
+		sect += n;
+		nsect -= n;
+		if(nsect > 0) {
+			clust = next_cluster(fatfs, clust);
+		}
+	}
+	return write_sectors(fatfs->dev, run_lba, run_len, run_ptr);
+}
+
+/* initialize the first cluster of a new directory with the . and .. entries */
+static int init_dir_cluster(struct fatfs *fatfs, uint32_t clust, uint32_t parent)
+{
+	int res, csize = fatfs->cluster_size * 512;
+	struct fat_dirent *ent;
+
+	if(!(ent = calloc(1, csize))) {
+		errno = ENOMEM;
+		return -1;
+	}
+	/* .. entries pointing to the root directory have a 0 cluster address */
+	if(parent == fatfs->root_clust) {
+		parent = 0;
+	}
+
+	memset(ent[0].name, ' ', 11);
+	ent[0].name[0] = '.';
+	ent[0].attr = ATTR_DIR;
+	ent[0].first_cluster_low = clust;
+	ent[0].first_cluster_high = clust >> 16;
+
+	memset(ent[1].name, ' ', 11);
+	ent[1].name[0] = ent[1].name[1] = '.';
+	ent[1].attr = ATTR_DIR;
+	ent[1].first_cluster_low = parent;
+	ent[1].first_cluster_high = parent >> 16;
+
+	res = write_clusters(fatfs, clust, 1, ent);
+	free(ent);
+	return res;
+}
+
+static int valid_short_char(int c)
+{
+	return isalnum(c) || (c & 0x80) || (c && strchr("!#$%&'()-@^_`{}~", c));
+}
+
+/* Generate the short 8.3 name for a new entry. Returns 1 if name can be stored
+ * as is, or 0 if a numeric-tail alias was generated, and LFN entries are needed.
+ */
+static int make_short_name(struct fat_dir *dir, const char *name, char *sname)
+{
+	int i, j, num, baselen, extlen, numlen, exact = 1;
+	char base[8], ext[3], numstr[8];
+	const char *dot, *ptr;
+
+	if(!(dot = strrchr(name, '.')) || dot == name) {
+		dot = name + strlen(name);
+	}
+
+	baselen = 0;
+	for(ptr=name; ptr<dot; ptr++) {
+		if(*ptr == ' ' || *ptr == '.') {
+			exact = 0;
+			continue;
+		}
+		if(baselen >= 8) {
+			exact = 0;
+			break;
+		}
+		if(!valid_short_char(*ptr) || islower(*ptr)) exact = 0;
+		base[baselen++] = valid_short_char(*ptr) ? toupper(*ptr) : '_';
+	}
+
+	extlen = 0;
+	if(*dot) {
+		for(ptr=dot+1; *ptr; ptr++) {
+			if(*ptr == ' ') {
+				exact = 0;
+				continue;
+			}
+			if(extlen >= 3) {
+				exact = 0;
+				break;
+			}
+			if(!valid_short_char(*ptr) || islower(*ptr)) exact = 0;
+			ext[extlen++] = valid_short_char(*ptr) ? toupper(*ptr) : '_';
+		}
+	}
+	if(!baselen) {
+		base[baselen++] = '_';
+		exact = 0;
+	}
+
+	memset(sname, ' ', 11);
+	memcpy(sname + 8, ext, extlen);
+
+	if(exact) {
+		memcpy(sname, base, baselen);
+		return 1;
+	}
+
+	/* find the first free numeric tail: NAME~1, NAME~2 ... */
+	for(num=1; num<1000000; num++) {
+		sprintf(numstr, "~%d", num);
+		numlen = strlen(numstr);
+		j = baselen < 8 - numlen ? baselen : 8 - numlen;
+
+		memset(sname, ' ', 8);
+		memcpy(sname, base, j);
+		memcpy(sname + j, numstr, numlen);
+
+		for(i=0; i<dir->max_nent; i++) {
+			struct fat_dirent *dent = dir->ent + i;
+			if(DENT_IS_NULL(dent)) {
+				i = dir->max_nent;
+				break;
+			}
+			if(!DENT_IS_UNUSED(dent) && dent->attr != ATTR_LFN &&
+					memcmp(dent->name, sname, 11) == 0) {
+				break;
+			}
+		}
+		if(i >= dir->max_nent) {
+			break;
+		}
+	}
+	return 0;
+}
+
+/* first cluster of a directory entry. The high half is only valid on FAT32 */
+static uint32_t dent_cluster(struct fatfs *fatfs, struct fat_dirent *dent)
+{
+	uint32_t clust = dent->first_cluster_low;
+	if(fatfs->type >= FAT32) {
+		clust |= (uint32_t)dent->first_cluster_high << 16;
+	}
+	return clust;
+}
+
+/* count the LFN entries belonging to the short entry at idx */
+static int count_lfn(struct fat_dir *dir, int idx)
+{
+	int n = 0;
+	struct fat_lfnent *lfn;
+
+	while(--idx >= 0) {
+		lfn = (struct fat_lfnent*)(dir->ent + idx);
+		if(lfn->attr != ATTR_LFN || DENT_IS_UNUSED(lfn)) {
+			break;
+		}
+		n++;
+		if(lfn->seq & LFN_LAST) {
+			break;
+		}
+	}
+	return n;
+}
+
+static int read_sectors(int dev, uint64_t sidx, int count, void *sect)
+{
+	char *ptr = sect;
+
+	if(dev == -1 || dev == boot_drive_number) {
+		/* reads go through the low memory buffer, don't overflow it */
+		while(count > 0) {
+			int n = count > max_sect_once ? max_sect_once : count;
+
+			if(bdev_read_range(sidx, n, ptr) == -1) {
+				return -1;
+			}
+			sidx += n;
+			ptr += n * 512;
+			count -= n;
+		}
+		return 0;
+	}
+
+	printf("BUG: reading sectors from drives other than the boot drive not implemented yet\n");
+	return -1;
+}
+
+static int write_sectors(int dev, uint64_t sidx, int count, void *sect)
+{
+	char *ptr = sect;
+
+	if(dev == -1 || dev == boot_drive_number) {
+		while(count > 0) {
+			int n = count > max_sect_once ? max_sect_once : count;
+
+			if(bdev_write_range(sidx, n, ptr) == -1) {
+				return -1;
+			}
+			sidx += n;
+			ptr += n * 512;
+			count -= n;
+		}
+		return 0;
+	}
+
+	printf("BUG: writing sectors to drives other than the boot drive not implemented yet\n");
+	return -1;
+}
+
+static uint64_t clust_to_sect(struct fatfs *fatfs, uint32_t addr)
+{
+	return (uint64_t)(addr - 2) * fatfs->cluster_size + fatfs->first_data_sect + fatfs->start_sect;
+}
+
+static int read_cluster(struct fatfs *fatfs, uint32_t addr, void *clust)
+{
+	char *ptr = clust;
+	uint64_t saddr = clust_to_sect(fatfs, addr);
+
+	if(read_sectors(fatfs->dev, saddr, fatfs->cluster_size, ptr) == -1) {
+		return -1;
+	}
+	return 0;
+}
+
+/* write count clusters, which must be consecutive on disk */
+static int write_clusters(struct fatfs *fatfs, uint32_t addr, int count, void *clust)
+{
+	uint64_t saddr = clust_to_sect(fatfs, addr);
+	return write_sectors(fatfs->dev, saddr, count * fatfs->cluster_size, clust);
+}
+
+static int dent_filename(struct fat_dirent *dent, struct fat_dirent *prev, char *buf)
+{
+	int len = 0;
+	char *ptr = buf;
+	struct fat_lfnent *lfn = (struct fat_lfnent*)(dent - 1);
+
+	if(lfn > (struct fat_lfnent*)prev && lfn->attr == ATTR_LFN) {
+		/* found a long filename entry, use that */
+		do {
+			uint16_t ustr[14], *uptr = ustr;
+			memcpy(uptr, lfn->part1, sizeof lfn->part1);
 			uptr += sizeof lfn->part1 / sizeof *lfn->part1;
 			memcpy(uptr, lfn->part2, sizeof lfn->part2);
 			uptr += sizeof lfn->part2 / sizeof *lfn->part2;
@@ -851,12 +2399,101 @@ static int dent_filename(struct fat_dirent *dent, struct fat_dirent *prev, char
 	return len;
 }
 
+/* case-insensitive FNV-1a */
+static unsigned int name_hash(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while(*name) {
+		h = (h ^ (unsigned char)tolower(*name++)) * 16777619u;
+	}
+	return h;
+}
+
+static void build_dir_index(struct fat_dir *dir)
+{
+	int i, bucket, size;
+
+	/* keep the load factor between 0.25 and 0.5 */
+	size = DIR_HASH_MIN * 2;
+	while(size < dir->fsent_size * 2) size <<= 1;
+
+	free(dir->htab);
+	if(!(dir->htab = malloc(size * sizeof *dir->htab))) {
+		panic("FAT: failed to allocate directory hash table\n");
+	}
+	dir->htab_mask = size - 1;
+	memset(dir->htab, 0xff, size * sizeof *dir->htab);
+
+	/* insert in reverse, so that chains are in directory order */
+	for(i=dir->fsent_size-1; i>=0; i--) {
+		bucket = name_hash(dir->fsent[i].name) & dir->htab_mask;
+		dir->hnext[i] = dir->htab[bucket];
+		dir->htab[bucket] = i;
+	}
+}
+
+/* add a newly parsed entry to the hash index, creating or growing the index
+ * as the directory grows.
+ */
+static void index_entry(struct fat_dir *dir, int idx)
+{
+	int bucket;
+
+	if(dir->fsent_size < DIR_HASH_MIN) {
+		return;
+	}
+	if(!dir->htab || dir->fsent_size * 2 > dir->htab_mask + 1) {
+		build_dir_index(dir);
+		return;
+	}
+
+	bucket = name_hash(dir->fsent[idx].name) & dir->htab_mask;
+	dir->hnext[idx] = dir->htab[bucket];
+	dir->htab[bucket] = idx;
+}
+
 static struct fs_dirent *find_entry(struct fat_dir *dir, const char *name)
+{
+	int i, start = 0;
+	unsigned int hash;
+	struct fs_dirent *dent;
+
+	hash = name_hash(name);
+
+	/* if it's not in the entries parsed so far, keep loading the directory
+	 * until we find it, or reach the end.
+	 */
+	for(;;) {
+		if(dir->htab) {
+			i = dir->htab[hash & dir->htab_mask];
+			while(i >= 0) {
+				dent = dir->fsent + i;
+				if(strcasecmp(dent->name, name) == 0) {
+					return dent;
+				}
+				i = dir->hnext[i];
+			}
+		} else if((dent = find_entry_linear(dir, name, start))) {
+			return dent;
+		}
+
+		start = dir->fsent_size;
+		if(!load_dir_more(dir)) {
+			break;
+		}
+	}
+	return 0;
+}
+
+static struct fs_dirent *find_entry_linear(struct fat_dir *dir, const char *name, int start)
 {
 	int i;
-	struct fs_dirent *dent = dir->fsent;
+	struct fs_dirent *dent;
 
-	for(i=0; i<dir->fsent_size; i++) {
+	dent = dir->fsent + start;
+
+	for(i=start; i<dir->fsent_size; i++) {
 		if(strcasecmp(dent->name, name) == 0) {
 			return dent;
 		}
@@ -865,17 +2502,176 @@ static struct fs_dirent *find_entry(struct fat_dir *dir, const char *name)
 	return 0;
 }
 
+static void init_fat_cache(struct fatfs *fatfs)
+{
+	int i, nwin;
+	unsigned char *buf;
+
+	/* no point in keeping more windows than the FAT has */
+	nwin = (fatfs->fat_size + FAT_WIN_SECT - 1) / FAT_WIN_SECT;
+	if(nwin > FAT_NUM_WIN) nwin = FAT_NUM_WIN;
+	/* FAT12 entries may straddle two windows, so we need at least 2 */
+	if(nwin < 2) nwin = 2;
+
+	if(!(fatfs->fatwin = malloc(nwin * sizeof *fatfs->fatwin))) {
+		panic("FAT: failed to allocate FAT cache\n");
+	}
+	if(!(buf = malloc(nwin * FAT_WIN_SIZE))) {
+		panic("FAT: failed to allocate FAT cache buffer (%d bytes)\n", nwin * FAT_WIN_SIZE);
+	}
+	for(i=0; i<nwin; i++) {
+		fatfs->fatwin[i].idx = -1;
+		fatfs->fatwin[i].nsect = 0;
+		fatfs->fatwin[i].dirty = 0;
+		fatfs->fatwin[i].last_use = 0;
+		fatfs->fatwin[i].data = buf + i * FAT_WIN_SIZE;
+	}
+	fatfs->num_win = nwin;
+	fatfs->last_win = 0;
+	fatfs->win_clock = 0;
+}
+
+/* return the cached FAT window widx, loading it if necessary, and evicting the
+ * least recently used window if the cache is full.
+ */
+static struct fat_window *get_fat_window(struct fatfs *fatfs, int32_t widx)
+{
+	int i;
+	struct fat_window *win, *lru;
+
+	if((win = fatfs->last_win) && win->idx == widx) {
+		win->last_use = ++fatfs->win_clock;
+		return win;
+	}
+
+	lru = fatfs->fatwin;
+	for(i=0; i<fatfs->num_win; i++) {
+		win = fatfs->fatwin + i;
+		if(win->idx == widx) {
+			goto done;
+		}
+		if(win->last_use < lru->last_use) {
+			lru = win;
+		}
+	}
+
+	win = lru;
+	if(win->dirty && write_fat_window(fatfs, win) == -1) {
+		return 0;
+	}
+
+	win->idx = -1;
+	win->nsect = fatfs->fat_size - widx * FAT_WIN_SECT;
+	if(win->nsect > FAT_WIN_SECT) win->nsect = FAT_WIN_SECT;
+	if(win->nsect <= 0 || read_sectors(fatfs->dev, fatfs->start_sect + fatfs->fat_sect +
+				widx * FAT_WIN_SECT, win->nsect, win->data) == -1) {
+		win->last_use = 0;
+		return 0;
+	}
+	win->idx = widx;
+
+done:
+	win->last_use = ++fatfs->win_clock;
+	fatfs->last_win = win;
+	return win;
+}
+
+/* write the dirty sectors of a FAT window to every copy of the FAT on disk,
+ * coalescing consecutive dirty sectors into a single write.
+ */
+static int write_fat_window(struct fatfs *fatfs, struct fat_window *win)
+{
+	int i, start, end, res = 0;
+	uint64_t sidx;
+
+	start = 0;
+	while(start < win->nsect) {
+		if(!(win->dirty & (1 << start))) {
+			start++;
+			continue;
+		}
+		end = start;
+		while(end < win->nsect && (win->dirty & (1 << end))) {
+			end++;
+		}
+
+		for(i=0; i<fatfs->num_fats; i++) {
+			sidx = fatfs->start_sect + fatfs->fat_sect + i * fatfs->fat_size +
+				win->idx * FAT_WIN_SECT + start;
+			if(write_sectors(fatfs->dev, sidx, end - start, win->data + start * 512) == -1) {
+				res = -1;
+			}
+		}
+		start = end;
+	}
+
+	win->dirty = 0;
+	return res;
+}
+
+/* return a pointer to the byte at offset offs in the FAT, or null if it failed
+ * to load. If wr is non-zero, the sector containing it is marked dirty.
+ */
+static unsigned char *fat_ptr(struct fatfs *fatfs, uint32_t offs, int wr)
+{
+	struct fat_window *win;
+	uint32_t woffs;
+
+	if(!(win = get_fat_window(fatfs, offs / FAT_WIN_SIZE))) {
+		return 0;
+	}
+	woffs = offs % FAT_WIN_SIZE;
+	if(wr) {
+		win->dirty |= 1 << (woffs / 512);
+		fatfs->fat_dirty_any = 1;
+	}
+	return win->data + woffs;
+}
+
+/* load the FAT windows covering count clusters starting from clust, in
+ * anticipation of following a mostly contiguous cluster chain. At most half
+ * the cache is used for this, to avoid thrashing it for large files.
+ */
+static void prefetch_fat(struct fatfs *fatfs, uint32_t clust, uint32_t count)
+{
+	int32_t widx, wend;
+	uint32_t entsz;
+
+	if(clust < 2 || !count) return;
+
+	entsz = fatfs->type == FAT12 ? 3 : (fatfs->type == FAT16 ? 4 : 8);	/* x2 */
+	widx = clust * entsz / 2 / FAT_WIN_SIZE;
+	wend = ((clust + count) * entsz / 2 + 1) / FAT_WIN_SIZE;
+
+	if(wend - widx >= fatfs->num_win / 2) {
+		wend = widx + fatfs->num_win / 2 - 1;
+	}
+	while(widx <= wend) {
+		if(!get_fat_window(fatfs, widx++)) break;
+	}
+}
+
 static uint32_t read_fat(struct fatfs *fatfs, uint32_t addr)
 {
 	uint32_t res = 0xffffffff;
+	unsigned char *ptr;
 
 	switch(fatfs->type) {
 	case FAT12:
 		{
+			/* entries are 12 bits, packed 2 per 3 bytes. They might straddle a
+			 * window boundary, so access each byte separately.
+			 */
 			uint32_t idx = addr + addr / 2;
-			res = ((uint16_t*)fatfs->fat)[idx];
+			if(!(ptr = fat_ptr(fatfs, idx, 0))) break;
+			res = *ptr;
+			if(!(ptr = fat_ptr(fatfs, idx + 1, 0))) {
+				res = 0xffffffff;
+				break;
+			}
+			res |= (uint32_t)*ptr << 8;
 
-			if(idx & 1) {
+			if(addr & 1) {
 				res >>= 4;		/* odd entries end up on the high 12 bits */
 			} else {
 				res &= 0xfff;	/* even entries end up on the low 12 bits */
@@ -884,18 +2680,102 @@ static uint32_t read_fat(struct fatfs *fatfs, uint32_t addr)
 		break;
 
 	case FAT16:
-		res = ((uint16_t*)fatfs->fat)[addr];
+		if((ptr = fat_ptr(fatfs, addr * 2, 0))) {
+			res = *(uint16_t*)ptr;
+		}
+		break;
+
+	case FAT32:
+	case EXFAT:
+		if((ptr = fat_ptr(fatfs, addr * 4, 0))) {
+			res = *(uint32_t*)ptr & 0x0fffffff;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return res;
+}
+
+static void write_fat(struct fatfs *fatfs, uint32_t addr, uint32_t val)
+{
+	uint32_t offs;
+	unsigned char *ptr;
+	uint32_t *ptr32;
+
+	switch(fatfs->type) {
+	case FAT12:
+		/* modify each byte before fetching the next, in case they are in
+		 * different windows
+		 */
+		offs = addr + addr / 2;
+		if(!(ptr = fat_ptr(fatfs, offs, 1))) break;
+		if(addr & 1) {
+			*ptr = (*ptr & 0xf) | ((val << 4) & 0xf0);
+		} else {
+			*ptr = val & 0xff;
+		}
+		if(!(ptr = fat_ptr(fatfs, offs + 1, 1))) break;
+		if(addr & 1) {
+			*ptr = (val >> 4) & 0xff;
+		} else {
+			*ptr = (*ptr & 0xf0) | ((val >> 8) & 0xf);
+		}
+		break;
+
+	case FAT16:
+		if((ptr = fat_ptr(fatfs, addr * 2, 1))) {
+			*(uint16_t*)ptr = val;
+		}
 		break;
 
 	case FAT32:
 	case EXFAT:
-		res = ((uint32_t*)fatfs->fat)[addr];
+		/* the top 4 bits are reserved and must be preserved */
+		if((ptr32 = (uint32_t*)fat_ptr(fatfs, addr * 4, 1))) {
+			*ptr32 = (*ptr32 & 0xf0000000) | (val & 0x0fffffff);
+		}
 		break;
 
 	default:
 		break;
 	}
+}
+
+/* write all modified FAT sectors to disk */
+static int flush_fat(struct fatfs *fatfs)
+{
+	int i, res = 0;
+	uint32_t *fsinfo;
+
+	if(!fatfs->fat_dirty_any) {
+		return 0;
+	}
+
+	/* the first time we modify a FAT32 volume, invalidate the free cluster
+	 * count in the FSInfo sector, so that other systems will recalculate it.
+	 */
+	if(fatfs->fsinfo_sect) {
+		uint64_t sidx = fatfs->start_sect + fatfs->fsinfo_sect;
+		if(read_sectors(fatfs->dev, sidx, 1, sectbuf) != -1) {
+			fsinfo = (uint32_t*)sectbuf;
+			if(fsinfo[FSINFO_SIG1_OFFS / 4] == FSINFO_SIG1 && fsinfo[FSINFO_SIG2_OFFS / 4] == FSINFO_SIG2) {
+				fsinfo[FSINFO_FREE_OFFS / 4] = 0xffffffff;
+				write_sectors(fatfs->dev, sidx, 1, sectbuf);
+			}
+		}
+		fatfs->fsinfo_sect = 0;
+	}
+
+	for(i=0; i<fatfs->num_win; i++) {
+		if(fatfs->fatwin[i].dirty && write_fat_window(fatfs, fatfs->fatwin + i) == -1) {
+			res = -1;
+		}
+	}
 
+	fatfs->fat_dirty_any = 0;
 	return res;
 }
 
@@ -932,6 +2812,145 @@ static int32_t find_cluster(struct fatfs *fatfs, int count, int32_t clust)
 	return clust;
 }
 
+static void build_freemap(struct fatfs *fatfs)
+{
+	uint32_t i, nbits = fatfs->num_clusters + 2;
+	uint32_t nwords = (nbits + 31) / 32;
+
+	if(!(fatfs->freemap = malloc(nwords * sizeof *fatfs->freemap))) {
+		panic("FAT: failed to allocate free cluster map\n");
+	}
+	memset(fatfs->freemap, 0, nwords * sizeof *fatfs->freemap);
+
+	/* clusters 0 and 1 are reserved, and mark the padding at the end as used
+	 * so that we never have to check for it while searching.
+	 */
+	BM_SET(fatfs->freemap, 0);
+	BM_SET(fatfs->freemap, 1);
+	for(i=nbits; i<nwords * 32; i++) {
+		BM_SET(fatfs->freemap, i);
+	}
+
+	fatfs->num_free = 0;
+	for(i=2; i<nbits; i++) {
+		if(read_fat(fatfs, i)) {
+			BM_SET(fatfs->freemap, i);
+		} else {
+			fatfs->num_free++;
+		}
+	}
+}
+
+/* find the first run of at least count free clusters. If there isn't one,
+ * return the largest run available. The length of the run is returned in
+ * runlen (0 if there are no free clusters at all).
+ */
+static uint32_t find_free_run(struct fatfs *fatfs, uint32_t count, uint32_t *runlen)
+{
+	uint32_t i, start, len, best = 0, best_len = 0;
+	uint32_t nbits = fatfs->num_clusters + 2;
+
+	i = 2;
+	while(i < nbits) {
+		if((i & 0x1f) == 0 && fatfs->freemap[i >> 5] == 0xffffffff) {
+			i += 32;
+			continue;
+		}
+		if(BM_TEST(fatfs->freemap, i)) {
+			i++;
+			continue;
+		}
+
+		start = i;
+		while(i < nbits && !BM_TEST(fatfs->freemap, i) && i - start < count) {
+			i++;
+		}
+		len = i - start;
+		if(len >= count) {
+			*runlen = len;
+			return start;
+		}
+		if(len > best_len) {
+			best = start;
+			best_len = len;
+		}
+	}
+
+	*runlen = best_len;
+	return best;
+}
+
+/* allocate count clusters and link them to the end of the chain ending at last
+ * (or start a new chain if last is 0). Returns the first allocated cluster, and
+ * the new end of the chain in lastp.
+ */
+static int32_t alloc_clusters(struct fatfs *fatfs, int count, int32_t last, int32_t *lastp)
+{
+	uint32_t i, start, len;
+	uint32_t nbits = fatfs->num_clusters + 2;
+	int32_t first = 0;
+
+	if(!fatfs->freemap) {
+		build_freemap(fatfs);
+	}
+	if(count > fatfs->num_free) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	while(count > 0) {
+		/* prefer extending the chain in place, to keep the file contiguous */
+		if(last >= 2 && last + 1 < nbits && !BM_TEST(fatfs->freemap, last + 1)) {
+			start = last + 1;
+			len = 1;
+			while(len < count && start + len < nbits && !BM_TEST(fatfs->freemap, start + len)) {
+				len++;
+			}
+		} else {
+			start = find_free_run(fatfs, count, &len);
+			if(!len) {
+				errno = ENOSPC;
+				return -1;
+			}
+			if(len > count) len = count;
+		}
+
+		for(i=0; i<len; i++) {
+			BM_SET(fatfs->freemap, start + i);
+			write_fat(fatfs, start + i, i < len - 1 ? start + i + 1 : eoc_mark[fatfs->type]);
+		}
+		if(last >= 2) {
+			write_fat(fatfs, last, start);
+		}
+		if(!first) {
+			first = start;
+		}
+		last = start + len - 1;
+		count -= len;
+		fatfs->num_free -= len;
+	}
+
+	if(lastp) *lastp = last;
+	return first;
+}
+
+static void free_chain(struct fatfs *fatfs, int32_t clust)
+{
+	int32_t next;
+
+	if(!fatfs->freemap) {
+		build_freemap(fatfs);
+	}
+
+	while(clust >= 2) {
+		next = next_cluster(fatfs, clust);
+		write_fat(fatfs, clust, 0);
+		BM_CLR(fatfs->freemap, clust);
+		fatfs->num_free++;
+		clust = next;
+	}
+}
+
 /*
 static void dbg_printdir(struct fat_dirent *dir, int max_entries)
 {
@@ -963,3 +2982,55 @@ static void clean_trailws(char *s)
 	while(p >= s && isspace(*p)) p--;
 	p[1] = 0;
 }
+
+/* directory lookup benchmark, used by the fsbench test. Builds a directory
+ * with num_ent 8.3 entries in memory, and times looking up every one of them
+ * through the hash index, and with a linear search.
+ */
+void fsfat_lookup_bench(int num_ent)
+{
+	int i, found;
+	unsigned long t0, t_hash, t_lin;
+	char name[16];
+	struct fatfs fatfs;
+	struct fat_dir dir;
+
+	memset(&fatfs, 0, sizeof fatfs);
+	memset(&dir, 0, sizeof dir);
+	dir.fatfs = &fatfs;
+	dir.next_clust = -1;
+	dir.prev_ent = -1;
+	dir.max_nent = num_ent + 1;
+	if(!(dir.ent = calloc(dir.max_nent, sizeof *dir.ent))) {
+		printf("fsfat_lookup_bench: failed to allocate %d entries\n", num_ent);
+		return;
+	}
+	for(i=0; i<num_ent; i++) {
+		sprintf(name, "A%07dPNG", i);
+		memcpy(dir.ent[i].name, name, 11);
+		dir.ent[i].attr = ATTR_ARCHIVE;
+	}
+	parse_dir_entries(&dir);
+
+	found = 0;
+	t0 = get_ticks();
+	for(i=0; i<num_ent; i++) {
+		sprintf(name, "a%07d.png", i);
+		if(find_entry(&dir, name)) found++;
+	}
+	t_hash = get_ticks() - t0;
+
+	t0 = get_ticks();
+	for(i=0; i<num_ent; i++) {
+		sprintf(name, "a%07d.png", i);
+		if(find_entry_linear(&dir, name, 0)) found++;
+	}
+	t_lin = get_ticks() - t0;
+
+	printf("%d entries (%s): hashed %lu ms, linear %lu ms (found %d/%d)\n", num_ent,
+			dir.htab ? "indexed" : "not indexed", TICKS_TO_MSEC(t_hash),
+			TICKS_TO_MSEC(t_lin), found, num_ent * 2);
+
+	free_dir_entries(&dir);
+	free(dir.ent);
+}
@@ -18,14 +18,31 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include <errno.h>
 #include <alloca.h>
+#include "config.h"
 #include "fs.h"
+#include "dcache.h"
+#include "timer.h"
 #include "panic.h"
+#include "mem.h"
 
 #define MAX_NAME	120
 
+/* file data are stored in page-sized chunks, so that growing a file never
+ * needs to move the existing data. Each chunk is a physical page, allocated
+ * right after the previous one whenever possible, so that fs_map can usually
+ * return a pointer into the file data directly.
+ */
+#define CHUNK_SHIFT	12	/* must match the page size of alloc_ppage */
+#define CHUNK_SIZE	(1 << CHUNK_SHIFT)
+#define CHUNK_MASK	(CHUNK_SIZE - 1)
+
+/* directories with fewer entries than this are searched linearly */
+#define DIR_HASH_MIN	16
+
 struct memfs_node;
 struct memfs_file;
 struct memfs_dir;
@@ -37,6 +54,11 @@ struct memfs {
 struct memfs_dir {
 	struct memfs_node *clist, *ctail;
 	struct memfs_node *cur;
+
+	/* case-insensitive name hash index, chained through memfs_node.hnext */
+	struct memfs_node **htab;
+	unsigned int htab_mask;
+	int nchildren;
 };
 
 struct odir {
@@ -46,8 +68,10 @@ struct odir {
 };
 
 struct memfs_file {
-	char *data;
-	long size, max_size;
+	char **chunks;
+	int num_chunks, max_chunks;
+	long size;
+	int nmaps;		/* the file can't be modified or moved while it's mapped */
 };
 
 struct ofile {
@@ -64,6 +88,7 @@ struct memfs_node {
 	char name[MAX_NAME + 4];
 	struct memfs_node *parent;
 	struct memfs_node *next;
+	struct memfs_node *hnext;	/* next in the parent's hash bucket */
 	struct fs_node *fsnode;	/* we need it for crossing mounts in fs_open */
 };
 
@@ -81,14 +106,27 @@ static int rewinddir(struct fs_node *node);
 static struct fs_dirent *readdir(struct fs_node *node);
 static int rename(struct fs_node *node, const char *name);
 static int remove(struct fs_node *node);
+static void *map(struct fs_node *node, long offs, long len);
+static int unmap(struct fs_node *node, void *ptr);
 
 static struct fs_node *create_fsnode(struct filesys *fs, struct memfs_node *n);
 
 static struct memfs_node *alloc_node(int type);
 static void free_node(struct memfs_node *node);
 
+static int grow_file(struct memfs_file *file, long size);
+static void copy_to_file(struct memfs_file *file, long pos, const char *src, long len);
+static void copy_from_file(struct memfs_file *file, long pos, char *dest, long len);
+static int is_contig(struct memfs_file *file, int first, int last);
+static int make_contig(struct memfs_file *file);
+
+static struct memfs_node *lookup(struct filesys *fs, struct memfs_node *dir, const char *name);
 static struct memfs_node *find_entry(struct memfs_node *dir, const char *name);
 static void add_child(struct memfs_node *dir, struct memfs_node *n);
+static unsigned int name_hash(const char *name);
+static void build_dir_index(struct memfs_node *dnode);
+static void index_child(struct memfs_node *dnode, struct memfs_node *n);
+static void unindex_child(struct memfs_node *dnode, struct memfs_node *n);
 
 
 static struct fs_operations fs_mem_ops = {
@@ -101,7 +139,9 @@ static struct fs_operations fs_mem_ops = {
 
 	rewinddir, readdir,
 
-	rename, remove
+	rename, remove,
+
+	map, unmap
 };
 
 
@@ -135,7 +175,9 @@ struct filesys *fsmem_create(int dev, uint64_t start, uint64_t size)
 static void destroy(struct filesys *fs)
 {
 	struct memfs *memfs = fs->data;
+	dcache_purge_fs(fs);
 	free_node((struct memfs_node*)memfs->rootdir);
+	free(memfs->rootdir);
 	free(memfs);
 	free(fs);
 }
@@ -186,7 +228,7 @@ static struct fs_node *open(struct filesys *fs, const char *path, unsigned int f
 		path = fs_path_next((char*)path, name, sizeof name);
 		parent = node;
 
-		if(!(node = find_entry(node, name))) {
+		if(!(node = lookup(fs, node, name))) {
 			if(*path || !(flags & FSO_CREATE)) {
 				errno = ENOENT;
 				return 0;
@@ -198,6 +240,7 @@ static struct fs_node *open(struct filesys *fs, const char *path, unsigned int f
 			}
 			strcpy(node->name, name);
 			add_child(parent, node);
+			dcache_remove(fs, (intptr_t)parent, name);
 			return create_fsnode(fs, node);
 		}
 	}
@@ -333,7 +376,9 @@ static int read(struct fs_node *node, void *buf, int sz)
 	if(sz > of->file->size - of->cur_pos) {
 		sz = of->file->size - of->cur_pos;
 	}
-	memcpy(buf, of->file->data + of->cur_pos, sz);
+	if(sz <= 0) return 0;
+
+	copy_from_file(of->file, of->cur_pos, buf, sz);
 	of->cur_pos += sz;
 	return sz;
 }
@@ -341,32 +386,34 @@ static int read(struct fs_node *node, void *buf, int sz)
 static int write(struct fs_node *node, void *buf, int sz)
 {
 	struct ofile *of;
-	int total_sz, new_max_sz;
-	void *tmp;
+	struct memfs_file *file;
+	long end;
 
 	if(!node || !buf || sz < 0 || node->type != FSNODE_FILE) {
 		return -1;
 	}
 
 	of = node->data;
-	total_sz = of->cur_pos + sz;
-	if(total_sz > of->file->max_size) {
-		if(total_sz < of->file->max_size * 2) {
-			new_max_sz = of->file->max_size * 2;
-		} else {
-			new_max_sz = total_sz;
-		}
-		if(!(tmp = realloc(of->file->data, new_max_sz))) {
-			errno = ENOSPC;
-			return -1;
-		}
-		of->file->data = tmp;
-		of->file->max_size = new_max_sz;
+	file = of->file;
+
+	if(file->nmaps > 0) {
+		errno = EBUSY;
+		return -1;
 	}
 
-	memcpy(of->file->data + of->cur_pos, buf, sz);
-	of->cur_pos += sz;
-	if(of->cur_pos > of->file->size) of->file->size = of->cur_pos;
+	end = of->cur_pos + sz;
+	if(grow_file(file, end) == -1) {
+		errno = ENOSPC;
+		return -1;
+	}
+	/* zero-fill any gap left by seeking past the end of the file */
+	if(of->cur_pos > file->size) {
+		copy_to_file(file, file->size, 0, of->cur_pos - file->size);
+	}
+
+	copy_to_file(file, of->cur_pos, buf, sz);
+	of->cur_pos = end;
+	if(end > file->size) file->size = end;
 	return sz;
 }
 
@@ -404,7 +451,7 @@ static struct fs_dirent *readdir(struct fs_node *node)
 	fsd->name = n->name;
 	fsd->data = 0;
 	fsd->type = n->type;
-	fsd->fsize = n->file.size;
+	fsd->fsize = n->type == FSNODE_FILE ? n->file.size : 0;
 
 	return fsd;
 }
@@ -412,8 +459,18 @@ static struct fs_dirent *readdir(struct fs_node *node)
 static int rename(struct fs_node *node, const char *name)
 {
 	struct memfs_node *n = (struct memfs_node*)((struct odir*)node->data)->dir;
+
+	if(n->parent) {
+		dcache_remove(node->fs, (intptr_t)n->parent, n->name);
+		dcache_remove(node->fs, (intptr_t)n->parent, name);
+		unindex_child(n->parent, n);
+	}
 	strncpy(n->name, name, MAX_NAME);
 	n->name[MAX_NAME] = 0;
+
+	if(n->parent) {
+		index_child(n->parent, n);
+	}
 	return 0;
 }
 
@@ -429,12 +486,17 @@ static int remove(struct fs_node *node)
 		n = (struct memfs_node*)od->dir;
 
 		if(n->dir.clist) {
-			errno = EEXIST;
+			errno = ENOTEMPTY;
 			return -1;
 		}
 	} else {
 		of = node->data;
 		n = (struct memfs_node*)of->file;
+
+		if(n->file.nmaps > 0) {
+			errno = EBUSY;
+			return -1;
+		}
 	}
 	par = n->parent;
 
@@ -451,6 +513,12 @@ static int remove(struct fs_node *node)
 				par->dir.ctail = prev;
 			}
 			prev->next = n->next;
+			unindex_child(par, n);
+			par->dir.nchildren--;
+			dcache_remove(node->fs, (intptr_t)par, n->name);
+			if(n->type == FSNODE_DIR) {
+				dcache_purge_dir(node->fs, (intptr_t)n);
+			}
 			free_node(n);
 			res = 0;
 			break;
@@ -461,6 +529,65 @@ static int remove(struct fs_node *node)
 	return res;
 }
 
+/* memfs file data are already in memory, and mappings point straight into
+ * the chunks. Ranges spanning multiple chunks need them to be consecutive in
+ * memory, which is usually the case (see grow_file). Otherwise the first
+ * mapping moves the whole file to consecutive pages, once, since the data
+ * can't move again while they're mapped.
+ */
+static void *map(struct fs_node *node, long offs, long len)
+{
+	struct ofile *of;
+	struct memfs_file *file;
+	char *ptr;
+
+	if(!node || node->type != FSNODE_FILE) {
+		errno = EINVAL;
+		return 0;
+	}
+	of = node->data;
+	file = of->file;
+
+	if(len <= 0) {
+		len = file->size - offs;
+	}
+	if(offs < 0 || len <= 0 || offs + len > file->size) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if(!file->nmaps && !is_contig(file, 0, file->num_chunks - 1)) {
+		/* failing is only a problem for ranges spanning multiple chunks */
+		make_contig(file);
+	}
+	if(!is_contig(file, offs >> CHUNK_SHIFT, (offs + len - 1) >> CHUNK_SHIFT)) {
+		errno = ENOMEM;
+		return 0;
+	}
+	ptr = file->chunks[offs >> CHUNK_SHIFT] + (offs & CHUNK_MASK);
+
+	file->nmaps++;
+	return ptr;
+}
+
+static int unmap(struct fs_node *node, void *ptr)
+{
+	struct ofile *of;
+
+	if(!node || node->type != FSNODE_FILE) {
+		errno = EINVAL;
+		return -1;
+	}
+	of = node->data;
+
+	if(of->file->nmaps <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	of->file->nmaps--;
+	return 0;
+}
+
 static struct memfs_node *alloc_node(int type)
 {
 	struct memfs_node *node;
@@ -478,7 +605,10 @@ static void free_node(struct memfs_node *node)
 
 	switch(node->type) {
 	case FSNODE_FILE:
-		free(node->file.data);
+		while(node->file.num_chunks > 0) {
+			free_ppage(ADDR_TO_PAGE(node->file.chunks[--node->file.num_chunks]));
+		}
+		free(node->file.chunks);
 		break;
 
 	case FSNODE_DIR:
@@ -486,11 +616,143 @@ static void free_node(struct memfs_node *node)
 			struct memfs_node *n = node->dir.clist;
 			node->dir.clist = n->next;
 			free_node(n);
+			free(n);
 		}
+		free(node->dir.htab);
 		break;
 	}
 }
 
+/* make sure there are enough chunks allocated for size bytes of file data */
+static int grow_file(struct memfs_file *file, long size)
+{
+	int nchunks, newmax, pg;
+	void *tmp;
+
+	nchunks = (size + CHUNK_MASK) >> CHUNK_SHIFT;
+
+	if(nchunks > file->max_chunks) {
+		newmax = file->max_chunks ? file->max_chunks * 2 : 8;
+		while(newmax < nchunks) newmax *= 2;
+
+		if(!(tmp = realloc(file->chunks, newmax * sizeof *file->chunks))) {
+			return -1;
+		}
+		file->chunks = tmp;
+		file->max_chunks = newmax;
+	}
+
+	while(file->num_chunks < nchunks) {
+		pg = -1;
+		if(file->num_chunks > 0) {
+			/* try to continue right after the previous chunk */
+			pg = ADDR_TO_PAGE(file->chunks[file->num_chunks - 1]) + 1;
+			if(alloc_ppage_range(pg, 1) == -1) {
+				pg = -1;
+			}
+		}
+		if(pg == -1 && (pg = alloc_ppage(MEM_HEAP)) == -1) {
+			return -1;
+		}
+		file->chunks[file->num_chunks++] = PAGE_TO_PTR(pg);
+	}
+	return 0;
+}
+
+/* copy len bytes to the file at pos, or zeroes if src is null */
+static void copy_to_file(struct memfs_file *file, long pos, const char *src, long len)
+{
+	long offs, sz;
+	char *dest;
+
+	while(len > 0) {
+		offs = pos & CHUNK_MASK;
+		sz = CHUNK_SIZE - offs;
+		if(sz > len) sz = len;
+
+		dest = file->chunks[pos >> CHUNK_SHIFT] + offs;
+		if(src) {
+			memcpy(dest, src, sz);
+			src += sz;
+		} else {
+			memset(dest, 0, sz);
+		}
+		pos += sz;
+		len -= sz;
+	}
+}
+
+static void copy_from_file(struct memfs_file *file, long pos, char *dest, long len)
+{
+	long offs, sz;
+
+	while(len > 0) {
+		offs = pos & CHUNK_MASK;
+		sz = CHUNK_SIZE - offs;
+		if(sz > len) sz = len;
+
+		memcpy(dest, file->chunks[pos >> CHUNK_SHIFT] + offs, sz);
+		dest += sz;
+		pos += sz;
+		len -= sz;
+	}
+}
+
+/* returns 1 if chunks first to last are consecutive in memory */
+static int is_contig(struct memfs_file *file, int first, int last)
+{
+	int i;
+
+	for(i=first; i<last; i++) {
+		if(file->chunks[i + 1] != file->chunks[i] + CHUNK_SIZE) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* move the file data to consecutive pages */
+static int make_contig(struct memfs_file *file)
+{
+	int i, pg;
+	char *dest;
+
+	if((pg = alloc_ppages(file->num_chunks, MEM_HEAP)) == -1) {
+		return -1;
+	}
+	dest = PAGE_TO_PTR(pg);
+
+	for(i=0; i<file->num_chunks; i++) {
+		memcpy(dest, file->chunks[i], CHUNK_SIZE);
+		free_ppage(ADDR_TO_PAGE(file->chunks[i]));
+		file->chunks[i] = dest;
+		dest += CHUNK_SIZE;
+	}
+	return 0;
+}
+
+/* find_entry through the path lookup cache */
+static struct memfs_node *lookup(struct filesys *fs, struct memfs_node *dnode, const char *name)
+{
+	struct memfs_node *n;
+
+	switch(dcache_lookup(fs, (intptr_t)dnode, name, &n)) {
+	case DCACHE_HIT:
+		return n;
+	case DCACHE_NEGATIVE:
+		return 0;
+	default:
+		break;
+	}
+
+	if((n = find_entry(dnode, name))) {
+		dcache_add(fs, (intptr_t)dnode, name, &n, sizeof n);
+	} else {
+		dcache_add(fs, (intptr_t)dnode, name, 0, 0);
+	}
+	return n;
+}
+
 static struct memfs_node *find_entry(struct memfs_node *dnode, const char *name)
 {
 	struct memfs_node *n;
@@ -498,6 +760,17 @@ static struct memfs_node *find_entry(struct memfs_node *dnode, const char *name)
 	if(strcmp(name, ".") == 0) return dnode;
 	if(strcmp(name, "..") == 0) return dnode->parent;
 
+	if(dnode->dir.htab) {
+		n = dnode->dir.htab[name_hash(name) & dnode->dir.htab_mask];
+		while(n) {
+			if(strcasecmp(n->name, name) == 0) {
+				return n;
+			}
+			n = n->hnext;
+		}
+		return 0;
+	}
+
 	n = dnode->dir.clist;
 	while(n) {
 		if(strcasecmp(n->name, name) == 0) {
@@ -517,4 +790,175 @@ static void add_child(struct memfs_node *dnode, struct memfs_node *n)
 		dnode->dir.clist = dnode->dir.ctail = n;
 	}
 	n->parent = dnode;
+	dnode->dir.nchildren++;
+
+	index_child(dnode, n);
+}
+
+/* case-insensitive FNV-1a */
+static unsigned int name_hash(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while(*name) {
+		h = (h ^ (unsigned char)tolower(*name++)) * 16777619u;
+	}
+	return h;
+}
+
+static void build_dir_index(struct memfs_node *dnode)
+{
+	int size;
+	unsigned int bucket;
+	struct memfs_node *n;
+
+	/* keep the load factor between 0.25 and 0.5 */
+	size = DIR_HASH_MIN * 2;
+	while(size < dnode->dir.nchildren * 2) size <<= 1;
+
+	free(dnode->dir.htab);
+	if(!(dnode->dir.htab = calloc(size, sizeof *dnode->dir.htab))) {
+		panic("MEMFS: failed to allocate directory hash table\n");
+	}
+	dnode->dir.htab_mask = size - 1;
+
+	n = dnode->dir.clist;
+	while(n) {
+		bucket = name_hash(n->name) & dnode->dir.htab_mask;
+		n->hnext = dnode->dir.htab[bucket];
+		dnode->dir.htab[bucket] = n;
+		n = n->next;
+	}
+}
+
+/* add a child to the hash index, creating or growing the index as the
+ * directory grows.
+ */
+static void index_child(struct memfs_node *dnode, struct memfs_node *n)
+{
+	unsigned int bucket;
+
+	if(dnode->dir.nchildren < DIR_HASH_MIN) {
+		return;
+	}
+	if(!dnode->dir.htab || dnode->dir.nchildren * 2 > dnode->dir.htab_mask + 1) {
+		build_dir_index(dnode);
+		return;
+	}
+
+	bucket = name_hash(n->name) & dnode->dir.htab_mask;
+	n->hnext = dnode->dir.htab[bucket];
+	dnode->dir.htab[bucket] = n;
+}
+
+static void unindex_child(struct memfs_node *dnode, struct memfs_node *n)
+{
+	struct memfs_node **prev;
+
+	if(!dnode->dir.htab) return;
+
+	prev = dnode->dir.htab + (name_hash(n->name) & dnode->dir.htab_mask);
+	while(*prev) {
+		if(*prev == n) {
+			*prev = n->hnext;
+			break;
+		}
+		prev = &(*prev)->hnext;
+	}
+	n->hnext = 0;
+}
+
+/* memfs benchmarks, used by the fsbench test */
+
+/* times writing a file of size bytes in 4k appends, and reading it back */
+void fsmem_write_bench(long size)
+{
+	long count = 0;
+	unsigned long t0, t_wr, t_rd;
+	char *buf;
+	struct filesys *fs;
+	struct fs_node *node;
+
+	if(!(buf = malloc(CHUNK_SIZE))) {
+		printf("fsmem_write_bench: failed to allocate buffer\n");
+		return;
+	}
+	memset(buf, 0xaa, CHUNK_SIZE);
+
+	fs = fsmem_create(DEV_MEMDISK, 0, 0);
+	if(!(node = open(fs, "/bench", FSO_CREATE))) {
+		printf("fsmem_write_bench: failed to create file\n");
+		goto end;
+	}
+
+	t0 = get_ticks();
+	while(count < size) {
+		if(write(node, buf, CHUNK_SIZE) == -1) {
+			printf("fsmem_write_bench: write failed after %ld KB\n", count >> 10);
+			break;
+		}
+		count += CHUNK_SIZE;
+	}
+	t_wr = get_ticks() - t0;
+
+	seek(node, 0, FSSEEK_SET);
+	t0 = get_ticks();
+	while(read(node, buf, CHUNK_SIZE) > 0);
+	t_rd = get_ticks() - t0;
+
+	printf("%ld KB in 4k appends: write %lu ms, read %lu ms\n", count >> 10,
+			TICKS_TO_MSEC(t_wr), TICKS_TO_MSEC(t_rd));
+	close(node);
+end:
+	destroy(fs);
+	free(buf);
+}
+
+/* times looking up every entry of a directory with num_ent files, through the
+ * hash index and with a linear search.
+ */
+void fsmem_lookup_bench(int num_ent)
+{
+	int i, found = 0;
+	unsigned long t0, t_hash, t_lin;
+	char name[32];
+	struct filesys *fs;
+	struct memfs_node *dnode, *n;
+
+	fs = fsmem_create(DEV_MEMDISK, 0, 0);
+	dnode = ((struct memfs*)fs->data)->rootdir;
+
+	for(i=0; i<num_ent; i++) {
+		if(!(n = alloc_node(FSNODE_FILE))) {
+			panic("fsmem_lookup_bench: failed to allocate node\n");
+		}
+		sprintf(n->name, "file%07d.dat", i);
+		add_child(dnode, n);
+	}
+
+	t0 = get_ticks();
+	for(i=0; i<num_ent; i++) {
+		sprintf(name, "FILE%07d.DAT", i);
+		if(find_entry(dnode, name)) found++;
+	}
+	t_hash = get_ticks() - t0;
+
+	t0 = get_ticks();
+	for(i=0; i<num_ent; i++) {
+		sprintf(name, "FILE%07d.DAT", i);
+		n = dnode->dir.clist;
+		while(n) {
+			if(strcasecmp(n->name, name) == 0) {
+				found++;
+				break;
+			}
+			n = n->next;
+		}
+	}
+	t_lin = get_ticks() - t0;
+
+	printf("%d entries: hashed %lu ms, linear %lu ms (found %d/%d)\n", num_ent,
+			TICKS_TO_MSEC(t_hash), TICKS_TO_MSEC(t_lin), found, num_ent * 2);
+
+	destroy(fs);
 }
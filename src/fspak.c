@@ -0,0 +1,739 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+/* Read-only packed asset archive filesystem.
+ *
+ * Archives are created by tools/mkpak. All fields are little endian:
+ *  - header: "PAK0", number of files, offset of the index, archive size.
+ *  - index: one 20 byte pak_entry per file, sorted by name hash.
+ *  - names: nul-terminated file paths, relative to the archive root.
+ *  - file data: each file starts at a 4k boundary, and is contiguous.
+ *
+ * Files may be LZ4-compressed (mkpak -z), in which case their data start with
+ * a seek table of nblk + 1 offsets, followed by independent LZ4 blocks, each
+ * decompressing to PAK_BLOCK_SIZE bytes (except the last). Blocks which didn't
+ * compress are stored as-is, and have the same compressed and raw size. Reads
+ * decompress only the blocks they touch.
+ *
+ * The whole archive is kept in memory, either because it was linked into the
+ * kernel image (DEV_MEMPAK), or because it was read in one go from a block
+ * device at mount time. Opening a file is a binary search of the index, and
+ * reading an uncompressed file is a memcpy, or a pointer into the archive with
+ * fs_map.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "config.h"
+#include "fs.h"
+#include "lz4.h"
+#include "timer.h"
+#include "boot.h"
+#include "bootdev.h"
+#include "mem.h"
+#include "panic.h"
+
+#define PAK_MAGIC	"PAK0"
+#define PAK_BLOCK_SIZE	16384
+
+struct pak_header {
+	char magic[4];
+	uint32_t num_files;
+	uint32_t index_offs;
+	uint32_t size;
+} __attribute__((packed));
+
+struct pak_entry {
+	uint32_t hash;		/* case-insensitive FNV-1a of the name */
+	uint32_t name_offs;
+	uint32_t offs;		/* 4k aligned, from the start of the archive */
+	uint32_t size;
+	uint32_t csize;		/* compressed size, 0 for uncompressed files */
+} __attribute__((packed));
+
+/* decompressed copy of a compressed file, for fs_map. Shared by all mappings
+ * of the file, and kept until the last unmap, even if the file is closed.
+ */
+struct pak_mapping {
+	struct pak_entry *ent;
+	char *data;
+	int ref;
+	struct pak_mapping *next;
+};
+
+struct pakfs {
+	char *data;
+	struct pak_header *hdr;
+	struct pak_entry *index;
+	int num_pages;		/* pages allocated by us, if loaded from disk */
+	struct pak_mapping *maps;
+};
+
+struct pak_file {
+	struct pak_entry *ent;
+	char *data;
+	long cur_pos;
+
+	/* compressed files only */
+	uint32_t *blktab;
+	char *blkbuf;		/* last decompressed block, for partial block reads */
+	int cur_blk;
+};
+
+struct pak_dir {
+	int cur_ent;
+	struct fs_dirent dent;
+};
+
+static void destroy(struct filesys *fs);
+
+static struct fs_node *open(struct filesys *fs, const char *path, unsigned int flags);
+static void close(struct fs_node *node);
+static long fsize(struct fs_node *node);
+static int seek(struct fs_node *node, int offs, int whence);
+static long tell(struct fs_node *node);
+static int read(struct fs_node *node, void *buf, int sz);
+static int write(struct fs_node *node, void *buf, int sz);
+static int rewinddir(struct fs_node *node);
+static struct fs_dirent *readdir(struct fs_node *node);
+static int rename(struct fs_node *node, const char *name);
+static int remove(struct fs_node *node);
+static void *map(struct fs_node *node, long offs, long len);
+static int unmap(struct fs_node *node, void *ptr);
+
+static int valid_pak(char *data, long size);
+static char *load_pak(int dev, uint64_t start, int *num_pages);
+static struct pak_entry *find_entry(struct pakfs *pak, const char *name);
+static int read_block(struct pak_file *pf, int blk, char *dest);
+static int read_compressed(struct pak_file *pf, char *dest, long pos, long sz);
+static unsigned int name_hash(const char *name);
+
+static struct fs_operations fs_pak_ops = {
+	destroy,
+	open, close,
+
+	fsize,
+	seek, tell,
+	read, write,
+
+	rewinddir, readdir,
+
+	rename, remove,
+
+	map, unmap
+};
+
+
+/* dev is either DEV_MEMPAK, with start being the address of the archive in
+ * memory, or a block device with start being the first sector of the archive.
+ */
+struct filesys *fspak_create(int dev, uint64_t start, uint64_t size)
+{
+	struct filesys *fs;
+	struct pakfs *pak;
+	char *data;
+	int num_pages = 0;
+
+	if(dev == DEV_MEMPAK) {
+		data = (char*)(intptr_t)start;
+		if(!valid_pak(data, size ? (long)size : -1)) {
+			return 0;
+		}
+	} else {
+		if(dev >= 0 && dev != boot_drive_number) {
+			return 0;
+		}
+		if(!(data = load_pak(dev, start, &num_pages))) {
+			return 0;
+		}
+	}
+
+	if(!(pak = malloc(sizeof *pak))) {
+		panic("PAK: create failed to allocate memory\n");
+	}
+	pak->data = data;
+	pak->hdr = (struct pak_header*)data;
+	pak->index = (struct pak_entry*)(data + pak->hdr->index_offs);
+	pak->num_pages = num_pages;
+	pak->maps = 0;
+
+	if(!(fs = malloc(sizeof *fs))) {
+		panic("PAK: failed to allocate memory for the filesystem structure\n");
+	}
+	fs->type = FSTYPE_PAK;
+	fs->name = 0;
+	fs->fsop = &fs_pak_ops;
+	fs->data = pak;
+
+	printf("mounted asset archive: %u files, %u bytes\n", pak->hdr->num_files, pak->hdr->size);
+	return fs;
+}
+
+static void destroy(struct filesys *fs)
+{
+	struct pakfs *pak = fs->data;
+
+	while(pak->maps) {
+		struct pak_mapping *m = pak->maps;
+		pak->maps = m->next;
+		free(m->data);
+		free(m);
+	}
+
+	if(pak->num_pages) {
+		free_ppages(ADDR_TO_PAGE(pak->data), pak->num_pages);
+	}
+	free(pak);
+	free(fs);
+}
+
+static struct fs_node *open(struct filesys *fs, const char *path, unsigned int flags)
+{
+	struct pakfs *pak = fs->data;
+	struct pak_entry *ent;
+	struct fs_node *node;
+	struct pak_file *pf;
+	struct pak_dir *pd;
+
+	path = fs_path_skipsep((char*)path);
+
+	if(!*path || strcmp(path, ".") == 0) {
+		/* the archive has a flat namespace, the root is the only directory */
+		if(flags & FSO_EXCL) {
+			errno = EEXIST;
+			return 0;
+		}
+		if(!(pd = malloc(sizeof *pd))) {
+			errno = ENOMEM;
+			return 0;
+		}
+		pd->cur_ent = 0;
+		ent = 0;
+	} else {
+		if(!(ent = find_entry(pak, path))) {
+			errno = (flags & FSO_CREATE) ? EPERM : ENOENT;
+			return 0;
+		}
+		if(flags & FSO_EXCL) {
+			errno = EEXIST;
+			return 0;
+		}
+		if(flags & FSO_DIR) {
+			errno = ENOTDIR;
+			return 0;
+		}
+		if(!(pf = malloc(sizeof *pf))) {
+			errno = ENOMEM;
+			return 0;
+		}
+		memset(pf, 0, sizeof *pf);
+		pf->ent = ent;
+		pf->data = pak->data + ent->offs;
+		pf->cur_blk = -1;
+		if(ent->csize) {
+			pf->blktab = (uint32_t*)pf->data;
+		}
+	}
+
+	if(!(node = calloc(1, sizeof *node))) {
+		free(ent ? (void*)pf : (void*)pd);
+		errno = ENOMEM;
+		return 0;
+	}
+	node->fs = fs;
+	node->type = ent ? FSNODE_FILE : FSNODE_DIR;
+	node->data = ent ? (void*)pf : (void*)pd;
+	return node;
+}
+
+static void close(struct fs_node *node)
+{
+	struct pak_file *pf;
+
+	if(!node) return;
+
+	if(node->type == FSNODE_FILE) {
+		pf = node->data;
+		free(pf->blkbuf);
+	}
+	free(node->data);
+	free(node);
+}
+
+static long fsize(struct fs_node *node)
+{
+	struct pak_file *pf;
+
+	if(!node || node->type != FSNODE_FILE) {
+		return -1;
+	}
+	pf = node->data;
+	return pf->ent->size;
+}
+
+static int seek(struct fs_node *node, int offs, int whence)
+{
+	struct pak_file *pf;
+	long new_pos;
+
+	if(!node || node->type != FSNODE_FILE) {
+		return -1;
+	}
+	pf = node->data;
+
+	switch(whence) {
+	case FSSEEK_SET:
+		new_pos = offs;
+		break;
+
+	case FSSEEK_CUR:
+		new_pos = pf->cur_pos + offs;
+		break;
+
+	case FSSEEK_END:
+		new_pos = pf->ent->size + offs;
+		break;
+
+	default:
+		return -1;
+	}
+
+	if(new_pos < 0) new_pos = 0;
+
+	pf->cur_pos = new_pos;
+	return 0;
+}
+
+static long tell(struct fs_node *node)
+{
+	struct pak_file *pf;
+
+	if(!node || node->type != FSNODE_FILE) {
+		return -1;
+	}
+	pf = node->data;
+	return pf->cur_pos;
+}
+
+static int read(struct fs_node *node, void *buf, int sz)
+{
+	struct pak_file *pf;
+
+	if(!node || !buf || sz < 0 || node->type != FSNODE_FILE) {
+		return -1;
+	}
+	pf = node->data;
+
+	if(sz > (long)pf->ent->size - pf->cur_pos) {
+		sz = (long)pf->ent->size - pf->cur_pos;
+	}
+	if(sz <= 0) return 0;
+
+	if(pf->ent->csize) {
+		if(read_compressed(pf, buf, pf->cur_pos, sz) == -1) {
+			errno = EIO;
+			return -1;
+		}
+	} else {
+		memcpy(buf, pf->data + pf->cur_pos, sz);
+	}
+	pf->cur_pos += sz;
+	return sz;
+}
+
+static int write(struct fs_node *node, void *buf, int sz)
+{
+	errno = EPERM;
+	return -1;
+}
+
+static int rewinddir(struct fs_node *node)
+{
+	struct pak_dir *pd;
+
+	if(!node || node->type != FSNODE_DIR) {
+		return -1;
+	}
+	pd = node->data;
+	pd->cur_ent = 0;
+	return 0;
+}
+
+static struct fs_dirent *readdir(struct fs_node *node)
+{
+	struct pakfs *pak;
+	struct pak_dir *pd;
+	struct pak_entry *ent;
+
+	if(!node || node->type != FSNODE_DIR) {
+		return 0;
+	}
+	pak = node->fs->data;
+	pd = node->data;
+
+	if(pd->cur_ent >= pak->hdr->num_files) {
+		return 0;
+	}
+	ent = pak->index + pd->cur_ent++;
+
+	pd->dent.name = pak->data + ent->name_offs;
+	pd->dent.data = ent;
+	pd->dent.type = FSNODE_FILE;
+	pd->dent.fsize = ent->size;
+	return &pd->dent;
+}
+
+static int rename(struct fs_node *node, const char *name)
+{
+	errno = EPERM;
+	return -1;
+}
+
+static int remove(struct fs_node *node)
+{
+	errno = EPERM;
+	return -1;
+}
+
+/* the archive is in memory and never changes, so mapping uncompressed files is
+ * free. Compressed files are decompressed when first mapped, into a buffer
+ * shared by all their mappings, which outlives close like FAT mappings do.
+ */
+static void *map(struct fs_node *node, long offs, long len)
+{
+	struct pakfs *pak;
+	struct pak_file *pf;
+	struct pak_mapping *m;
+
+	if(!node || node->type != FSNODE_FILE) {
+		errno = EINVAL;
+		return 0;
+	}
+	pak = node->fs->data;
+	pf = node->data;
+
+	if(len <= 0) {
+		len = pf->ent->size - offs;
+	}
+	if(offs < 0 || len <= 0 || offs + len > pf->ent->size) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if(!pf->ent->csize) {
+		return pf->data + offs;
+	}
+
+	m = pak->maps;
+	while(m && m->ent != pf->ent) {
+		m = m->next;
+	}
+	if(!m) {
+		if(!(m = malloc(sizeof *m))) {
+			panic("PAK: failed to allocate mapping structure\n");
+		}
+		if(!(m->data = malloc(pf->ent->size))) {
+			free(m);
+			errno = ENOMEM;
+			return 0;
+		}
+		if(read_compressed(pf, m->data, 0, pf->ent->size) == -1) {
+			free(m->data);
+			free(m);
+			errno = EIO;
+			return 0;
+		}
+		m->ent = pf->ent;
+		m->ref = 0;
+		m->next = pak->maps;
+		pak->maps = m;
+	}
+	m->ref++;
+	return m->data + offs;
+}
+
+static int unmap(struct fs_node *node, void *ptr)
+{
+	struct pakfs *pak;
+	struct pak_mapping dummy, *prev, *m;
+
+	if(!node || node->type != FSNODE_FILE) {
+		errno = EINVAL;
+		return -1;
+	}
+	pak = node->fs->data;
+
+	dummy.next = pak->maps;
+	prev = &dummy;
+	while(prev->next) {
+		m = prev->next;
+		if((char*)ptr >= m->data && (char*)ptr < m->data + m->ent->size) {
+			if(--m->ref <= 0) {
+				prev->next = m->next;
+				free(m->data);
+				free(m);
+			}
+			pak->maps = dummy.next;
+			return 0;
+		}
+		prev = m;
+	}
+
+	/* uncompressed files are mapped straight from the archive */
+	if((char*)ptr >= pak->data && (char*)ptr < pak->data + pak->hdr->size) {
+		return 0;
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+/* decompress block blk of a compressed file straight from the archive */
+static int read_block(struct pak_file *pf, int blk, char *dest)
+{
+	long blksz, csz;
+	char *src;
+
+	blksz = pf->ent->size - blk * PAK_BLOCK_SIZE;
+	if(blksz > PAK_BLOCK_SIZE) blksz = PAK_BLOCK_SIZE;
+
+	src = pf->data + pf->blktab[blk];
+	csz = pf->blktab[blk + 1] - pf->blktab[blk];
+
+	if(csz == blksz) {
+		memcpy(dest, src, blksz);
+		return 0;
+	}
+	return lz4_decompress(src, csz, dest, blksz) == blksz ? 0 : -1;
+}
+
+/* whole blocks are decompressed directly into dest. Partial blocks go through
+ * the file's block buffer, which is kept around for the next sequential read.
+ */
+static int read_compressed(struct pak_file *pf, char *dest, long pos, long sz)
+{
+	int blk;
+	long offs, blksz, len;
+
+	while(sz > 0) {
+		blk = pos / PAK_BLOCK_SIZE;
+		offs = pos % PAK_BLOCK_SIZE;
+		blksz = pf->ent->size - blk * PAK_BLOCK_SIZE;
+		if(blksz > PAK_BLOCK_SIZE) blksz = PAK_BLOCK_SIZE;
+
+		len = blksz - offs;
+		if(len > sz) len = sz;
+
+		if(len == blksz) {
+			if(read_block(pf, blk, dest) == -1) {
+				return -1;
+			}
+		} else {
+			if(blk != pf->cur_blk) {
+				if(!pf->blkbuf && !(pf->blkbuf = malloc(PAK_BLOCK_SIZE))) {
+					return -1;
+				}
+				if(read_block(pf, blk, pf->blkbuf) == -1) {
+					pf->cur_blk = -1;
+					return -1;
+				}
+				pf->cur_blk = blk;
+			}
+			memcpy(dest, pf->blkbuf + offs, len);
+		}
+
+		dest += len;
+		pos += len;
+		sz -= len;
+	}
+	return 0;
+}
+
+/* check the header and the index of an archive. If size is negative, trust
+ * the size in the header.
+ */
+static int valid_pak(char *data, long size)
+{
+	int i;
+	struct pak_header *hdr = (struct pak_header*)data;
+	struct pak_entry *ent;
+
+	if(memcmp(hdr->magic, PAK_MAGIC, 4) != 0) {
+		return 0;
+	}
+	if(size < 0) size = hdr->size;
+	if(hdr->size > size || hdr->index_offs < sizeof *hdr || hdr->index_offs > size ||
+			hdr->num_files > (size - hdr->index_offs) / sizeof *ent) {
+		printf("PAK: invalid archive header\n");
+		return 0;
+	}
+
+	ent = (struct pak_entry*)(data + hdr->index_offs);
+	for(i=0; i<hdr->num_files; i++) {
+		uint32_t stored = ent[i].csize ? ent[i].csize : ent[i].size;
+		if(ent[i].name_offs >= size || ent[i].offs > size ||
+				stored > size - ent[i].offs) {
+			printf("PAK: invalid index entry %d\n", i);
+			return 0;
+		}
+		if(ent[i].csize) {
+			uint32_t nblk = (ent[i].size + PAK_BLOCK_SIZE - 1) / PAK_BLOCK_SIZE;
+			uint32_t *blktab = (uint32_t*)(data + ent[i].offs);
+			if((nblk + 1) * 4 > stored || blktab[nblk] > stored) {
+				printf("PAK: invalid seek table in entry %d\n", i);
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+/* read the whole archive from a block device into newly allocated pages */
+static char *load_pak(int dev, uint64_t start, int *num_pages)
+{
+	int pg, npages, nsect, count, max_sect;
+	char *data, *ptr;
+	struct pak_header *hdr;
+
+	pg = alloc_ppages(1, MEM_HEAP);
+	if(pg == -1) return 0;
+	data = PAGE_TO_PTR(pg);
+
+	if(bdev_read_range(start, 1, data) == -1 || memcmp(data, PAK_MAGIC, 4) != 0) {
+		free_ppages(pg, 1);
+		return 0;
+	}
+	hdr = (struct pak_header*)data;
+	npages = BYTES_TO_PAGES(hdr->size);
+	nsect = (hdr->size + 511) / 512;
+	free_ppages(pg, 1);
+
+	if((pg = alloc_ppages(npages, MEM_HEAP)) == -1) {
+		printf("PAK: failed to allocate %d pages for the archive\n", npages);
+		return 0;
+	}
+	data = PAGE_TO_PTR(pg);
+
+	/* reads go through the low memory buffer, don't overflow it */
+	max_sect = ((unsigned char*)0xa0000 - low_mem_buffer) / 512;
+	if(max_sect > 127) max_sect = 127;
+
+	ptr = data;
+	while(nsect > 0) {
+		count = nsect > max_sect ? max_sect : nsect;
+		if(bdev_read_range(start, count, ptr) == -1) {
+			printf("PAK: failed to read archive\n");
+			free_ppages(pg, npages);
+			return 0;
+		}
+		start += count;
+		ptr += count * 512;
+		nsect -= count;
+	}
+
+	if(!valid_pak(data, npages * 4096)) {
+		free_ppages(pg, npages);
+		return 0;
+	}
+	*num_pages = npages;
+	return data;
+}
+
+/* binary search in the index, which is sorted by name hash */
+static struct pak_entry *find_entry(struct pakfs *pak, const char *name)
+{
+	int lo, hi, mid;
+	unsigned int hash = name_hash(name);
+	struct pak_entry *ent;
+
+	lo = 0;
+	hi = pak->hdr->num_files;
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		if(pak->index[mid].hash < hash) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	/* collisions are adjacent in the index */
+	ent = pak->index + lo;
+	while(lo++ < pak->hdr->num_files && ent->hash == hash) {
+		if(strcasecmp(pak->data + ent->name_offs, name) == 0) {
+			return ent;
+		}
+		ent++;
+	}
+	return 0;
+}
+
+/* case-insensitive FNV-1a, must match the one in tools/mkpak */
+static unsigned int name_hash(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while(*name) {
+		h = (h ^ (unsigned char)tolower(*name++)) * 16777619u;
+	}
+	return h;
+}
+
+/* archive read benchmark, used by the fsbench test. Reads every file in the
+ * archive linked into the kernel image, in 4k reads.
+ */
+void fspak_read_bench(void)
+{
+	int i;
+	long raw_total = 0, stored_total = 0;
+	unsigned long t0, dt;
+	char *buf;
+	struct filesys *fs;
+	struct pakfs *pak;
+	struct pak_entry *ent;
+	struct fs_node *node;
+
+	if(!(fs = fspak_create(DEV_MEMPAK, (intptr_t)pak_start, pak_end - pak_start))) {
+		printf("fspak_read_bench: no valid archive linked into the kernel\n");
+		return;
+	}
+	pak = fs->data;
+	if(!(buf = malloc(4096))) {
+		panic("fspak_read_bench: failed to allocate buffer\n");
+	}
+
+	t0 = get_ticks();
+	for(i=0; i<pak->hdr->num_files; i++) {
+		ent = pak->index + i;
+		if(!(node = open(fs, pak->data + ent->name_offs, 0))) {
+			continue;
+		}
+		while(read(node, buf, 4096) > 0);
+		close(node);
+
+		raw_total += ent->size;
+		stored_total += ent->csize ? ent->csize : ent->size;
+	}
+	dt = get_ticks() - t0;
+
+	printf("%u files, %ld KB stored as %ld KB: read in %lu ms\n", pak->hdr->num_files,
+			raw_total >> 10, stored_total >> 10, TICKS_TO_MSEC(dt));
+
+	free(buf);
+	destroy(fs);
+}
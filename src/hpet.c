@@ -0,0 +1,197 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <inttypes.h>
+#include "hpet.h"
+#include "acpi.h"
+#include "apic.h"
+#include "intr.h"
+#include "timer.h"
+#include "asmops.h"
+#include "cpuid.h"
+
+/* registers, as 32bit word offsets */
+#define REG_CAP			0
+#define REG_PERIOD		(0x4 / 4)
+#define REG_CFG			(0x10 / 4)
+#define REG_INTSTAT		(0x20 / 4)
+#define REG_COUNT_LOW	(0xf0 / 4)
+#define REG_COUNT_HIGH	(0xf4 / 4)
+#define REG_TIMER_CFG(x)	((0x100 + (x) * 0x20) / 4)
+#define REG_TIMER_CMP(x)	((0x108 + (x) * 0x20) / 4)
+
+#define CAP_NUM_TIMERS(x)	((((x) >> 8) & 0x1f) + 1)
+#define CAP_COUNT_64		0x2000
+#define CAP_LEG_ROUTE		0x8000
+
+#define CFG_ENABLE		1
+#define CFG_LEG_ROUTE	2	/* timer 0 replaces the PIT on IRQ 0, timer 1 the RTC */
+
+#define TCFG_LEVEL		0x0002
+#define TCFG_INT_EN		0x0004
+#define TCFG_PERIODIC	0x0008
+#define TCFG_PER_CAP	0x0010
+#define TCFG_VAL_SET	0x0040
+#define TCFG_32BIT		0x0100
+
+/* the counter period is in femtoseconds, and at most 100ns */
+#define MAX_PERIOD		100000000
+
+/* don't program comparators closer than this to the current count */
+#define MIN_DELTA		16
+
+/* ACPI HPET description table */
+struct hpet_table {
+	struct acpi_sdt_hdr hdr;
+	uint32_t evtimer_id;
+	struct acpi_gas base;
+	uint8_t hpet_num;
+	uint16_t min_tick;
+	uint8_t prot;
+} __attribute__((packed));
+
+static void hpet_oneshot(uint64_t delta);
+static void hpet_periodic(unsigned long hz);
+static void hpet_stop(void);
+
+static volatile uint32_t *hpet;
+static uint32_t ns_mult;
+
+static struct timer_clock hpet_clock = {"HPET", hpet_read};
+static struct timer_evsrc hpet_evsrc = {"HPET", hpet_oneshot, hpet_periodic, hpet_stop};
+
+
+int init_hpet(void)
+{
+	struct hpet_table *tab;
+	uint32_t cap, period, tcfg;
+	int iflag;
+
+	if(!(tab = acpi_find_table("HPET", 0)) || tab->base.space != 0) {
+		return -1;
+	}
+	hpet = (volatile uint32_t*)(uint32_t)tab->base.addr;
+
+	cap = hpet[REG_CAP];
+	period = hpet[REG_PERIOD];
+	if(!period || period > MAX_PERIOD) {
+		printf("HPET: invalid counter period: %lu fs\n", (unsigned long)period);
+		hpet = 0;
+		return -1;
+	}
+	hpet_hz = udiv64(1000000000000000ull, period);
+	ns_mult = udiv64((uint64_t)hpet_hz << 32, 1000000000);
+
+	printf("HPET at %p: %d timers, %d bit counter, %lu.%03lu MHz\n", (void*)hpet,
+			CAP_NUM_TIMERS(cap), cap & CAP_COUNT_64 ? 64 : 32, hpet_hz / 1000000,
+			hpet_hz / 1000 % 1000);
+
+	/* halt the counter and disable all timer 0 interrupts, before starting
+	 * it from 0
+	 */
+	hpet[REG_CFG] &= ~(CFG_ENABLE | CFG_LEG_ROUTE);
+	tcfg = hpet[REG_TIMER_CFG(0)];
+	hpet[REG_TIMER_CFG(0)] = tcfg & ~(TCFG_INT_EN | TCFG_PERIODIC | TCFG_LEVEL);
+	hpet[REG_COUNT_LOW] = 0;
+	hpet[REG_COUNT_HIGH] = 0;
+	hpet[REG_CFG] |= CFG_ENABLE;
+
+	/* a 32bit counter wraps every few minutes, it's only good for
+	 * interrupts. A TSC running at a constant rate is as good and much
+	 * cheaper to read.
+	 */
+	if((cap & CAP_COUNT_64) && !(CPU_HAS(TSC) && (cpu_info.feat_pm & CPUID_FEAT_INVTSC))) {
+		hpet_clock.hz = hpet_hz;
+		set_timer_clock(&hpet_clock);
+	}
+
+	/* timer 0 in legacy replacement mode takes over IRQ 0 from the PIT, and
+	 * the timer IRQ handler calls timer_event. The local APIC timer is
+	 * preferred if we have it, since it's cheaper to program. Legacy routing
+	 * goes to I/O APIC input 2, so IRQ 0 has to be there.
+	 */
+	if(lapic_timer_hz || !(cap & CAP_LEG_ROUTE) || !(tcfg & TCFG_PER_CAP)) {
+		return 0;
+	}
+	if(apic_mode && apic_config.isa_irq[0].gsi != 2) {
+		return 0;
+	}
+
+	iflag = get_intr_flag();
+	disable_intr();
+
+	hpet[REG_TIMER_CFG(0)] = (tcfg & ~(TCFG_INT_EN | TCFG_PERIODIC | TCFG_LEVEL)) | TCFG_32BIT;
+	hpet[REG_CFG] |= CFG_LEG_ROUTE;
+	if(set_timer_evsrc(&hpet_evsrc) == -1) {
+		hpet[REG_CFG] &= ~CFG_LEG_ROUTE;
+	} else {
+		hpet_legacy = 1;
+		/* the PIT event source masked it when it stopped */
+		unmask_irq(0);
+	}
+
+	set_intr_flag(iflag);
+	return 0;
+}
+
+uint64_t hpet_read(void)
+{
+	uint32_t hi, lo;
+
+	do {
+		hi = hpet[REG_COUNT_HIGH];
+		lo = hpet[REG_COUNT_LOW];
+	} while(hpet[REG_COUNT_HIGH] != hi);
+
+	return ((uint64_t)hi << 32) | lo;
+}
+
+/* timer 0 is in 32bit mode, and matches against the low half of the counter.
+ * If the deadline passes while we're setting it, it would only fire after the
+ * counter wraps around, so check and try again further ahead.
+ */
+static void hpet_oneshot(uint64_t delta)
+{
+	uint64_t ticks = mul_shr(delta, ns_mult, 32);
+	uint32_t cmp;
+
+	if(ticks < MIN_DELTA) ticks = MIN_DELTA;
+	if(ticks > 0x7fffffff) ticks = 0x7fffffff;
+
+	hpet[REG_TIMER_CFG(0)] = (hpet[REG_TIMER_CFG(0)] & ~TCFG_PERIODIC) | TCFG_INT_EN;
+	do {
+		cmp = hpet[REG_COUNT_LOW] + ticks;
+		hpet[REG_TIMER_CMP(0)] = cmp;
+		ticks *= 2;
+	} while((int32_t)(cmp - hpet[REG_COUNT_LOW]) <= 0);
+}
+
+static void hpet_periodic(unsigned long hz)
+{
+	uint32_t period = (hpet_hz + hz / 2) / hz;
+
+	hpet[REG_TIMER_CFG(0)] |= TCFG_INT_EN | TCFG_PERIODIC | TCFG_VAL_SET;
+	hpet[REG_TIMER_CMP(0)] = hpet[REG_COUNT_LOW] + period;
+	/* with VAL_SET, the second write sets the period */
+	hpet[REG_TIMER_CMP(0)] = period;
+}
+
+static void hpet_stop(void)
+{
+	hpet[REG_TIMER_CFG(0)] &= ~(TCFG_INT_EN | TCFG_PERIODIC);
+}
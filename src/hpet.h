@@ -0,0 +1,39 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef HPET_H_
+#define HPET_H_
+
+#include <inttypes.h>
+
+/* frequency of the HPET main counter, 0 if there's no HPET */
+unsigned long hpet_hz;
+/* nonzero if timer 0 is in legacy replacement mode, which takes over IRQ 8
+ * from the RTC as well as IRQ 0 from the PIT
+ */
+int hpet_legacy;
+
+/* find the HPET through the ACPI HPET table and start its main counter. It
+ * becomes the clock source if the TSC isn't invariant, and its first
+ * comparator the timer interrupt source if the local APIC timer isn't in use.
+ * Returns -1 if there's no usable HPET.
+ */
+int init_hpet(void);
+
+uint64_t hpet_read(void);
+
+#endif	/* HPET_H_ */
@@ -16,15 +16,24 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #include <stdio.h>
+#include <string.h>
 #include "config.h"
 #include "intr.h"
 #include "desc.h"
 #include "segm.h"
 #include "asmops.h"
 #include "panic.h"
+#include "smp.h"
+#include "workq.h"
+#include "timer.h"
+#include "boot.h"
+#include "trace.h"
 
 #define SYSCALL_INT		0x80
 
+/* interrupt enable flag in eflags */
+#define FLAG_IF			0x200
+
 /* IDT gate descriptor bits */
 #define GATE_TASK		(5 << 8)
 #define GATE_INTR		(6 << 8)
@@ -57,6 +66,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 void init_pic(void);
 static void gate_desc(desc_t *desc, uint16_t sel, uint32_t addr, int dpl, int type);
+static void pic_mask_irq(int irq);
+static void pic_unmask_irq(int irq);
+static void update_stats(int inum, uint64_t start);
+static void intr_name(int inum, char *buf);
 
 /* defined in intr_asm.S */
 void set_idt(uint32_t addr, uint16_t limit);
@@ -70,8 +83,16 @@ static desc_t idt[256] __attribute__((aligned(8)));
 /* table of handler functions for all interrupts */
 static intr_func_t intr_func[256];
 
-static struct intr_frame *cur_intr_frame;
-static int eoi_pending;
+/* per-processor interrupt state */
+static struct intr_frame *cur_intr_frame[MAX_CPUS];
+static int eoi_pending[MAX_CPUS];
+static int intr_depth[MAX_CPUS];
+
+static struct intr_stats stats[256];
+static char intr_names[256][12];
+
+static struct irq_controller pic_irqctl = {"8259 PIC", pic_eoi, pic_mask_irq, pic_unmask_irq};
+static struct irq_controller *irqctl = &pic_irqctl;
 
 
 void init_intr(void)
@@ -84,6 +105,7 @@ void init_intr(void)
 	for(i=0; i<256; i++) {
 		set_intr_entry(i, intr_entry_default);
 		interrupt(i, 0);
+		intr_name(i, intr_names[i]);
 	}
 
 	/* by including intrtab.h here (without ASM being defined)
@@ -103,7 +125,13 @@ void init_intr(void)
 	 * setting up the maping of IRQs [0, 15] to interrupts [32, 47]
 	 */
 	init_pic();
-	eoi_pending = 0;
+	eoi_pending[0] = 0;
+}
+
+/* load the IDT on an application processor */
+void init_cpu_intr(void)
+{
+	set_idt((uint32_t)idt, sizeof idt - 1);
 }
 
 /* retrieve the current interrupt frame.
@@ -111,7 +139,12 @@ void init_intr(void)
  */
 struct intr_frame *get_intr_frame(void)
 {
-	return cur_intr_frame;
+	return cur_intr_frame[cpu_index()];
+}
+
+int in_intr(void)
+{
+	return intr_depth[cpu_index()];
 }
 
 /* set an interrupt handler function for a particular interrupt */
@@ -125,14 +158,25 @@ void interrupt(int intr_num, intr_func_t func)
 
 /* this function is called from all interrupt entry points
  * it calls the appropriate interrupt handlers if available and handles
- * sending an end-of-interrupt command to the PICs when finished.
+ * sending an end-of-interrupt command to the PICs when finished. After the
+ * outermost interrupt, it runs any deferred work (see workq.h) with
+ * interrupts enabled, unless we interrupted code running with interrupts
+ * disabled (exceptions and software interrupts).
  */
 void dispatch_intr(struct intr_frame frm)
 {
-	cur_intr_frame = &frm;
+	int cpu = cpu_index();
+#ifdef INTR_STATS
+	uint64_t start = boot_have_tsc ? rdtsc() : 0;
+#endif
+
+	trace_begin(intr_names[frm.inum]);
+
+	cur_intr_frame[cpu] = &frm;
+	intr_depth[cpu]++;
 
 	if(IS_IRQ(frm.inum)) {
-		eoi_pending = frm.inum;
+		eoi_pending[cpu] = frm.inum;
 	}
 
 	if(intr_func[frm.inum]) {
@@ -145,9 +189,129 @@ void dispatch_intr(struct intr_frame frm)
 	}
 
 	disable_intr();
-	if(eoi_pending) {
-		end_of_irq(INTR_TO_IRQ(eoi_pending));
+	trace_end();
+#ifdef INTR_STATS
+	update_stats(frm.inum, start);
+#endif
+	if(eoi_pending[cpu]) {
+		end_of_irq(INTR_TO_IRQ(eoi_pending[cpu]));
+	}
+
+	if(--intr_depth[cpu] == 0 && (frm.eflags & FLAG_IF) && work_pending()) {
+		run_deferred();
+		disable_intr();
+	}
+}
+
+static void update_stats(int inum, uint64_t start)
+{
+	int bin;
+	uint32_t dt32;
+	uint64_t dt;
+	struct intr_stats *st = stats + inum;
+
+	st->count++;
+	if(!boot_have_tsc) return;
+
+	dt = rdtsc() - start;
+	st->total += dt;
+	if(dt > st->max) {
+		st->max = dt;
+	}
+
+	/* the histogram bin is the index of the most significant bit */
+	if(dt >> 32) {
+		bin = INTR_HIST_BINS - 1;
+	} else if((dt32 = (uint32_t)dt)) {
+		asm("bsrl %1, %0" : "=r" (bin) : "rm" (dt32));
+	} else {
+		bin = 0;
+	}
+	st->hist[bin]++;
+}
+
+int get_intr_stats(int intr_num, struct intr_stats *st)
+{
+	int iflag;
+
+	if(intr_num < 0 || intr_num > 255) {
+		return -1;
+	}
+
+	iflag = get_intr_flag();
+	disable_intr();
+	*st = stats[intr_num];
+	set_intr_flag(iflag);
+	return 0;
+}
+
+void reset_intr_stats(void)
+{
+	int iflag = get_intr_flag();
+	disable_intr();
+	memset(stats, 0, sizeof stats);
+	num_spurious_irq7 = num_spurious_irq15 = 0;
+	set_intr_flag(iflag);
+}
+
+void print_intr_stats(void)
+{
+	int i, j;
+	unsigned long avg_ns, max_ns;
+	struct intr_stats st;
+
+#ifndef INTR_STATS
+	printf("interrupt statistics disabled (see INTR_STATS in config.h)\n");
+	return;
+#endif
+
+	printf("interrupt statistics (vector: count, handler time histogram as log2 cycles:count)\n");
+	for(i=0; i<256; i++) {
+		get_intr_stats(i, &st);
+		if(!st.count) continue;
+
+		printf(" %3d %s: %lu", i, intr_names[i], st.count);
+		if(!boot_have_tsc) {
+			putchar('\n');
+			continue;
+		}
+		avg_ns = cycles_to_ns(udiv64(st.total, st.count));
+		max_ns = cycles_to_ns(st.max);
+		printf(", avg %lu ns, max %lu ns\n     ", avg_ns, max_ns);
+		for(j=0; j<INTR_HIST_BINS; j++) {
+			if(st.hist[j]) {
+				printf(" %d:%lu", j, st.hist[j]);
+			}
+		}
+		putchar('\n');
 	}
+	printf(" spurious irq 7: %lu, irq 15: %lu\n", num_spurious_irq7, num_spurious_irq15);
+}
+
+/* name used for statistics and traces */
+static void intr_name(int inum, char *buf)
+{
+	if(inum < 32) {
+		sprintf(buf, "exc %d", inum);
+	} else if(IS_IRQ(inum)) {
+		sprintf(buf, "irq %d", INTR_TO_IRQ(inum));
+	} else if(IS_MSI(inum)) {
+		sprintf(buf, "msi %d", inum - MSI_INTR_BASE);
+	} else if(IS_APIC_INTR(inum)) {
+		sprintf(buf, "apic %d", inum - APIC_INTR_BASE);
+	} else {
+		sprintf(buf, "intr %d", inum);
+	}
+}
+
+void set_irq_controller(struct irq_controller *ic)
+{
+	irqctl = ic ? ic : &pic_irqctl;
+}
+
+struct irq_controller *get_irq_controller(void)
+{
+	return irqctl;
 }
 
 void init_pic(void)
@@ -188,7 +352,7 @@ static void gate_desc(desc_t *desc, uint16_t sel, uint32_t addr, int dpl, int ty
 	desc->d[3] = (addr & 0xffff0000) >> 16;
 }
 
-#define IS_TRAP(n)	((n) >= 32 && !IS_IRQ(n))
+#define IS_TRAP(n)	((n) >= 32 && !IS_IRQ(n) && !IS_MSI(n) && !IS_APIC_INTR(n) && (n) != 255)
 void set_intr_entry(int num, void (*handler)(void))
 {
 	int type = IS_TRAP(num) ? GATE_TRAP : GATE_INTR;
@@ -214,6 +378,16 @@ unsigned char get_pic_mask(int pic)
 }
 
 void mask_irq(int irq)
+{
+	irqctl->mask(irq);
+}
+
+void unmask_irq(int irq)
+{
+	irqctl->unmask(irq);
+}
+
+static void pic_mask_irq(int irq)
 {
 	int port;
 	unsigned char mask;
@@ -229,7 +403,7 @@ void mask_irq(int irq)
 	outb(mask, port);
 }
 
-void unmask_irq(int irq)
+static void pic_unmask_irq(int irq)
 {
 	int port;
 	unsigned char mask;
@@ -248,21 +422,27 @@ void unmask_irq(int irq)
 
 void end_of_irq(int irq)
 {
+	int cpu = cpu_index();
 	int intr_state = get_intr_flag();
 	disable_intr();
 
-	if(!eoi_pending) {
+	if(!eoi_pending[cpu]) {
 		set_intr_flag(intr_state);
 		return;
 	}
-	eoi_pending = 0;
+	eoi_pending[cpu] = 0;
+
+	irqctl->eoi(irq);
 
+	set_intr_flag(intr_state);
+}
+
+void pic_eoi(int irq)
+{
 	if(irq > 7) {
 		outb(OCW2_EOI, PIC2_CMD);
 	}
 	outb(OCW2_EOI, PIC1_CMD);
-
-	set_intr_flag(intr_state);
 }
 
 #ifdef ENABLE_GDB_STUB
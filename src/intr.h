@@ -29,6 +29,16 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 /* checks whether a particular interrupt is an remapped IRQ */
 #define IS_IRQ(n)	((n) >= IRQ_OFFSET && (n) < IRQ_OFFSET + 16)
 
+/* interrupts reserved for message signalled interrupts (see pci_enable_msi) */
+#define MSI_INTR_BASE	(IRQ_OFFSET + 16)
+#define NUM_MSI_INTR	16
+#define IS_MSI(n)	((n) >= MSI_INTR_BASE && (n) < MSI_INTR_BASE + NUM_MSI_INTR)
+
+/* interrupts generated by the local APIC itself (see apic.h) */
+#define APIC_INTR_BASE	(MSI_INTR_BASE + NUM_MSI_INTR)
+#define NUM_APIC_INTR	8
+#define IS_APIC_INTR(n)	((n) >= APIC_INTR_BASE && (n) < APIC_INTR_BASE + NUM_APIC_INTR)
+
 /* general purpose registers as they are pushed by pusha */
 struct registers {
 	uint32_t edi, esi, ebp, esp;
@@ -59,10 +69,51 @@ struct intr_frame {
 
 typedef void (*intr_func_t)(int);
 
+/* number of handler time histogram bins. Bin n counts handlers which took
+ * [2^n, 2^(n+1)) TSC cycles.
+ */
+#define INTR_HIST_BINS	32
+
+/* statistics kept by dispatch_intr for each interrupt, when INTR_STATS is
+ * defined in config.h. Handler times are in TSC cycles and include any nested
+ * interrupts, but not the end of interrupt and deferred work. Without a TSC
+ * only the counts are kept. Counts may occasionally be lost when multiple
+ * processors take the same interrupt at once.
+ */
+struct intr_stats {
+	unsigned long count;
+	uint64_t total, max;
+	unsigned long hist[INTR_HIST_BINS];
+};
+
+/* spurious IRQ 7 and IRQ 15 interrupts filtered out by the PIC entry points
+ * in intr_asm.S, which never reach dispatch_intr.
+ */
+volatile unsigned long num_spurious_irq7, num_spurious_irq15;
+
+/* operations of the interrupt controller IRQs are routed through. The 8259
+ * PICs are used by default, until init_apic switches to the I/O APIC.
+ */
+struct irq_controller {
+	const char *name;
+	void (*eoi)(int irq);
+	void (*mask)(int irq);
+	void (*unmask)(int irq);
+};
+
 
 void init_intr(void);
+void init_cpu_intr(void);
 
 struct intr_frame *get_intr_frame(void);
+/* nonzero while running an interrupt handler on this processor */
+int in_intr(void);
+
+/* copy the statistics of an interrupt. Returns -1 if intr_num is invalid */
+int get_intr_stats(int intr_num, struct intr_stats *st);
+void reset_intr_stats(void);
+/* print the statistics of all interrupts which occured since the last reset */
+void print_intr_stats(void);
 
 /* install high level interrupt callback */
 void interrupt(int intr_num, intr_func_t func);
@@ -72,6 +123,9 @@ void interrupt(int intr_num, intr_func_t func);
  */
 void set_intr_entry(int num, void (*handler)(void));
 
+void set_irq_controller(struct irq_controller *ic);
+struct irq_controller *get_irq_controller(void);
+
 void prog_pic(int offs);
 void set_pic_mask(int pic, unsigned char mask);
 unsigned char get_pic_mask(int pic);
@@ -85,5 +139,7 @@ void set_intr_flag(int onoff);
 void intr_ret(struct intr_frame ifrm);
 
 void end_of_irq(int irq);
+/* send an end of interrupt command to the PICs */
+void pic_eoi(int irq);
 
 #endif	/* INTR_H_ */
@@ -65,6 +65,32 @@ INTR_ENTRY_NOEC(44, irq12)
 INTR_ENTRY_NOEC(45, irq13)
 INTR_ENTRY_NOEC(46, irq14)
 INTR_ENTRY_NOEC(47, irq15)
+/* message signalled interrupts */
+INTR_ENTRY_NOEC(48, msi0)
+INTR_ENTRY_NOEC(49, msi1)
+INTR_ENTRY_NOEC(50, msi2)
+INTR_ENTRY_NOEC(51, msi3)
+INTR_ENTRY_NOEC(52, msi4)
+INTR_ENTRY_NOEC(53, msi5)
+INTR_ENTRY_NOEC(54, msi6)
+INTR_ENTRY_NOEC(55, msi7)
+INTR_ENTRY_NOEC(56, msi8)
+INTR_ENTRY_NOEC(57, msi9)
+INTR_ENTRY_NOEC(58, msi10)
+INTR_ENTRY_NOEC(59, msi11)
+INTR_ENTRY_NOEC(60, msi12)
+INTR_ENTRY_NOEC(61, msi13)
+INTR_ENTRY_NOEC(62, msi14)
+INTR_ENTRY_NOEC(63, msi15)
+/* local APIC interrupts */
+INTR_ENTRY_NOEC(64, apic0)
+INTR_ENTRY_NOEC(65, apic1)
+INTR_ENTRY_NOEC(66, apic2)
+INTR_ENTRY_NOEC(67, apic3)
+INTR_ENTRY_NOEC(68, apic4)
+INTR_ENTRY_NOEC(69, apic5)
+INTR_ENTRY_NOEC(70, apic6)
+INTR_ENTRY_NOEC(71, apic7)
 /* system call interrupt */
 INTR_ENTRY_NOEC(128, syscall)
 /* default interrupt */
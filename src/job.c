@@ -0,0 +1,236 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <inttypes.h>
+#include "job.h"
+#include "smp.h"
+#include "apic.h"
+#include "spinlock.h"
+#include "asmops.h"
+
+#define JOBQ_SIZE	256
+#define JOBQ_MASK	(JOBQ_SIZE - 1)
+
+/* per-processor job queue. The owner pushes and pops at the bottom, thieves
+ * steal from the top.
+ */
+struct job_queue {
+	spinlock_t lock;
+	unsigned int top, bottom;
+	struct job *jobs[JOBQ_SIZE];
+};
+
+struct range_job {
+	struct job job;
+	int start, end, grain;
+	range_func_t func;
+	void *arg;
+};
+
+static int push_job(struct job_queue *q, struct job *job);
+static struct job *get_job(int cpu);
+static void run_job(struct job *job);
+static void finish_job(struct job *job);
+static void wake_worker(void);
+static void run_range(void *arg);
+
+static struct job_queue jobq[MAX_CPUS];
+static volatile int num_queued;
+/* processors halted in job_worker */
+static volatile int idle_mask;
+
+
+void job_submit(struct job *job, job_func_t func, void *arg, struct job *parent)
+{
+	job->func = func;
+	job->arg = arg;
+	job->parent = parent;
+	job->pending = 1;
+	if(parent) {
+		atomic_add(&parent->pending, 1);
+	}
+
+	if(push_job(jobq + cpu_index(), job) == -1) {
+		run_job(job);	/* queue full, just do it */
+		return;
+	}
+	atomic_add(&num_queued, 1);
+
+	if(idle_mask) {
+		wake_worker();
+	}
+}
+
+void job_wait(struct job *job)
+{
+	struct job *other;
+	int cpu = cpu_index();
+
+	while(job->pending > 0) {
+		if((other = get_job(cpu))) {
+			run_job(other);
+		} else {
+			cpu_relax();
+		}
+	}
+}
+
+void parallel_for(int start, int end, int grain, range_func_t func, void *arg)
+{
+	struct range_job rj;
+
+	if(end <= start) return;
+	if(grain <= 0) {
+		grain = (end - start) / (num_cpus * 4);
+		if(grain < 1) grain = 1;
+	}
+
+	rj.start = start;
+	rj.end = end;
+	rj.grain = grain;
+	rj.func = func;
+	rj.arg = arg;
+	run_range(&rj);
+}
+
+void job_worker(void)
+{
+	int cpu = cpu_index();
+	int bit = 1 << cpu;
+	struct job *job;
+
+	for(;;) {
+		if((job = get_job(cpu))) {
+			run_job(job);
+			continue;
+		}
+
+		disable_intr();
+		/* the locked or orders this against job_submit incrementing
+		 * num_queued before checking idle_mask, so either we see the new
+		 * job, or it sees us idle and sends an IPI. sti takes effect after
+		 * the hlt starts, so a pending IPI still wakes us up.
+		 */
+		atomic_or(&idle_mask, bit);
+		if(!num_queued) {
+			asm volatile("sti\n\thlt\n\tcli");
+		}
+		atomic_and(&idle_mask, ~bit);
+		enable_intr();
+	}
+}
+
+static int push_job(struct job_queue *q, struct job *job)
+{
+	int iflag = spin_lock_irq(&q->lock);
+
+	if(q->bottom - q->top >= JOBQ_SIZE) {
+		spin_unlock_irq(&q->lock, iflag);
+		return -1;
+	}
+	q->jobs[q->bottom++ & JOBQ_MASK] = job;
+
+	spin_unlock_irq(&q->lock, iflag);
+	return 0;
+}
+
+/* newest job from our own queue, or else the oldest job of another one */
+static struct job *get_job(int cpu)
+{
+	int i, iflag, idx;
+	struct job_queue *q;
+	struct job *job = 0;
+
+	if(!num_queued) return 0;
+
+	for(i=0; i<num_cpus; i++) {
+		idx = (cpu + i) % num_cpus;
+		q = jobq + idx;
+		if(q->top == q->bottom) continue;
+
+		iflag = spin_lock_irq(&q->lock);
+		if(q->top != q->bottom) {
+			if(idx == cpu) {
+				job = q->jobs[--q->bottom & JOBQ_MASK];
+			} else {
+				job = q->jobs[q->top++ & JOBQ_MASK];
+			}
+		}
+		spin_unlock_irq(&q->lock, iflag);
+
+		if(job) {
+			atomic_add(&num_queued, -1);
+			return job;
+		}
+	}
+	return 0;
+}
+
+static void run_job(struct job *job)
+{
+	job->func(job->arg);
+	finish_job(job);
+}
+
+static void finish_job(struct job *job)
+{
+	/* the job might be gone as soon as pending drops to 0 */
+	struct job *parent = job->parent;
+
+	if(atomic_add(&job->pending, -1) == 1 && parent) {
+		finish_job(parent);
+	}
+}
+
+static void wake_worker(void)
+{
+	int i, mask = idle_mask;
+
+	for(i=0; i<num_cpus; i++) {
+		if(mask & (1 << i)) {
+			atomic_and(&idle_mask, ~(1 << i));
+			lapic_send_ipi(cpus[i].apic_id, APIC_IPI_INTR);
+			return;
+		}
+	}
+}
+
+/* split the range in half, queue one half, and recurse into the other, so
+ * that large chunks get stolen first.
+ */
+static void run_range(void *arg)
+{
+	struct range_job *rj = arg;
+	struct range_job half, rest;
+	int mid;
+
+	if(rj->end - rj->start <= rj->grain) {
+		rj->func(rj->start, rj->end, rj->arg);
+		return;
+	}
+	mid = rj->start + (rj->end - rj->start) / 2;
+
+	half = *rj;
+	half.start = mid;
+	job_submit(&half.job, run_range, &half, 0);
+
+	rest = *rj;
+	rest.end = mid;
+	run_range(&rest);
+
+	job_wait(&half.job);
+}
@@ -0,0 +1,55 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef JOB_H_
+#define JOB_H_
+
+typedef void (*job_func_t)(void *arg);
+typedef void (*range_func_t)(int start, int end, void *arg);
+
+/* job handle, allocated by the caller, which must stay valid until job_wait
+ * returns. The fields are private to the job system.
+ */
+struct job {
+	job_func_t func;
+	void *arg;
+	struct job *parent;
+	volatile int pending;	/* 1 until it has run, plus unfinished children */
+};
+
+/* queue func(arg) to run on any processor. Jobs are taken from the back of
+ * the queue of the processor which submitted them, and idle processors steal
+ * from the front of other queues. If parent is not null, the parent job isn't
+ * finished until this one is. Jobs running on the application processors
+ * must not call into anything which isn't thread-safe, like malloc or printf.
+ */
+void job_submit(struct job *job, job_func_t func, void *arg, struct job *parent);
+/* wait for a job and its children to finish, running queued jobs meanwhile */
+void job_wait(struct job *job);
+
+/* call func for consecutive ranges covering [start, end), no longer than
+ * grain (0 picks a size based on the number of processors), in parallel, and
+ * wait for all of them to finish.
+ */
+void parallel_for(int start, int end, int grain, range_func_t func, void *arg);
+
+/* main loop of the application processors: run jobs, or halt until there
+ * are jobs to run.
+ */
+void job_worker(void);
+
+#endif	/* JOB_H_ */
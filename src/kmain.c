@@ -16,6 +16,7 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include "segm.h"
@@ -29,36 +30,75 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "audio.h"
 #include "pci.h"
 #include "vbetest.h"
+#include "fsbench.h"
+#include "bootprof.h"
+#include "cpuid.h"
+#include "apic.h"
+#include "hpet.h"
+#include "smp.h"
+#include "thread.h"
+#include "intrbench.h"
+#include "jobbench.h"
+#include "serial.h"
+#include "prof.h"
+#include "trace.h"
 
 
 void logohack(void);
 
+static void poll_serial_cmd(void);
+static void serial_cmd(char *cmd);
+
 void pcboot_main(void)
 {
+	unsigned long ticks, last_sec = 0;
+
+	bprof_init();
+	init_cpuid();
+
 	init_segm();
+	bprof_mark("init_segm");
 	init_intr();
+	bprof_mark("init_intr");
 
 	con_init();
+	bprof_mark("con_init");
 	kb_init();
+	bprof_mark("kb_init");
 	init_psaux();
+	bprof_mark("init_psaux");
 
 	init_mem();
+	bprof_mark("init_mem");
 
 	init_pci();
+	bprof_mark("init_pci");
 
 	/* initialize the timer */
 	init_timer();
+	bprof_mark("init_timer");
+#ifdef USE_APIC
+	init_apic();
+	bprof_mark("init_apic");
+#endif
+	init_hpet();
+	bprof_mark("init_hpet");
+	init_smp();
+	bprof_mark("init_smp");
+	init_threads();
 
 	audio_init();
+	bprof_mark("audio_init");
 
 	enable_intr();
 
+	bprof_print();
 	printf("PCBoot kernel initialized\n");
 
 	for(;;) {
 		int c;
 
-		halt_cpu();
+		sched_halt();
 		while((c = kb_getkey()) >= 0) {
 			switch(c) {
 			case KB_F1:
@@ -70,6 +110,18 @@ void pcboot_main(void)
 			case KB_F2:
 				vbetest();
 				break;
+
+			case KB_F3:
+				fsbench();
+				break;
+
+			case KB_F4:
+				intrbench();
+				break;
+
+			case KB_F5:
+				jobbench();
+				break;
 			}
 			if(isprint(c)) {
 				printf("key: %d '%c'\n", c, (char)c);
@@ -77,8 +129,81 @@ void pcboot_main(void)
 				printf("key: %d\n", c);
 			}
 		}
-		if((nticks % 250) == 0) {
-			con_printf(71, 0, "[%ld]", nticks);
+		poll_serial_cmd();
+
+		if((ticks = get_ticks()) / TICK_FREQ_HZ != last_sec) {
+			last_sec = ticks / TICK_FREQ_HZ;
+			con_printf(71, 0, "[%ld]", ticks);
+		}
+	}
+}
+
+/* debugging commands can be sent over the serial console, one per line */
+static void poll_serial_cmd(void)
+{
+	static char line[64];
+	static int len;
+	int c;
+
+	while(ser_pending(0)) {
+		c = ser_getc(0);
+		if(c == '\r' || c == '\n') {
+			line[len] = 0;
+			if(len) serial_cmd(line);
+			len = 0;
+		} else if(len < sizeof line - 1) {
+			line[len++] = c;
+		}
+	}
+}
+
+static void serial_cmd(char *cmd)
+{
+	int hz;
+	unsigned int flags;
+
+	if(strcmp(cmd, "irqstat") == 0) {
+		print_intr_stats();
+	} else if(strcmp(cmd, "irqstat reset") == 0) {
+		reset_intr_stats();
+	} else if(strcmp(cmd, "trace start") == 0) {
+		trace_start();
+	} else if(strcmp(cmd, "trace stop") == 0) {
+		trace_stop();
+	} else if(strcmp(cmd, "trace dump") == 0) {
+		trace_dump();
+	} else if(strcmp(cmd, "prof stop") == 0) {
+		prof_stop();
+	} else if(strcmp(cmd, "prof dump") == 0) {
+		prof_dump();
+	} else if(strncmp(cmd, "prof", 4) == 0 && (!cmd[4] || cmd[4] == ' ')) {
+		/* prof [bt] [hz] */
+		cmd += 4;
+		while(*cmd == ' ') cmd++;
+		flags = 0;
+		if(strncmp(cmd, "bt", 2) == 0) {
+			flags = PROF_BACKTRACE;
+			cmd += 2;
+		}
+		if((hz = atoi(cmd)) <= 0) {
+			hz = 1024;
+		}
+		if((hz = prof_start(hz, flags)) == -1) {
+			perror("prof");
+		} else {
+			printf("profiling at %d hz\n", hz);
 		}
+	} else if(strcmp(cmd, "help") == 0) {
+		printf("serial commands:\n");
+		printf(" irqstat         print interrupt statistics\n");
+		printf(" irqstat reset   reset interrupt statistics\n");
+		printf(" prof [bt] [hz]  start profiling, with backtraces if bt\n");
+		printf(" prof stop       stop profiling\n");
+		printf(" prof dump       dump profiler samples, for tools/prof/profsym\n");
+		printf(" trace start     start event tracing\n");
+		printf(" trace stop      stop event tracing\n");
+		printf(" trace dump      stop tracing and dump events, for tools/trace/trace2json\n");
+	} else {
+		printf("unknown command: %s (try help)\n", cmd);
 	}
 }
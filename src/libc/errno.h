@@ -32,6 +32,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define ENOTDIR			12
 #define EISDIR			13
 #define EEXIST			14
+#define ENOTEMPTY		15
 #define ERANGE			34
 
 #define EBUG			127	/* for missing features and known bugs */
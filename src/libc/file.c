@@ -42,16 +42,16 @@ FILE *fopen(const char *path, const char *mode)
 			}
 			break;
 		case 'w':
-			mflags |= MODE_WRITE | MODE_TRUNCATE;
+			mflags |= MODE_WRITE | MODE_TRUNCATE | MODE_CREATE;
 			if(*mode == '+') {
-				mflags |= MODE_READ | MODE_CREATE;
+				mflags |= MODE_READ;
 				mode++;
 			}
 			break;
 		case 'a':
-			mflags |= MODE_WRITE | MODE_APPEND;
+			mflags |= MODE_WRITE | MODE_APPEND | MODE_CREATE;
 			if(*mode == '+') {
-				mflags |= MODE_READ | MODE_CREATE;
+				mflags |= MODE_READ;
 				mode++;
 			}
 			break;
@@ -63,16 +63,30 @@ FILE *fopen(const char *path, const char *mode)
 		}
 	}
 
-	if(!(node = fs_open(path, 0))) {
-		/* TODO: create */
-		errno = ENOENT;	/* TODO */
+	if(!(node = fs_open(path, (mflags & MODE_CREATE) ? FSO_CREATE : 0))) {
 		return 0;
 	}
 	if(node->type != FSNODE_FILE) {
+		fs_close(node);
 		errno = EISDIR;
 		return 0;
 	}
 
+	if((mflags & MODE_TRUNCATE) && fs_filesize(node) > 0) {
+		/* truncate by re-creating the file */
+		if(fs_remove(node) == -1) {
+			fs_close(node);
+			return 0;
+		}
+		fs_close(node);
+		if(!(node = fs_open(path, FSO_CREATE))) {
+			return 0;
+		}
+	}
+	if(mflags & MODE_APPEND) {
+		fs_seek(node, 0, FSSEEK_END);
+	}
+
 	if(!(fp = malloc(sizeof *fp))) {
 		errno = ENOMEM;
 		return 0;
@@ -238,7 +238,8 @@ static const char *errstr[] = {
 	"Not a directory",
 	"Is a directory",
 	"Does not exist",
-	0,0,0,0,0,
+	"Directory not empty",
+	0,0,0,0,
 	0,0,0,0,0,0,0,0,0,0,  0,0,0,0,0,0,0,0,0,0,
 	0,0,0,0,0,0,0,0,0,0,  0,0,0,0,0,0,0,0,0,0,
 	0,0,0,0,0,0,0,0,0,0,  0,0,0,0,0,0,0,0,0,0,
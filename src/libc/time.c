@@ -19,6 +19,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "time.h"
 #include "rtc.h"
 #include "timer.h"
+#include "asmops.h"
 #include "config.h"
 
 #define MINSEC		60
@@ -47,12 +48,17 @@ static char *mon[] = {
 
 time_t time(time_t *tp)
 {
-	time_t res = start_time + nticks / TICK_FREQ_HZ;
+	time_t res = start_time + udiv64(get_time_ns(), 1000000000);
 
 	if(tp) *tp = res;
 	return res;
 }
 
+clock_t clock(void)
+{
+	return udiv64(get_time_ns(), 1000);
+}
+
 char *asctime(struct tm *tm)
 {
 	static char buf[64];
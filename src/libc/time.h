@@ -19,6 +19,9 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define TIME_H_
 
 typedef long time_t;
+typedef long clock_t;
+
+#define CLOCKS_PER_SEC	1000000
 
 struct tm {
 	int tm_sec;
@@ -36,6 +39,8 @@ struct tm {
 long timezone;
 
 time_t time(time_t *tp);
+/* microseconds since boot */
+clock_t clock(void);
 char *asctime(struct tm *tm);
 char *asctime_r(struct tm *tm, char *buf);
 
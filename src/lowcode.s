@@ -38,6 +38,7 @@ saved_flags: .word 0
 saved_if: .byte 0
 saved_pic1_mask: .byte 0
 saved_pic2_mask: .byte 0
+int86_trace_name: .asciz "int86"
 
 	# drop back to unreal mode to call 16bit interrupt
 	.global int86
@@ -45,6 +46,17 @@ int86:
 	push %ebp
 	mov %esp, %ebp
 	pushal
+
+	# trace_begin("int86"), see trace.h
+	cmpl $0, trace_enabled
+	jz 0f
+	pushl $0
+	pushl $int86_trace_name
+	# TRACE_BEGIN
+	pushl $0x42
+	call trace_event
+	add $12, %esp
+0:
 	call get_intr_flag
 	mov %al, saved_if
 	cli
@@ -52,6 +64,9 @@ int86:
 	sidt (saved_idtr)
 	lidt (rmidt)
 
+	# if IRQs are routed through the I/O APIC, reconnect the PICs
+	call apic_bios_enter
+
 	# save PIC masks
 	pushl $0
 	call get_pic_mask
@@ -175,6 +190,9 @@ int_op:	int $0
 	call set_pic_mask
 	add $8, %esp
 
+	# switch back to the I/O APIC, if we were using it
+	call apic_bios_exit
+
 	# keyboard voodoo: with some BIOS implementations, after returning from
 	# int13, there's (I guess) leftover data in the keyboard port and we
 	# can't receive any more keyboard interrupts afterwards. Reading from
@@ -188,6 +206,16 @@ int_op:	int $0
 	call set_intr_flag
 	add $4, %esp
 
+	# trace_end()
+	cmpl $0, trace_enabled
+	jz 0f
+	pushl $0
+	pushl $0
+	# TRACE_END
+	pushl $0x45
+	call trace_event
+	add $12, %esp
+0:
 	popal
 	pop %ebp
 	ret
@@ -0,0 +1,83 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include "lz4.h"
+
+/* reads an LZ4 length extension: bytes are added until one is not 255 */
+#define READ_LEN(len) \
+	do { \
+		int c; \
+		do { \
+			if(ip >= iend) return -1; \
+			c = *ip++; \
+			(len) += c; \
+		} while(c == 255); \
+	} while(0)
+
+int lz4_decompress(const void *src, int srcsz, void *dest, int destsz)
+{
+	const unsigned char *ip = src, *iend = ip + srcsz;
+	unsigned char *op = dest, *oend = op + destsz;
+	unsigned char *match;
+	int token, len, offs;
+
+	while(ip < iend) {
+		token = *ip++;
+
+		/* literals */
+		len = token >> 4;
+		if(len == 15) READ_LEN(len);
+		if(len > iend - ip || len > oend - op) {
+			return -1;
+		}
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* the last sequence has only literals */
+		if(ip >= iend) break;
+
+		/* match */
+		if(iend - ip < 2) return -1;
+		offs = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(!offs || offs > op - (unsigned char*)dest) {
+			return -1;
+		}
+		match = op - offs;
+
+		len = token & 0xf;
+		if(len == 15) READ_LEN(len);
+		len += 4;
+		if(len > oend - op) {
+			return -1;
+		}
+
+		if(offs >= len) {
+			memcpy(op, match, len);
+			op += len;
+		} else {
+			/* overlapping match, repeats the last offs bytes */
+			while(len-- > 0) {
+				*op++ = *match++;
+			}
+		}
+	}
+
+	return op - (unsigned char*)dest;
+}
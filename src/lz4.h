@@ -0,0 +1,27 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef LZ4_H_
+#define LZ4_H_
+
+/* decompress a single LZ4 block (raw block format, no frame header) of srcsz
+ * bytes into dest, which has room for destsz bytes. Returns the decompressed
+ * size, or -1 if the data are corrupt or don't fit.
+ */
+int lz4_decompress(const void *src, int srcsz, void *dest, int destsz);
+
+#endif	/* LZ4_H_ */
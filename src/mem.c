@@ -239,12 +239,17 @@ int alloc_ppage_range(int start, int size)
 	int i, pg = start;
 	int intr_state;
 
+	if(start < 0 || start + size > bmsize * 8) {
+		return -1;
+	}
+
 	intr_state = get_intr_flag();
 	disable_intr();
 
 	/* first validate that no page in the requested range is allocated */
 	for(i=0; i<size; i++) {
 		if(!IS_FREE(pg)) {
+			set_intr_flag(intr_state);
 			return -1;
 		}
 		++pg;
@@ -40,7 +40,8 @@ int alloc_ppages(int count, int area);
 void free_ppages(int pg0, int count);
 
 /* allocate a specific range of pages.
- * Fails (and returns -1) if any page in the requested range is not free.
+ * Fails (and returns -1) if any page in the requested range is not free, or
+ * beyond the end of memory.
  */
 int alloc_ppage_range(int start, int size);
 int free_ppage_range(int start, int size);
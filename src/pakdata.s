@@ -0,0 +1,26 @@
+# pcboot - bootable PC demo/game kernel
+# Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+# 
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+# 
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY, without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# 
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+	# asset archive built by tools/mkpak from the assets directory. The main
+	# program is loaded at 1MB, so aligning here keeps every file in the
+	# archive page-aligned in memory.
+	.section .rodata
+	.global pak_start
+	.global pak_end
+	.balign 4096
+pak_start:
+	.incbin "assets.pak"
+pak_end:
@@ -22,6 +22,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "intr.h"
 #include "int86.h"
 #include "asmops.h"
+#include "apic.h"
 #include "panic.h"
 
 #define CONFIG_ADDR_PORT	0xcf8
@@ -30,42 +31,57 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define ADDR_ENABLE		0x80000000
 #define ADDR_BUSID(x)	(((uint32_t)(x) & 0xff) << 16)
 #define ADDR_DEVID(x)	(((uint32_t)(x) & 0x1f) << 11)
-#define ADDR_FUNC(x)	(((uint32_t)(x) & 3) << 8)
+#define ADDR_FUNC(x)	(((uint32_t)(x) & 7) << 8)
 
 /* signature returned in edx by the PCI BIOS present function: FOURCC "PCI " */
 #define PCI_SIG		0x20494350
 
-#define TYPE_MULTIFUNC	0x80
-
-struct config_data {
-	uint16_t vendor, device;
-	uint16_t cmd, status;
-	uint8_t rev, iface, subclass, class;
-	uint8_t cacheline_size;
-	uint8_t latency_timer;
-	uint8_t hdr_type;
-	uint8_t bist;
-	uint32_t base_addr[6];
-	uint32_t cardbus_cis;
-	uint16_t subsys_vendor;
-	uint16_t subsys;
-	uint32_t rom_addr;
-	uint32_t reserved1, reserved2;
-	uint8_t intr_line, intr_pin;
-	uint8_t min_grant, max_latency;
-} __attribute__((packed));
-
-static int enum_bus(int busid);
-static int enum_dev(int busid, int dev);
-static int read_dev_info(struct config_data *res, int bus, int dev, int func);
-static void print_dev_info(struct config_data *info, int bus, int dev, int func);
+#define BAR_IO			1
+#define BAR_MEM_TYPE	6
+#define BAR_MEM_64		4
+#define BAR_MEM_PREF	8
+
+/* MSI capability message control register bits */
+#define MSI_CTL_ENABLE	0x0001
+#define MSI_CTL_MME		0x0070	/* multiple message enable */
+#define MSI_CTL_64BIT	0x0080
+
+/* MSI messages are memory writes to the local APIC address range. The
+ * destination APIC id goes in bits 12-19 of the address, and the interrupt
+ * vector in the low 8 bits of the data.
+ */
+#define MSI_ADDR		0xfee00000
+#define MSI_ADDR_DEST(x)	((uint32_t)(x) << 12)
+
+static void enum_bus(int busid);
+static void enum_dev(int busid, int dev);
+static int add_dev(int bus, int dev, int func);
+static int read_dev_info(struct pci_config_data *res, int bus, int dev, int func);
+static void print_dev_info(struct pci_config_data *info, int bus, int dev, int func);
+
+static void probe_drivers(struct pci_driver *drv);
+static int match_id(struct pci_device *dev, struct pci_device_id *id);
+static void msi_intr(int inum);
 
 static uint32_t cfg_read32_m1(int bus, int dev, int func, int reg);
 static uint32_t cfg_read32_m2(int bus, int dev, int func, int reg);
+static void cfg_write_m1(int bus, int dev, int func, int reg, uint32_t val, int size);
+static void cfg_write_m2(int bus, int dev, int func, int reg, uint32_t val, int size);
 static const char *class_str(int cc);
 static const char *subclass_str(int cc, int sub);
 
 static uint32_t (*cfg_read32)(int, int, int, int);
+static void (*cfg_write)(int, int, int, int, uint32_t, int);
+
+static struct pci_device pcidev[MAX_PCI_DEVICES];
+static int num_pcidev;
+static uint32_t bus_visited[256 / 32];
+static int num_cfg_reads;
+static int pci_enum_done;
+
+static struct pci_driver *drvlist;
+
+static intr_func_t msi_func[NUM_MSI_INTR];
 
 void init_pci(void)
 {
@@ -91,6 +107,7 @@ void init_pci(void)
 	printf("PCI BIOS v%x.%x found\n", (regs.ebx & 0xff00) >> 8, regs.ebx & 0xff);
 	if(regs.eax & 1) {
 		cfg_read32 = cfg_read32_m1;
+		cfg_write = cfg_write_m1;
 	} else {
 		if(!(regs.eax & 2)) {
 			printf("Failed to find supported PCI mess mechanism\n");
@@ -98,54 +115,396 @@ void init_pci(void)
 		}
 		printf("PCI mess mechanism #1 unsupported, falling back to mechanism #2\n");
 		cfg_read32 = cfg_read32_m2;
+		cfg_write = cfg_write_m2;
 	}
 
-	for(i=0; i<256; i++) {
-		count += enum_bus(i);
+	/* walk the bus hierarchy starting from the host bridge(s) instead of
+	 * probing all 256 buses. A multi-function host bridge means there are
+	 * multiple host controllers, and function N is responsible for bus N.
+	 */
+	if((cfg_read32(0, 0, 0, 0xc) >> 16) & PCI_HDR_MULTIFUNC) {
+		for(i=0; i<8; i++) {
+			if((cfg_read32(0, 0, i, 0) & 0xffff) != 0xffff) {
+				enum_bus(i);
+			}
+		}
+	} else {
+		enum_bus(0);
 	}
-	printf("found %d PCI devices\n\n", count);
+
+	for(i=0; i<256 / 32; i++) {
+		uint32_t bits = bus_visited[i];
+		while(bits) {
+			count += bits & 1;
+			bits >>= 1;
+		}
+	}
+	printf("found %d PCI devices on %d buses (%d config reads)\n\n", num_pcidev,
+			count, num_cfg_reads);
+
+	pci_enum_done = 1;
+	probe_drivers(drvlist);
 }
 
-static int enum_bus(int busid)
+int pci_num_devices(void)
 {
-	int i, count = 0;
+	return num_pcidev;
+}
 
-	for(i=0; i<32; i++) {
-		count += enum_dev(busid, i);
+struct pci_device *pci_device(int idx)
+{
+	if(idx < 0 || idx >= num_pcidev) {
+		return 0;
 	}
+	return pcidev + idx;
+}
 
-	return count;
+struct pci_device *pci_find_device(int vendor, int device, struct pci_device *prev)
+{
+	struct pci_device *dev = prev ? prev + 1 : pcidev;
+	struct pci_device *end = pcidev + num_pcidev;
+
+	while(dev < end) {
+		if(dev->cfg.vendor == vendor && dev->cfg.device == device) {
+			return dev;
+		}
+		dev++;
+	}
+	return 0;
 }
 
-static int enum_dev(int busid, int dev)
+struct pci_device *pci_find_class(int class, int subclass, struct pci_device *prev)
 {
-	int i, count;
-	struct config_data info;
+	struct pci_device *dev = prev ? prev + 1 : pcidev;
+	struct pci_device *end = pcidev + num_pcidev;
 
-	/* vendor id ffff is invalid */
-	if((cfg_read32(busid, dev, 0, 0) & 0xffff) == 0xffff) {
+	while(dev < end) {
+		if(dev->cfg.class == class && (subclass < 0 || dev->cfg.subclass == subclass)) {
+			return dev;
+		}
+		dev++;
+	}
+	return 0;
+}
+
+int pci_bar(struct pci_device *dev, int idx, struct pci_bar *bar)
+{
+	uint32_t val;
+
+	if(idx < 0 || idx >= dev->num_bars) {
+		return -1;
+	}
+	/* the upper half of a 64bit BAR is not a BAR in itself */
+	if(idx > 0 && (dev->cfg.base_addr[idx - 1] & (BAR_IO | BAR_MEM_TYPE)) == BAR_MEM_64) {
+		return -1;
+	}
+	if(!(val = dev->cfg.base_addr[idx])) {
+		return -1;
+	}
+
+	if(val & BAR_IO) {
+		bar->type = PCI_BAR_IO;
+		bar->addr = val & 0xfffffffc;
+		bar->is64 = bar->prefetch = 0;
+		return 0;
+	}
+
+	bar->type = PCI_BAR_MEM;
+	bar->addr = val & 0xfffffff0;
+	bar->prefetch = (val & BAR_MEM_PREF) != 0;
+	bar->is64 = (val & BAR_MEM_TYPE) == BAR_MEM_64;
+	if(bar->is64) {
+		if(idx + 1 >= dev->num_bars) {
+			return -1;
+		}
+		bar->addr |= (uint64_t)dev->cfg.base_addr[idx + 1] << 32;
+	}
+	return 0;
+}
+
+uint64_t pci_bar_size(struct pci_device *dev, int idx)
+{
+	int reg;
+	uint16_t cmd;
+	uint32_t lo, hi = 0xffffffff;
+	uint64_t mask;
+	struct pci_bar bar;
+
+	if(pci_bar(dev, idx, &bar) == -1) {
 		return 0;
 	}
-	if(read_dev_info(&info, busid, dev, 0) == -1) {
+	reg = PCI_REG_BAR0 + idx * 4;
+
+	/* disable decoding while the BAR holds the all-ones pattern */
+	cmd = pci_cfg_read16(dev, PCI_REG_CMD);
+	pci_cfg_write16(dev, PCI_REG_CMD, cmd & ~(PCI_CMD_IO | PCI_CMD_MEM));
+
+	pci_cfg_write32(dev, reg, 0xffffffff);
+	lo = pci_cfg_read32(dev, reg);
+	pci_cfg_write32(dev, reg, dev->cfg.base_addr[idx]);
+	if(bar.is64) {
+		pci_cfg_write32(dev, reg + 4, 0xffffffff);
+		hi = pci_cfg_read32(dev, reg + 4);
+		pci_cfg_write32(dev, reg + 4, dev->cfg.base_addr[idx + 1]);
+	}
+
+	pci_cfg_write16(dev, PCI_REG_CMD, cmd);
+
+	if(bar.type == PCI_BAR_IO) {
+		/* the upper 16 bits of I/O BARs may be hardwired to 0 */
+		lo = (lo & 0xfffc) | 0xffff0000;
+		return (uint32_t)~lo + 1;
+	}
+	mask = ((uint64_t)hi << 32) | (lo & 0xfffffff0);
+	return ~mask + 1;
+}
+
+uint8_t pci_cfg_read8(struct pci_device *dev, int reg)
+{
+	return cfg_read32(dev->bus, dev->dev, dev->func, reg & 0xfc) >> ((reg & 3) << 3);
+}
+
+uint16_t pci_cfg_read16(struct pci_device *dev, int reg)
+{
+	return cfg_read32(dev->bus, dev->dev, dev->func, reg & 0xfc) >> ((reg & 2) << 3);
+}
+
+uint32_t pci_cfg_read32(struct pci_device *dev, int reg)
+{
+	return cfg_read32(dev->bus, dev->dev, dev->func, reg & 0xfc);
+}
+
+void pci_cfg_write8(struct pci_device *dev, int reg, uint8_t val)
+{
+	cfg_write(dev->bus, dev->dev, dev->func, reg, val, 1);
+}
+
+void pci_cfg_write16(struct pci_device *dev, int reg, uint16_t val)
+{
+	cfg_write(dev->bus, dev->dev, dev->func, reg & 0xfe, val, 2);
+}
+
+void pci_cfg_write32(struct pci_device *dev, int reg, uint32_t val)
+{
+	cfg_write(dev->bus, dev->dev, dev->func, reg & 0xfc, val, 4);
+}
+
+void pci_enable(struct pci_device *dev, unsigned int cmdbits)
+{
+	dev->cfg.cmd = pci_cfg_read16(dev, PCI_REG_CMD) | cmdbits;
+	pci_cfg_write16(dev, PCI_REG_CMD, dev->cfg.cmd);
+}
+
+void pci_disable(struct pci_device *dev, unsigned int cmdbits)
+{
+	dev->cfg.cmd = pci_cfg_read16(dev, PCI_REG_CMD) & ~cmdbits;
+	pci_cfg_write16(dev, PCI_REG_CMD, dev->cfg.cmd);
+}
+
+int pci_find_cap(struct pci_device *dev, int id, int prev)
+{
+	int offs, count = 48;	/* at most 48 capabilities fit in config space */
+
+	if(!(pci_cfg_read16(dev, PCI_REG_STATUS) & PCI_STAT_CAPLIST)) {
 		return 0;
 	}
-	/*print_dev_info(&info, busid, dev, 0);*/
 
-	count = 1;
+	if(prev) {
+		offs = pci_cfg_read8(dev, prev + 1);
+	} else if((dev->cfg.hdr_type & PCI_HDR_TYPE_MASK) == PCI_HDR_CARDBUS) {
+		offs = pci_cfg_read8(dev, PCI_REG_CB_CAP);
+	} else {
+		offs = pci_cfg_read8(dev, PCI_REG_CAP);
+	}
 
-	if(info.hdr_type & TYPE_MULTIFUNC) {
-		for(i=1; i<8; i++) {
-			if(read_dev_info(&info, busid, dev, i) == -1) {
-				continue;
+	/* the bottom 2 bits of capability pointers are reserved */
+	while((offs &= 0xfc) && count-- > 0) {
+		if(pci_cfg_read8(dev, offs) == id) {
+			return offs;
+		}
+		offs = pci_cfg_read8(dev, offs + 1);
+	}
+	return 0;
+}
+
+int pci_enable_msi(struct pci_device *dev, intr_func_t func)
+{
+	int i, cap, inum;
+	uint16_t ctl;
+
+	if(dev->msi_intr) {
+		pci_disable_msi(dev);
+	}
+	if(!(cap = pci_find_cap(dev, PCI_CAP_MSI, 0)) || lapic_enable() == -1) {
+		return -1;
+	}
+	for(i=0; i<NUM_MSI_INTR; i++) {
+		if(!msi_func[i]) break;
+	}
+	if(i >= NUM_MSI_INTR) {
+		return -1;
+	}
+	inum = MSI_INTR_BASE + i;
+	msi_func[i] = func;
+	interrupt(inum, msi_intr);
+
+	/* request a single message, delivered to the processor we're running on */
+	ctl = pci_cfg_read16(dev, cap + 2) & ~(MSI_CTL_ENABLE | MSI_CTL_MME);
+	pci_cfg_write32(dev, cap + 4, MSI_ADDR | MSI_ADDR_DEST(lapic_id()));
+	if(ctl & MSI_CTL_64BIT) {
+		pci_cfg_write32(dev, cap + 8, 0);
+		pci_cfg_write16(dev, cap + 12, inum);
+	} else {
+		pci_cfg_write16(dev, cap + 8, inum);
+	}
+	pci_cfg_write16(dev, cap + 2, ctl | MSI_CTL_ENABLE);
+
+	pci_enable(dev, PCI_CMD_INTX_DISABLE);
+	dev->msi_intr = inum;
+	return inum;
+}
+
+void pci_disable_msi(struct pci_device *dev)
+{
+	int cap;
+
+	if(!dev->msi_intr) return;
+
+	if((cap = pci_find_cap(dev, PCI_CAP_MSI, 0))) {
+		pci_cfg_write16(dev, cap + 2, pci_cfg_read16(dev, cap + 2) & ~MSI_CTL_ENABLE);
+	}
+	pci_disable(dev, PCI_CMD_INTX_DISABLE);
+
+	interrupt(dev->msi_intr, 0);
+	msi_func[dev->msi_intr - MSI_INTR_BASE] = 0;
+	dev->msi_intr = 0;
+}
+
+void pci_register_driver(struct pci_driver *drv)
+{
+	if(pci_enum_done) {
+		drv->next = 0;
+		probe_drivers(drv);
+	}
+	drv->next = drvlist;
+	drvlist = drv;
+}
+
+/* offer all unclaimed devices to the drivers in the list starting at drv */
+static void probe_drivers(struct pci_driver *drv)
+{
+	int i;
+	struct pci_device *dev;
+	struct pci_device_id *id;
+
+	while(drv) {
+		for(i=0; i<num_pcidev; i++) {
+			dev = pcidev + i;
+			for(id=drv->ids; id->vendor && !dev->drv; id++) {
+				if(match_id(dev, id) && drv->probe(dev, id) == 0) {
+					printf("PCI: %s driver attached to %d:%d,%d (%04x:%04x)\n", drv->name,
+							dev->bus, dev->dev, dev->func, dev->cfg.vendor, dev->cfg.device);
+					dev->drv = drv;
+				}
 			}
-			/*print_dev_info(&info, busid, dev, i);*/
-			count++;
 		}
+		drv = drv->next;
+	}
+}
+
+static int match_id(struct pci_device *dev, struct pci_device_id *id)
+{
+	if(id->vendor != PCI_ANY && id->vendor != dev->cfg.vendor) return 0;
+	if(id->device != PCI_ANY && id->device != dev->cfg.device) return 0;
+	if(id->class != PCI_ANY && id->class != dev->cfg.class) return 0;
+	if(id->subclass != PCI_ANY && id->subclass != dev->cfg.subclass) return 0;
+	return 1;
+}
+
+static void msi_intr(int inum)
+{
+	msi_func[inum - MSI_INTR_BASE](inum);
+	lapic_eoi();
+}
+
+static void enum_bus(int busid)
+{
+	int i;
+
+	/* misconfigured bridges could lead us in circles */
+	if(bus_visited[busid >> 5] & (1 << (busid & 0x1f))) {
+		return;
+	}
+	bus_visited[busid >> 5] |= 1 << (busid & 0x1f);
+
+	for(i=0; i<32; i++) {
+		enum_dev(busid, i);
+	}
+}
+
+static void enum_dev(int busid, int dev)
+{
+	int i;
+
+	/* vendor id ffff is invalid */
+	if((cfg_read32(busid, dev, 0, 0) & 0xffff) == 0xffff) {
+		return;
+	}
+	if((i = add_dev(busid, dev, 0)) == -1) {
+		return;
+	}
+
+	if(pcidev[i].cfg.hdr_type & PCI_HDR_MULTIFUNC) {
+		for(i=1; i<8; i++) {
+			add_dev(busid, dev, i);
+		}
+	}
+}
+
+/* reads the configuration header of a function into the device registry, and
+ * follows PCI-to-PCI bridges to their secondary bus. Returns the registry
+ * index, or -1 if there's no such function.
+ */
+static int add_dev(int bus, int dev, int func)
+{
+	int idx, secbus;
+	struct pci_device *pdev;
+
+	if(num_pcidev >= MAX_PCI_DEVICES) {
+		printf("PCI: too many devices, ignoring %d:%d,%d\n", bus, dev, func);
+		return -1;
+	}
+	idx = num_pcidev;
+	pdev = pcidev + idx;
+
+	if(read_dev_info(&pdev->cfg, bus, dev, func) == -1) {
+		return -1;
+	}
+	/*print_dev_info(&pdev->cfg, bus, dev, func);*/
+	pdev->bus = bus;
+	pdev->dev = dev;
+	pdev->func = func;
+	num_pcidev++;
+
+	switch(pdev->cfg.hdr_type & PCI_HDR_TYPE_MASK) {
+	case PCI_HDR_DEV:
+		pdev->num_bars = 6;
+		break;
+
+	case PCI_HDR_BRIDGE:
+		pdev->num_bars = 2;
+		if((secbus = PCI_SECONDARY_BUS(&pdev->cfg)) > bus) {
+			enum_bus(secbus);
+		}
+		break;
+
+	default:
+		pdev->num_bars = 0;
 	}
-	return count;
+	return idx;
 }
 
-static int read_dev_info(struct config_data *res, int bus, int dev, int func)
+static int read_dev_info(struct pci_config_data *res, int bus, int dev, int func)
 {
 	int i;
 	uint32_t *ptr = (uint32_t*)res;
@@ -161,11 +520,11 @@ static int read_dev_info(struct config_data *res, int bus, int dev, int func)
 	return 0;
 }
 
-static void print_dev_info(struct config_data *info, int bus, int dev, int func)
+static void print_dev_info(struct pci_config_data *info, int bus, int dev, int func)
 {
 	printf("- (%d:%d,%d) Device %04x:%04x: ", bus, dev, func, info->vendor, info->device);
 	printf("\"%s\" (%d) - %s-func\n", class_str(info->class), info->class,
-			info->hdr_type & TYPE_MULTIFUNC ? "multi" : "single");
+			info->hdr_type & PCI_HDR_MULTIFUNC ? "multi" : "single");
 	printf("    subclass: \"%s\" (%d), iface: %d\n", subclass_str(info->class, info->subclass),
 			info->subclass, info->iface);
 }
@@ -175,6 +534,7 @@ static uint32_t cfg_read32_m1(int bus, int dev, int func, int reg)
 	uint32_t addr = ADDR_ENABLE | ADDR_BUSID(bus) | ADDR_DEVID(dev) |
 		ADDR_FUNC(func) | reg;
 
+	num_cfg_reads++;
 	outl(addr, CONFIG_ADDR_PORT);
 	return inl(CONFIG_DATA_PORT);
 }
@@ -185,6 +545,33 @@ static uint32_t cfg_read32_m2(int bus, int dev, int func, int reg)
 	return 0;
 }
 
+/* writes of less than 32 bits go through the corresponding byte lanes of the
+ * data port, to avoid rewriting the rest of the dword. Read-modify-write would
+ * clear any write-1-to-clear status bits next to the command register.
+ */
+static void cfg_write_m1(int bus, int dev, int func, int reg, uint32_t val, int size)
+{
+	uint32_t addr = ADDR_ENABLE | ADDR_BUSID(bus) | ADDR_DEVID(dev) |
+		ADDR_FUNC(func) | (reg & 0xfc);
+
+	outl(addr, CONFIG_ADDR_PORT);
+	switch(size) {
+	case 1:
+		outb(val, CONFIG_DATA_PORT + (reg & 3));
+		break;
+	case 2:
+		outw(val, CONFIG_DATA_PORT + (reg & 2));
+		break;
+	default:
+		outl(val, CONFIG_DATA_PORT);
+	}
+}
+
+static void cfg_write_m2(int bus, int dev, int func, int reg, uint32_t val, int size)
+{
+	panic("BUG: PCI mess mechanism #2 not implemented yet!");
+}
+
 static const char *class_names[] = {
 	"unknown",
 	"mass storage controller",
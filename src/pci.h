@@ -18,6 +18,159 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #ifndef PCI_H_
 #define PCI_H_
 
+#include <inttypes.h>
+#include "intr.h"
+
+#define MAX_PCI_DEVICES	64
+
+/* configuration space registers */
+#define PCI_REG_CMD		0x04
+#define PCI_REG_STATUS	0x06
+#define PCI_REG_BAR0	0x10
+#define PCI_REG_CAP		0x34
+#define PCI_REG_CB_CAP	0x14	/* capabilities pointer of CardBus bridges */
+
+/* command register bits */
+#define PCI_CMD_IO				0x0001
+#define PCI_CMD_MEM				0x0002
+#define PCI_CMD_MASTER			0x0004
+#define PCI_CMD_INTX_DISABLE	0x0400
+
+/* status register bits */
+#define PCI_STAT_CAPLIST	0x0010
+
+/* capability ids */
+#define PCI_CAP_PM		0x01
+#define PCI_CAP_MSI		0x05
+#define PCI_CAP_PCIE	0x10
+#define PCI_CAP_MSIX	0x11
+
+#define PCI_HDR_TYPE_MASK	0x7f
+#define PCI_HDR_MULTIFUNC	0x80
+enum {
+	PCI_HDR_DEV,		/* normal device */
+	PCI_HDR_BRIDGE,		/* PCI-to-PCI bridge */
+	PCI_HDR_CARDBUS		/* CardBus bridge */
+};
+
+/* type 0 configuration space header. For bridges (PCI_HDR_BRIDGE) only the
+ * first two base_addr entries are BARs, and the bus numbers are packed in
+ * base_addr[2] (see PCI_SECONDARY_BUS).
+ */
+struct pci_config_data {
+	uint16_t vendor, device;
+	uint16_t cmd, status;
+	uint8_t rev, iface, subclass, class;
+	uint8_t cacheline_size;
+	uint8_t latency_timer;
+	uint8_t hdr_type;
+	uint8_t bist;
+	uint32_t base_addr[6];
+	uint32_t cardbus_cis;
+	uint16_t subsys_vendor;
+	uint16_t subsys;
+	uint32_t rom_addr;
+	uint32_t reserved1, reserved2;
+	uint8_t intr_line, intr_pin;
+	uint8_t min_grant, max_latency;
+} __attribute__((packed));
+
+#define PCI_SECONDARY_BUS(cfg)	(((cfg)->base_addr[2] >> 8) & 0xff)
+
+struct pci_driver;
+
+struct pci_device {
+	int bus, dev, func;
+	int num_bars;
+	/* snapshot of the configuration header taken during enumeration. Only cmd
+	 * is kept up to date, by pci_enable and pci_disable.
+	 */
+	struct pci_config_data cfg;
+
+	struct pci_driver *drv;	/* driver which claimed this device */
+	int msi_intr;			/* interrupt number if MSI is enabled, 0 otherwise */
+};
+
+#define PCI_ANY		(-1)
+
+/* device match table entry. Use PCI_ANY for fields which shouldn't be
+ * checked. The table ends with an entry with vendor 0.
+ */
+struct pci_device_id {
+	int vendor, device;
+	int class, subclass;
+};
+
+struct pci_driver {
+	const char *name;
+	struct pci_device_id *ids;
+	/* called for every unclaimed device matching one of the ids. Return 0 to
+	 * claim the device, or -1 to leave it for other drivers.
+	 */
+	int (*probe)(struct pci_device *dev, struct pci_device_id *id);
+
+	struct pci_driver *next;
+};
+
+enum { PCI_BAR_MEM, PCI_BAR_IO };
+
+struct pci_bar {
+	int type;			/* PCI_BAR_MEM or PCI_BAR_IO */
+	uint64_t addr;
+	int is64;			/* 64bit memory BAR, takes up two BAR slots */
+	int prefetch;		/* prefetchable memory */
+};
+
 void init_pci(void);
 
+int pci_num_devices(void);
+struct pci_device *pci_device(int idx);
+
+/* find the next device after prev (or the first if prev is null), matching
+ * the vendor and device id, or the class and subclass. A subclass of -1
+ * matches any subclass.
+ */
+struct pci_device *pci_find_device(int vendor, int device, struct pci_device *prev);
+struct pci_device *pci_find_class(int class, int subclass, struct pci_device *prev);
+
+/* decode base address register idx of a device. Returns -1 if idx is out of
+ * range, or refers to an unused BAR or to the upper half of a 64bit BAR.
+ */
+int pci_bar(struct pci_device *dev, int idx, struct pci_bar *bar);
+/* probe the size of a BAR, by writing all ones to it and reading back which
+ * address bits stick. Returns 0 if the BAR is unused.
+ */
+uint64_t pci_bar_size(struct pci_device *dev, int idx);
+
+uint8_t pci_cfg_read8(struct pci_device *dev, int reg);
+uint16_t pci_cfg_read16(struct pci_device *dev, int reg);
+uint32_t pci_cfg_read32(struct pci_device *dev, int reg);
+void pci_cfg_write8(struct pci_device *dev, int reg, uint8_t val);
+void pci_cfg_write16(struct pci_device *dev, int reg, uint16_t val);
+void pci_cfg_write32(struct pci_device *dev, int reg, uint32_t val);
+
+/* set or clear PCI_CMD_* bits in the command register */
+void pci_enable(struct pci_device *dev, unsigned int cmdbits);
+void pci_disable(struct pci_device *dev, unsigned int cmdbits);
+
+/* find the next capability with the given id after the one at offset prev (0
+ * to start from the beginning). Returns its offset in configuration space, or
+ * 0 if not found.
+ */
+int pci_find_cap(struct pci_device *dev, int id, int prev);
+
+/* enable message signalled interrupts for a device, routed to the boot
+ * processor on a dedicated interrupt in the MSI_INTR_BASE range, with func as
+ * its handler. Legacy INTx is disabled. Returns the interrupt number, or -1
+ * if the device doesn't support MSI, no local APIC is available, or all MSI
+ * interrupts are taken. The end of interrupt is handled automatically.
+ */
+int pci_enable_msi(struct pci_device *dev, intr_func_t func);
+void pci_disable_msi(struct pci_device *dev);
+
+/* register a driver. If enumeration is already done, it's probed immediately
+ * against all unclaimed devices, otherwise at the end of init_pci.
+ */
+void pci_register_driver(struct pci_driver *drv);
+
 #endif	/* PCI_H_ */
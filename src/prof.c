@@ -0,0 +1,153 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "config.h"
+#include "prof.h"
+#include "rtc.h"
+#include "intr.h"
+#include "serial.h"
+#include "panic.h"
+
+#define BUF_WORDS	(PROF_BUF_SIZE * 1024 / 4)
+/* stop following the frame pointer chain at frames larger than this */
+#define MAX_FRAME_SIZE	65536
+
+static void prof_intr(int inum);
+static int backtrace(uint32_t fp, uint32_t *pc, int maxdepth);
+
+/* each sample is the number of addresses, followed by the interrupted eip and
+ * the return addresses of its callers.
+ */
+static uint32_t *samples;
+static volatile int num_words;
+static volatile unsigned long num_samples, num_dropped;
+static unsigned int prof_flags;
+static int prof_rate;
+static volatile int running;
+
+
+int prof_start(int hz, unsigned int flags)
+{
+	if(running) {
+		prof_stop();
+	}
+
+	if(!samples && !(samples = malloc(BUF_WORDS * sizeof *samples))) {
+		panic("failed to allocate profiler buffer (%d bytes)\n", BUF_WORDS * sizeof *samples);
+	}
+	num_words = 0;
+	num_samples = num_dropped = 0;
+	prof_flags = flags;
+
+	if((prof_rate = rtc_periodic(hz, prof_intr)) == -1) {
+		return -1;
+	}
+	running = 1;
+	return prof_rate;
+}
+
+void prof_stop(void)
+{
+	if(running) {
+		rtc_stop_periodic();
+		running = 0;
+	}
+}
+
+int prof_running(void)
+{
+	return running;
+}
+
+void prof_dump(void)
+{
+	int i, j, n, nwords;
+	char buf[16];
+	static char line[(PROF_MAX_DEPTH + 1) * 9 + 4];
+
+	/* samples are only ever appended, so we can dump while profiling */
+	nwords = num_words;
+
+	sprintf(line, "prof: begin rate %d samples %lu dropped %lu\n", prof_rate,
+			num_samples, num_dropped);
+	ser_dump(line);
+
+	i = 0;
+	while(i < nwords) {
+		n = samples[i++];
+		strcpy(line, "P");
+		for(j=0; j<n; j++) {
+			sprintf(buf, " %x", (unsigned int)samples[i++]);
+			strcat(line, buf);
+		}
+		strcat(line, "\n");
+		ser_dump(line);
+	}
+	ser_dump("prof: end\n");
+}
+
+static void prof_intr(int inum)
+{
+	int n, maxn;
+	uint32_t *sp;
+	struct intr_frame *frm = get_intr_frame();
+
+	maxn = (prof_flags & PROF_BACKTRACE) ? PROF_MAX_DEPTH : 1;
+	if(num_words + maxn + 1 > BUF_WORDS) {
+		num_dropped++;
+		return;
+	}
+
+	sp = samples + num_words;
+	sp[1] = frm->eip;
+	n = 1;
+	if(prof_flags & PROF_BACKTRACE) {
+		n += backtrace(frm->regs.ebp, sp + 2, maxn - 1);
+	}
+	sp[0] = n;
+
+	num_words += n + 1;
+	num_samples++;
+}
+
+/* follow the saved frame pointers up the stack, collecting return addresses.
+ * Stops at anything which doesn't look like a frame further up the same stack.
+ */
+static int backtrace(uint32_t fp, uint32_t *pc, int maxdepth)
+{
+	int n = 0;
+	uint32_t next, *frame;
+
+	while(n < maxdepth && fp && !(fp & 3)) {
+		frame = (uint32_t*)fp;
+		if(!(pc[n] = frame[1])) {
+			break;
+		}
+		n++;
+
+		next = frame[0];
+		if(next <= fp || next - fp > MAX_FRAME_SIZE) {
+			break;
+		}
+		fp = next;
+	}
+	return n;
+}
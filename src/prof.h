@@ -0,0 +1,42 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef PROF_H_
+#define PROF_H_
+
+/* sampling profiler. While running, the RTC periodic interrupt records the
+ * address the boot processor was interrupted at, and optionally a short
+ * backtrace following the frame pointer chain, into a buffer allocated by
+ * prof_start. Code running with interrupts disabled is not sampled; its time
+ * is attributed to the point where interrupts are enabled again.
+ * The samples can be symbolized on the host by tools/prof/profsym.
+ */
+
+/* prof_start flags */
+#define PROF_BACKTRACE	1
+
+/* start a new profile, discarding any previous samples. Returns the actual
+ * sampling rate, or -1 if the RTC interrupt is unavailable (see rtc_periodic).
+ */
+int prof_start(int hz, unsigned int flags);
+void prof_stop(void);
+int prof_running(void);
+
+/* write the recorded samples to the serial port, for profsym */
+void prof_dump(void);
+
+#endif	/* PROF_H_ */
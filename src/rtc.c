@@ -17,8 +17,11 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #include <stdio.h>
 #include <time.h>
+#include <errno.h>
 #include <asmops.h>
 #include "rtc.h"
+#include "intr.h"
+#include "hpet.h"
 
 /* CMOS I/O ports */
 #define PORT_CTL	0x70
@@ -41,8 +44,12 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define REG_STATD		13
 
 #define STATA_BUSY	(1 << 7)
+#define STATA_RATE_MASK	0xf
 #define STATB_24HR	(1 << 1)
 #define STATB_BIN	(1 << 2)
+#define STATB_PIE	(1 << 6)
+
+#define RTC_IRQ		8
 
 #define HOUR_PM_BIT		(1 << 7)
 
@@ -50,6 +57,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 static void read_rtc(struct tm *tm);
 static int read_reg(int reg);
+static void write_reg(int reg, int val);
+static void periodic_intr(int inum);
+
+static intr_func_t periodic_func;
 
 
 void init_rtc(void)
@@ -63,6 +74,60 @@ void init_rtc(void)
 }
 
 
+int rtc_periodic(int hz, intr_func_t func)
+{
+	int rate = 15, iflag;
+
+	/* the HPET legacy route disconnects the RTC from IRQ 8 */
+	if(hpet_legacy) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	/* the rate is 32768 >> (rate - 1), for rates 3 to 15 */
+	while(rate > 3 && (32768 >> (rate - 2)) <= hz) {
+		rate--;
+	}
+
+	iflag = get_intr_flag();
+	disable_intr();
+
+	periodic_func = func;
+	interrupt(IRQ_TO_INTR(RTC_IRQ), periodic_intr);
+
+	write_reg(REG_STATA, (read_reg(REG_STATA) & ~STATA_RATE_MASK) | rate);
+	write_reg(REG_STATB, read_reg(REG_STATB) | STATB_PIE);
+	read_reg(REG_STATC);	/* clear any pending interrupt */
+
+	set_intr_flag(iflag);
+	return 32768 >> (rate - 1);
+}
+
+void rtc_stop_periodic(void)
+{
+	int iflag = get_intr_flag();
+	disable_intr();
+
+	write_reg(REG_STATB, read_reg(REG_STATB) & ~STATB_PIE);
+	read_reg(REG_STATC);
+	/* leave the handler installed, in case an interrupt is already latched */
+	periodic_func = 0;
+
+	set_intr_flag(iflag);
+}
+
+static void periodic_intr(int inum)
+{
+	/* reading status register C acknowledges the interrupt, otherwise the RTC
+	 * won't interrupt again
+	 */
+	read_reg(REG_STATC);
+
+	if(periodic_func) {
+		periodic_func(inum);
+	}
+}
+
 static void read_rtc(struct tm *tm)
 {
 	int statb, pm;
@@ -121,3 +186,11 @@ static int read_reg(int reg)
 	iodelay();
 	return val;
 }
+
+static void write_reg(int reg, int val)
+{
+	outb(reg, PORT_CTL);
+	iodelay();
+	outb(val, PORT_DATA);
+	iodelay();
+}
@@ -19,10 +19,18 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define _RTC_H_
 
 #include <time.h>
+#include "intr.h"
 
 /* the time read from rtc during init */
 time_t start_time;
 
 void init_rtc(void);
 
+/* enable the RTC periodic interrupt (IRQ 8), calling func from its handler.
+ * The rate is hz rounded down to a power of two, between 2 and 8192. Returns
+ * the actual rate, or -1 with errno EBUSY if the HPET owns IRQ 8.
+ */
+int rtc_periodic(int hz, intr_func_t func);
+void rtc_stop_periodic(void);
+
 #endif	/* _RTC_H_ */
@@ -82,6 +82,15 @@ void set_tss(uint32_t addr)
 	set_task_reg(selector(SEGM_TASK, 0));
 }
 
+void init_cpu_segm(int cpu, struct task_state *tss)
+{
+	set_gdt((uint32_t)gdt, sizeof gdt - 1);
+	setup_selectors(selector(SEGM_KCODE, 0), selector(SEGM_KDATA, 0));
+
+	task_desc(gdt + SEGM_CPU_TSS + cpu, (uint32_t)tss, sizeof *tss - 1, 0);
+	set_task_reg(selector(SEGM_CPU_TSS + cpu, 0));
+}
+
 static void segm_desc(desc_t *desc, uint32_t base, uint32_t limit, int dpl, int type)
 {
 	desc->d[0] = limit & 0xffff; /* low order 16bits of limit */
@@ -18,6 +18,11 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #ifndef SEGM_H_
 #define SEGM_H_
 
+#include <inttypes.h>
+#include "config.h"
+
+struct task_state;
+
 enum {
 	SEGM_KCODE = 1,
 	SEGM_KDATA = 2,
@@ -25,8 +30,10 @@ enum {
 	SEGM_UDATA,
 	SEGM_TASK,
 	SEGM_CODE16,
+	/* one TSS per processor, its selector identifies the processor */
+	SEGM_CPU_TSS,
 
-	NUM_SEGMENTS
+	NUM_SEGMENTS = SEGM_CPU_TSS + MAX_CPUS
 };
 
 void init_segm(void);
@@ -35,5 +42,8 @@ uint16_t selector(int idx, int rpl);
 
 void set_tss(uint32_t addr);
 
+/* load the GDT on processor cpu, and its TSS in the task register */
+void init_cpu_segm(int cpu, struct task_state *tss);
+
 
 #endif	/* SEGM_H_ */
@@ -298,6 +298,15 @@ char *ser_getline(int fd, char *buf, int bsz)
 	return 0;
 }
 
+void ser_dump(const char *s)
+{
+#ifdef CON_SERIAL
+	ser_write(0, s, strlen(s));
+#else
+	printf("%s", s);
+#endif
+}
+
 static int have_recv(int base)
 {
 	unsigned short stat = inb(base + UART_LSTAT);
@@ -42,5 +42,11 @@ int ser_read(int fd, char *buf, int count);
 
 char *ser_getline(int fd, char *buf, int bsz);
 
+/* write a line of a debug dump (see prof_dump and trace_dump). It goes
+ * straight to the serial port to avoid flooding the screen, or through printf
+ * if the serial port isn't the console.
+ */
+void ser_dump(const char *s);
+
 
 #endif	/* SERIAL_H_ */
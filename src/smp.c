@@ -0,0 +1,150 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <string.h>
+#include "smp.h"
+#include "apic.h"
+#include "intr.h"
+#include "timer.h"
+#include "mem.h"
+#include "job.h"
+#include "asmops.h"
+
+/* where the application processor startup code is copied (see smp_asm.s) */
+#define TRAMP_ADDR		0x1000
+#define TRAMP_VAR(x)	((void*)(TRAMP_ADDR + ((x) - ap_tramp)))
+
+#define AP_STACK_PAGES	4
+
+/* warm reset vector and CMOS shutdown status, for processors which start
+ * through the BIOS reset code instead of the startup IPI (82489DX)
+ */
+#define WARM_RESET_VEC	0x467
+#define CMOS_ADDR		0x70
+#define CMOS_DATA		0x71
+#define CMOS_SHUTDOWN	0xf
+#define SHUTDOWN_JMP	0xa
+
+void ap_main(int idx);
+
+static int start_ap(int idx, int apic_id);
+static void ipi_intr(int inum);
+
+/* defined in smp_asm.s */
+extern char ap_tramp[], ap_tramp_end[];
+extern char ap_tramp_stack[], ap_tramp_cpu[], ap_tramp_gdtr[];
+
+
+void init_smp(void)
+{
+	int i, bsp_id;
+
+	bsp_id = lapic_id();
+	cpus[0].idx = 0;
+	cpus[0].apic_id = bsp_id;
+	cpus[0].online = 1;
+	cpus[0].tss.ss0 = selector(SEGM_KDATA, 0);
+	init_cpu_segm(0, &cpus[0].tss);
+	num_cpus = 1;
+
+	if(apic_config.num_cpus <= 1 || lapic_enable() == -1) {
+		return;
+	}
+	interrupt(APIC_IPI_INTR, ipi_intr);
+
+	memcpy((void*)TRAMP_ADDR, ap_tramp, ap_tramp_end - ap_tramp);
+	asm volatile("sgdt (%0)" :: "r"(TRAMP_VAR(ap_tramp_gdtr)) : "memory");
+
+	*(uint16_t*)WARM_RESET_VEC = 0;
+	*(uint16_t*)(WARM_RESET_VEC + 2) = TRAMP_ADDR >> 4;
+	outb(CMOS_SHUTDOWN, CMOS_ADDR);
+	outb(SHUTDOWN_JMP, CMOS_DATA);
+
+	for(i=0; i<apic_config.num_cpus && num_cpus < MAX_CPUS; i++) {
+		if(apic_config.cpu_id[i] != bsp_id && start_ap(num_cpus, apic_config.cpu_id[i]) != -1) {
+			num_cpus++;
+		}
+	}
+
+	outb(CMOS_SHUTDOWN, CMOS_ADDR);
+	outb(0, CMOS_DATA);
+
+	printf("SMP: %d processor(s) running\n", num_cpus);
+}
+
+/* INIT, then the startup IPI twice, as in the MP specification */
+static int start_ap(int idx, int apic_id)
+{
+	int i, pg;
+	uint64_t timeout;
+	struct cpu *cpu = cpus + idx;
+
+	if((pg = alloc_ppages(AP_STACK_PAGES, MEM_STACK)) == -1) {
+		printf("SMP: failed to allocate stack for processor %d\n", idx);
+		return -1;
+	}
+	cpu->idx = idx;
+	cpu->apic_id = apic_id;
+	cpu->online = 0;
+	cpu->stack_top = PAGE_TO_ADDR(pg + AP_STACK_PAGES);
+	cpu->tss.ss0 = selector(SEGM_KDATA, 0);
+	cpu->tss.esp0 = cpu->stack_top;
+
+	*(uint32_t*)TRAMP_VAR(ap_tramp_stack) = cpu->stack_top;
+	*(uint32_t*)TRAMP_VAR(ap_tramp_cpu) = idx;
+
+	lapic_send_init(apic_id);
+	udelay(10000);
+
+	for(i=0; i<2 && !cpu->online; i++) {
+		lapic_send_sipi(apic_id, TRAMP_ADDR);
+		udelay(200);
+	}
+
+	timeout = get_time_ns() + 100000000;
+	while(!cpu->online) {
+		if(get_time_ns() >= timeout) {
+			printf("SMP: processor %d (APIC id %d) failed to start\n", idx, apic_id);
+			free_ppages(pg, AP_STACK_PAGES);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* application processors continue here from the startup code */
+void ap_main(int idx)
+{
+	struct cpu *cpu = cpus + idx;
+
+	init_cpu_segm(idx, &cpu->tss);
+	init_cpu_intr();
+	lapic_init_ap();
+	asm volatile("fninit");
+
+	cpu->online = 1;
+	enable_intr();
+
+	job_worker();
+}
+
+/* the IPI only wakes up halted processors */
+static void ipi_intr(int inum)
+{
+	lapic_eoi();
+}
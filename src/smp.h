@@ -0,0 +1,56 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef SMP_H_
+#define SMP_H_
+
+#include <inttypes.h>
+#include "config.h"
+#include "segm.h"
+#include "tss.h"
+
+/* per-processor data */
+struct cpu {
+	int idx;		/* index in cpus, as returned by cpu_index */
+	int apic_id;
+	volatile int online;
+	uint32_t stack_top;
+	struct task_state tss;
+};
+
+struct cpu cpus[MAX_CPUS];
+/* number of processors running, including the boot processor */
+int num_cpus;
+
+/* start all application processors listed by the ACPI or MP tables, after
+ * init_apic. They enter job_worker (see job.h), and wait for jobs.
+ */
+void init_smp(void);
+
+/* index of the processor we're running on, from its TSS selector (0 before
+ * init_smp)
+ */
+static inline int cpu_index(void)
+{
+	uint16_t tr;
+	asm volatile("str %0" : "=r"(tr));
+	return tr ? (tr >> 3) - SEGM_CPU_TSS : 0;
+}
+
+#define this_cpu()	(cpus + cpu_index())
+
+#endif	/* SMP_H_ */
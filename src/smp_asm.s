@@ -0,0 +1,73 @@
+# pcboot - bootable PC demo/game kernel
+# Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY, without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+	# application processor startup code. init_smp copies it to TRAMP_ADDR
+	# in low memory, fills in the variables at the end, and sends a startup
+	# IPI, which starts the processor in real mode at TRAMP_ADDR >> 4:0.
+	.set TRAMP_ADDR, 0x1000
+	.set KCODE_SEL, 0x8
+	.set KDATA_SEL, 0x10
+
+	.text
+	.code16
+	.global ap_tramp
+ap_tramp:
+	cli
+	mov %cs, %ax
+	mov %ax, %ds
+
+	# load the kernel GDT, and enter protected mode. Caching is disabled
+	# after INIT (CD and NW set in cr0), enable it at the same time.
+	lgdtl ap_tramp_gdtr - ap_tramp
+	mov %cr0, %eax
+	and $0x9fffffff, %eax
+	or $1, %eax
+	mov %eax, %cr0
+	ljmpl $KCODE_SEL, $ap_pmode - ap_tramp + TRAMP_ADDR
+
+	.code32
+	# running from the copy, so all addresses in the trampoline are
+	# relative to TRAMP_ADDR
+ap_pmode:
+	mov $KDATA_SEL, %ax
+	mov %ax, %ds
+	mov %ax, %es
+	mov %ax, %fs
+	mov %ax, %gs
+	mov %ax, %ss
+	mov ap_tramp_stack - ap_tramp + TRAMP_ADDR, %esp
+	# push a 0 ret-addr to terminate gdb backtraces
+	pushl $0
+	pushl ap_tramp_cpu - ap_tramp + TRAMP_ADDR
+	mov $ap_main, %eax
+	call *%eax
+	# ap_main never returns
+0:	cli
+	hlt
+	jmp 0b
+
+	.align 4
+	.global ap_tramp_stack
+ap_tramp_stack: .long 0
+	.global ap_tramp_cpu
+ap_tramp_cpu: .long 0
+	.short 0
+	.global ap_tramp_gdtr
+ap_tramp_gdtr: .short 0
+	.long 0
+
+	.global ap_tramp_end
+ap_tramp_end:
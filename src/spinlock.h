@@ -0,0 +1,95 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef SPINLOCK_H_
+#define SPINLOCK_H_
+
+#include "intr.h"
+
+typedef volatile int spinlock_t;
+
+/* pause hint for spin-wait loops, a no-op before the pentium 4 */
+#define cpu_relax()		asm volatile("rep; nop" ::: "memory")
+
+static inline int atomic_xchg(volatile int *ptr, int val)
+{
+	asm volatile("xchgl %0, %1" : "+r"(val), "+m"(*ptr) :: "memory");
+	return val;
+}
+
+/* atomically add val to *ptr, and return the previous value */
+static inline int atomic_add(volatile int *ptr, int val)
+{
+	asm volatile("lock; xaddl %0, %1" : "+r"(val), "+m"(*ptr) :: "memory");
+	return val;
+}
+
+static inline void atomic_or(volatile int *ptr, int val)
+{
+	asm volatile("lock; orl %1, %0" : "+m"(*ptr) : "r"(val) : "memory");
+}
+
+static inline void atomic_and(volatile int *ptr, int val)
+{
+	asm volatile("lock; andl %1, %0" : "+m"(*ptr) : "r"(val) : "memory");
+}
+
+/* compare and swap, returns the previous value of *ptr. 486 and later */
+static inline void *atomic_cmpxchg_ptr(void *volatile *ptr, void *cmp, void *val)
+{
+	void *prev;
+	asm volatile("lock; cmpxchgl %2, %1" : "=a"(prev), "+m"(*ptr) : "r"(val), "0"(cmp) : "memory");
+	return prev;
+}
+
+static inline void *atomic_xchg_ptr(void *volatile *ptr, void *val)
+{
+	asm volatile("xchgl %0, %1" : "+r"(val), "+m"(*ptr) :: "memory");
+	return val;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+	while(atomic_xchg(lock, 1)) {
+		while(*lock) cpu_relax();
+	}
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	asm volatile("" ::: "memory");
+	*lock = 0;
+}
+
+/* spin_lock with interrupts disabled, for locks also taken by interrupt
+ * handlers. Returns the previous interrupt flag, to pass to spin_unlock_irq.
+ */
+static inline int spin_lock_irq(spinlock_t *lock)
+{
+	int iflag = get_intr_flag();
+	disable_intr();
+	spin_lock(lock);
+	return iflag;
+}
+
+static inline void spin_unlock_irq(spinlock_t *lock, int iflag)
+{
+	spin_unlock(lock);
+	set_intr_flag(iflag);
+}
+
+#endif	/* SPINLOCK_H_ */
@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include "fsbench.h"
+#include "dcache.h"
+
+/* defined in fsfat.c */
+void fsfat_lookup_bench(int num_ent);
+/* defined in fsmem.c */
+void fsmem_write_bench(long size);
+void fsmem_lookup_bench(int num_ent);
+/* defined in fspak.c */
+void fspak_read_bench(void);
+
+void fsbench(void)
+{
+	printf("FAT directory lookup benchmark\n");
+	fsfat_lookup_bench(10);
+	fsfat_lookup_bench(1000);
+	fsfat_lookup_bench(10000);
+
+	printf("memfs write benchmark\n");
+	fsmem_write_bench(32 * 1024 * 1024);
+
+	printf("memfs directory lookup benchmark\n");
+	fsmem_lookup_bench(10);
+	fsmem_lookup_bench(1000);
+	fsmem_lookup_bench(10000);
+
+	printf("asset archive read benchmark\n");
+	fspak_read_bench();
+
+	dcache_print_stats();
+}
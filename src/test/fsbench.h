@@ -0,0 +1,6 @@
+#ifndef FSBENCH_H_
+#define FSBENCH_H_
+
+void fsbench(void);
+
+#endif	/* FSBENCH_H_ */
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include "intrbench.h"
+#include "intr.h"
+#include "apic.h"
+#include "timer.h"
+#include "asmops.h"
+#include "workq.h"
+
+#define ITER	10000
+
+static void test_intr(int inum);
+static void print_result(const char *name, uint64_t cycles);
+
+static volatile int intr_count;
+static int ack_lapic;
+
+/* measure the cost of taking an interrupt, and of acknowledging it on the
+ * 8259 PIC and on the local APIC.
+ */
+void intrbench(void)
+{
+	int i, iflag;
+	uint64_t t0;
+
+	iflag = get_intr_flag();
+	interrupt(APIC_TEST_INTR, test_intr);
+
+	printf("interrupt cost benchmark (%s)\n", get_irq_controller()->name);
+
+	ack_lapic = 0;
+	disable_intr();
+	t0 = get_cycles();
+	for(i=0; i<ITER; i++) {
+		asm volatile("int %0" :: "i"(APIC_TEST_INTR));
+	}
+	print_result("software interrupt entry/exit", get_cycles() - t0);
+
+	t0 = get_cycles();
+	for(i=0; i<ITER; i++) {
+		pic_eoi(0);
+	}
+	print_result("8259 EOI", get_cycles() - t0);
+
+	if(lapic_enable() != -1) {
+		t0 = get_cycles();
+		for(i=0; i<ITER; i++) {
+			lapic_eoi();
+		}
+		print_result("local APIC EOI", get_cycles() - t0);
+
+		/* self-IPI: send, deliver, dispatch, EOI */
+		ack_lapic = 1;
+		intr_count = 0;
+		enable_intr();
+		t0 = get_cycles();
+		for(i=0; i<ITER; i++) {
+			lapic_send_ipi(lapic_id(), APIC_TEST_INTR);
+			while(intr_count <= i);
+		}
+		print_result("self-IPI round trip", get_cycles() - t0);
+		disable_intr();
+	}
+
+	interrupt(APIC_TEST_INTR, 0);
+	set_intr_flag(iflag);
+
+	workq_print_stats();
+}
+
+static void test_intr(int inum)
+{
+	intr_count++;
+	if(ack_lapic) {
+		lapic_eoi();
+	}
+}
+
+static void print_result(const char *name, uint64_t cycles)
+{
+	unsigned long cyc = udiv64(cycles, ITER);
+	unsigned long ns = udiv64(cycles_to_ns(cycles), ITER);
+	printf("  %-30s: %6lu cycles, %6lu ns\n", name, cyc, ns);
+}
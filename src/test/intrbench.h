@@ -0,0 +1,6 @@
+#ifndef INTRBENCH_H_
+#define INTRBENCH_H_
+
+void intrbench(void);
+
+#endif	/* INTRBENCH_H_ */
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "jobbench.h"
+#include "job.h"
+#include "smp.h"
+#include "timer.h"
+#include "asmops.h"
+
+#define XSZ		640
+#define YSZ		480
+#define MAX_ITER	256
+
+static void mandel_rows(int start, int end, void *arg);
+static uint64_t run(unsigned char *img, int par);
+
+/* render a mandelbrot set on the boot processor only, and then split across
+ * all processors with parallel_for
+ */
+void jobbench(void)
+{
+	unsigned char *img;
+	unsigned long t1, tn;
+
+	if(!(img = malloc(XSZ * YSZ))) {
+		printf("jobbench: failed to allocate image\n");
+		return;
+	}
+
+	printf("job system benchmark: %dx%d mandelbrot, %d processor(s)\n", XSZ, YSZ, num_cpus);
+	t1 = udiv64(run(img, 0), 1000);
+	tn = udiv64(run(img, 1), 1000);
+	if(!tn) tn = 1;
+	printf("  1 processor: %lu us\n", t1);
+	printf("  %d processor(s): %lu us (%lu.%02lux)\n", num_cpus, tn, t1 / tn, t1 * 100 / tn % 100);
+
+	free(img);
+}
+
+static uint64_t run(unsigned char *img, int par)
+{
+	uint64_t t0 = get_time_ns();
+
+	if(par) {
+		parallel_for(0, YSZ, 4, mandel_rows, img);
+	} else {
+		mandel_rows(0, YSZ, img);
+	}
+	return get_time_ns() - t0;
+}
+
+static void mandel_rows(int start, int end, void *arg)
+{
+	int i, j, iter;
+	float x, y, cx, cy, tmp;
+	unsigned char *pix = (unsigned char*)arg + start * XSZ;
+
+	for(i=start; i<end; i++) {
+		cy = (float)i / YSZ * 2.4f - 1.2f;
+		for(j=0; j<XSZ; j++) {
+			cx = (float)j / XSZ * 3.2f - 2.2f;
+			x = y = 0.0f;
+			for(iter=0; iter<MAX_ITER && x * x + y * y < 4.0f; iter++) {
+				tmp = x * x - y * y + cx;
+				y = 2.0f * x * y + cy;
+				x = tmp;
+			}
+			*pix++ = iter;
+		}
+	}
+}
@@ -0,0 +1,6 @@
+#ifndef JOBBENCH_H_
+#define JOBBENCH_H_
+
+void jobbench(void);
+
+#endif	/* JOBBENCH_H_ */
@@ -0,0 +1,255 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "thread.h"
+#include "intr.h"
+#include "asmops.h"
+#include "panic.h"
+#include "workq.h"
+
+static void thread_start(void);
+static void idle_thread(void *arg);
+static void schedule(void);
+static void enqueue(struct thread *t);
+static void reap(void);
+
+/* defined in thread_asm.s */
+void switch_stack(uint32_t *save_esp, uint32_t new_esp);
+
+static struct thread main_thread;
+static struct thread *idle;
+/* ready threads, in FIFO order */
+static struct thread *runq, *runq_tail;
+/* waiting threads */
+static struct thread *waitq;
+/* exited thread, freed by the next thread to run since it can't free its own
+ * stack
+ */
+static struct thread *zombie;
+static int next_id;
+
+
+void init_threads(void)
+{
+	main_thread.id = next_id++;
+	main_thread.name = "main";
+	main_thread.state = THREAD_RUNNING;
+	cur_thread = &main_thread;
+
+	if(!(idle = thread_create(idle_thread, 0, "idle", 0))) {
+		panic("failed to create the idle thread\n");
+	}
+	/* the idle thread only runs when nothing else is ready */
+	runq = runq_tail = 0;
+}
+
+struct thread *thread_create(thread_func_t func, void *arg, const char *name, int stack_size)
+{
+	struct thread *t;
+	uint32_t *sp;
+	int iflag;
+
+	if(stack_size <= 0) stack_size = THREAD_STACK_SIZE;
+
+	if(!(t = malloc(sizeof *t))) {
+		errno = ENOMEM;
+		return 0;
+	}
+	if(!(t->stack = malloc(stack_size))) {
+		free(t);
+		errno = ENOMEM;
+		return 0;
+	}
+	t->name = name;
+	t->func = func;
+	t->arg = arg;
+	t->wait_ev = 0;
+
+	/* initial stack, as switch_stack would leave it: ebp, ebx, esi, edi, and
+	 * a return address to thread_start, which itself returns to 0.
+	 */
+	sp = (uint32_t*)((char*)t->stack + (stack_size & ~3));
+	*--sp = 0;
+	*--sp = (uint32_t)thread_start;
+	*--sp = 0;
+	*--sp = 0;
+	*--sp = 0;
+	*--sp = 0;
+	t->esp = (uint32_t)sp;
+
+	iflag = get_intr_flag();
+	disable_intr();
+	t->id = next_id++;
+	enqueue(t);
+	set_intr_flag(iflag);
+	return t;
+}
+
+void thread_exit(void)
+{
+	disable_intr();
+	cur_thread->state = THREAD_DEAD;
+	schedule();
+	panic("dead thread %d rescheduled\n", cur_thread->id);
+}
+
+void yield(void)
+{
+	int iflag = get_intr_flag();
+	disable_intr();
+
+	if(runq) {
+		if(cur_thread != idle) {
+			enqueue(cur_thread);
+		}
+		schedule();
+	}
+
+	set_intr_flag(iflag);
+}
+
+void wait_event(void *ev)
+{
+	int iflag = get_intr_flag();
+	disable_intr();
+
+	cur_thread->state = THREAD_WAITING;
+	cur_thread->wait_ev = ev;
+	cur_thread->next = waitq;
+	waitq = cur_thread;
+	schedule();
+
+	set_intr_flag(iflag);
+}
+
+void wakeup(void *ev)
+{
+	struct thread *t, **prev;
+	int iflag = get_intr_flag();
+	disable_intr();
+
+	prev = &waitq;
+	while((t = *prev)) {
+		if(t->wait_ev == ev) {
+			*prev = t->next;
+			t->wait_ev = 0;
+			enqueue(t);
+		} else {
+			prev = &t->next;
+		}
+	}
+
+	set_intr_flag(iflag);
+}
+
+void sched_halt(void)
+{
+	if(work_pending()) {
+		run_deferred();
+	}
+
+	disable_intr();
+	if(runq) {
+		yield();
+		enable_intr();
+	} else {
+		/* sti takes effect after hlt starts, interrupts can't slip in between */
+		asm volatile("sti\n\thlt\n\t");
+	}
+}
+
+/* new threads start here, with interrupts disabled by the scheduler */
+static void thread_start(void)
+{
+	reap();
+	enable_intr();
+
+	cur_thread->func(cur_thread->arg);
+	thread_exit();
+}
+
+static void idle_thread(void *arg)
+{
+	for(;;) {
+		if(work_pending()) {
+			run_deferred();
+		}
+
+		disable_intr();
+		if(!runq && !work_pending()) {
+			asm volatile("sti\n\thlt\n\tcli");
+		}
+		yield();
+		enable_intr();
+	}
+}
+
+/* switch to the next ready thread, or to the idle thread if there are none.
+ * Called with interrupts disabled, after putting the current thread where it
+ * belongs.
+ */
+static void schedule(void)
+{
+	struct thread *prev = cur_thread;
+	struct thread *next = runq;
+
+	if(next) {
+		if(!(runq = next->next)) {
+			runq_tail = 0;
+		}
+	} else {
+		next = idle;
+	}
+	if(next == prev) {
+		prev->state = THREAD_RUNNING;
+		return;
+	}
+
+	if(prev->state == THREAD_DEAD) {
+		zombie = prev;
+	}
+	next->state = THREAD_RUNNING;
+	cur_thread = next;
+	switch_stack(&prev->esp, next->esp);
+
+	/* back in prev, after another thread switched to it */
+	reap();
+}
+
+static void enqueue(struct thread *t)
+{
+	t->state = THREAD_READY;
+	t->next = 0;
+	if(runq) {
+		runq_tail->next = t;
+		runq_tail = t;
+	} else {
+		runq = runq_tail = t;
+	}
+}
+
+static void reap(void)
+{
+	if(zombie) {
+		free(zombie->stack);
+		free(zombie);
+		zombie = 0;
+	}
+}
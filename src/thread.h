@@ -0,0 +1,76 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef THREAD_H_
+#define THREAD_H_
+
+#include <inttypes.h>
+
+#define THREAD_STACK_SIZE	16384
+
+enum { THREAD_READY, THREAD_RUNNING, THREAD_WAITING, THREAD_DEAD };
+
+typedef void (*thread_func_t)(void *arg);
+
+struct thread {
+	int id;
+	const char *name;
+	int state;
+	uint32_t esp;		/* saved stack pointer while switched out */
+	void *stack;		/* null for the main thread */
+	thread_func_t func;
+	void *arg;
+	void *wait_ev;		/* event we're waiting for, while THREAD_WAITING */
+	struct thread *next;
+};
+
+/* thread running on the boot processor. Threads are cooperative, and only
+ * run on the boot processor: use the job system (job.h) for parallel work.
+ */
+struct thread *cur_thread;
+
+/* turn the caller (pcboot_main) into the main thread, and create the idle
+ * thread, which halts when no other thread is ready.
+ */
+void init_threads(void);
+
+/* start func(arg) in a new thread. It runs the first time the caller yields
+ * or waits. stack_size 0 means THREAD_STACK_SIZE. Returns 0 on failure.
+ */
+struct thread *thread_create(thread_func_t func, void *arg, const char *name, int stack_size);
+/* terminate the calling thread, same as returning from its function */
+void thread_exit(void);
+
+/* let the other ready threads run, before continuing */
+void yield(void);
+
+/* sleep until someone calls wakeup with the same event, which can be any
+ * address. To avoid missing a wakeup from an interrupt handler between
+ * checking a condition and calling wait_event, disable interrupts before the
+ * check; wait_event returns with the interrupt flag unchanged.
+ */
+void wait_event(void *ev);
+/* make all threads waiting for ev ready. Can be called from interrupts. */
+void wakeup(void *ev);
+
+/* replacement for halt_cpu in polling loops: run pending deferred work, let
+ * the other threads run if any are ready, otherwise halt until the next
+ * interrupt
+ */
+void sched_halt(void);
+
+#endif	/* THREAD_H_ */
@@ -0,0 +1,36 @@
+# pcboot - bootable PC demo/game kernel
+# Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY, without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+	.text
+# switch_stack(uint32_t *save_esp, uint32_t new_esp)
+# saves the callee-saved registers on the current stack, and its stack
+# pointer to *save_esp, then switches to new_esp and restores the registers
+# saved there by a previous switch_stack. Returns in the other thread.
+	.globl switch_stack
+switch_stack:
+	movl 4(%esp), %eax
+	movl 8(%esp), %ecx
+	pushl %ebp
+	pushl %ebx
+	pushl %esi
+	pushl %edi
+	movl %esp, (%eax)
+	movl %ecx, %esp
+	popl %edi
+	popl %esi
+	popl %ebx
+	popl %ebp
+	ret
@@ -19,8 +19,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "intr.h"
 #include "asmops.h"
 #include "timer.h"
+#include "cpuid.h"
 #include "panic.h"
 #include "config.h"
+#include "workq.h"
 
 /* frequency of the oscillator driving the 8254 timer */
 #define OSC_FREQ_HZ		1193182
@@ -55,128 +57,631 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #define CMD_MODE_BIN		0
 #define CMD_MODE_BCD		1
 
-
-struct timer_event {
-	int dt;	/* remaining ticks delta from the previous event */
-	void (*func)(void);
-	struct timer_event *next;
-};
+/* read-back command bits */
+#define RDBACK_NO_COUNT		(1 << 5)
+#define RDBACK_NO_STATUS	(1 << 4)
+#define RDBACK_CHAN(x)		(2 << (x))
+#define STATUS_OUT			0x80
+
+/* port B of the keyboard controller, controls the gate of channel 2 */
+#define PORTB			0x61
+#define PORTB_T2GATE	0x01
+#define PORTB_SPKR		0x02
+#define PORTB_T2OUT		0x20
+
+/* TSC calibration: best of CAL_RUNS measurements of CAL_MSEC each */
+#define CAL_MSEC		10
+#define CAL_RUNS		3
+#define CAL_COUNT		(OSC_FREQ_HZ * CAL_MSEC / 1000)
+
+/* fixed point scale of the cycles->nsec and nsec->cycles multipliers */
+#define NS_SHIFT		22
+#define CYC_SHIFT		24
+/* PIT oscillator periods per nanosecond, as a 0.32 fixed point number */
+#define PIT_NS_MULT		5124677
+
+/* alarm wheel: the first level has 256 slots of 2^18ns (262us), and each of
+ * the 4 next levels has 64 slots, each covering a whole lap of the previous
+ * level. Deadlines up to 2^32 slots (about 13 days) ahead can be represented.
+ */
+#define ALARM_RES_SHIFT	18
+#define ALARM_RES		(1 << ALARM_RES_SHIFT)
+#define WHEEL0_BITS		8
+#define WHEEL0_SIZE		(1 << WHEEL0_BITS)
+#define WHEEL0_MASK		(WHEEL0_SIZE - 1)
+#define WHEELN_BITS		6
+#define WHEELN_SIZE		(1 << WHEELN_BITS)
+#define WHEEL_BITS(n)	(WHEEL0_BITS + (n) * WHEELN_BITS)
+/* slot index of time t in level n + 1 */
+#define WHEEL_IDX(t, n)	(((t) >> WHEEL_BITS(n)) & (WHEELN_SIZE - 1))
 
 static void timer_handler(int inum);
-
-static struct timer_event *evlist;
+static void init_clock(void);
+static uint32_t calc_ns_mult(uint64_t hz);
+static uint64_t pit_cycles(void);
+static void pit2_start(unsigned int count);
+static void program_oneshot(void);
+static void pit_oneshot(uint64_t delta);
+static void pit_periodic(unsigned long hz);
+static void pit_stop(void);
+static uint64_t tsc_read(void);
+static void wake_sleeper(void *ctx);
+static void add_alarm(struct alarm *al, uint64_t delay, uint64_t period,
+		alarm_func_t func, void *ctx);
+static void insert_alarm(struct alarm *al);
+static void unlink_alarm(struct alarm *al);
+static int cascade(int level, int idx);
+static void run_alarms(void);
+static void alarm_work_func(void *arg);
+
+static struct alarm *wheel0[WHEEL0_SIZE];
+static struct alarm *wheel[4][WHEELN_SIZE];
+static uint32_t wheel_time;		/* next wheel slot time to process */
+static uint32_t prog_unit;		/* slot time the one-shot timer is set for */
+
+static int reload_count;
+static int use_tsc;
+static int tickless;
+static uint32_t ns_mult, cyc_mult;
+
+/* get_time_ns is ns_base plus the time since the clock read clk_base */
+static uint32_t clk_mult;
+static uint64_t clk_base, ns_base;
+
+static struct timer_evsrc pit_evsrc = {"PIT", pit_oneshot, pit_periodic, pit_stop};
+static struct timer_evsrc *evsrc = &pit_evsrc;
+
+/* alarms run as deferred work after the timer interrupt */
+static struct workq timer_wq;
+static struct work alarm_work;
+
+static struct timer_clock tsc_clock = {"TSC", tsc_read};
+static struct timer_clock pit_clock = {"PIT", pit_cycles, OSC_FREQ_HZ};
+static struct timer_clock *clock = &pit_clock;
 
 
 void init_timer(void)
 {
-	/* calculate the reload count: round(osc / freq) */
-	int reload_count = DIV_ROUND(OSC_FREQ_HZ, TICK_FREQ_HZ);
+	init_workq(&timer_wq, "timer");
 
-	/* set the mode to square wave for channel 0, both low
-	 * and high reload count bytes will follow...
-	 */
-	outb(CMD_CHAN0 | CMD_ACCESS_BOTH | CMD_OP_SQWAVE, PORT_CMD);
-
-	/* write the low and high bytes of the reload count to the
-	 * port for channel 0
-	 */
-	outb(reload_count & 0xff, PORT_DATA0);
-	outb((reload_count >> 8) & 0xff, PORT_DATA0);
+	pit_periodic(TICK_FREQ_HZ);
 
 	/* set the timer interrupt handler */
 	interrupt(IRQ_TO_INTR(0), timer_handler);
+
+	init_clock();
 }
 
-void set_alarm(unsigned long msec, void (*func)(void))
+int set_timer_evsrc(struct timer_evsrc *es)
 {
-	int ticks, tsum, iflag;
-	struct timer_event *ev, *node;
+	int iflag;
 
-	if((ticks = MSEC_TO_TICKS(msec)) <= 0) {
-		return;
+	if(clock == &pit_clock) return -1;
+
+	iflag = get_intr_flag();
+	disable_intr();
+
+	evsrc->stop();
+	evsrc = es;
+	if(tickless) {
+		program_oneshot();
+	} else {
+		es->periodic(TICK_FREQ_HZ);
 	}
+	printf("timer: using %s\n", es->name);
 
-	if(!(ev = malloc(sizeof *ev))) {
-		panic("failed to allocate timer event");
-		return;
+	set_intr_flag(iflag);
+	return 0;
+}
+
+struct timer_evsrc *get_timer_evsrc(void)
+{
+	return evsrc;
+}
+
+void timer_restart(void)
+{
+	int iflag = get_intr_flag();
+	disable_intr();
+
+	if(tickless) {
+		program_oneshot();
+	} else {
+		evsrc->periodic(TICK_FREQ_HZ);
+	}
+
+	set_intr_flag(iflag);
+}
+
+int set_timer_clock(struct timer_clock *clk)
+{
+	int iflag;
+	uint64_t now;
+	unsigned long khz;
+
+	/* the nanoseconds multiplier must fit in 32 bits */
+	if(clk->hz <= (1000000000 >> (32 - NS_SHIFT))) {
+		return -1;
 	}
-	ev->func = func;
 
 	iflag = get_intr_flag();
 	disable_intr();
 
-	if(!evlist || ticks < evlist->dt) {
-		/* insert at the begining */
-		ev->next = evlist;
-		evlist = ev;
+	now = get_time_ns();
+	clock = clk;
+	clk_mult = calc_ns_mult(clk->hz);
+	clk_base = clk->read();
+	ns_base = now;
+
+	if(!use_tsc) {
+		/* the PIT can't count cycles in one-shot mode, use the new clock */
+		cycles_hz = clk->hz;
+		ns_mult = clk_mult;
+		cyc_mult = udiv64((uint64_t)cycles_hz << CYC_SHIFT, 1000000000);
+	}
+	khz = udiv64(clk->hz, 1000);
+	printf("timer: clock source %s, %lu.%03lu MHz\n", clk->name, khz / 1000, khz % 1000);
+
+#ifdef TIMER_TICKLESS
+	if(!tickless) {
+		tickless = 1;
+		program_oneshot();
+	}
+#endif
+
+	set_intr_flag(iflag);
+	return 0;
+}
 
-		ev->dt = ticks;
-		if(ev->next) {
-			ev->next->dt -= ticks;
+struct timer_clock *get_timer_clock(void)
+{
+	return clock;
+}
+
+/* calibrate the TSC against PIT channel 2, and set up the conversion factors
+ * between cycles and nanoseconds.
+ */
+static void init_clock(void)
+{
+	int i;
+	uint32_t cyc, best = 0xffffffff;
+	uint64_t t0;
+	unsigned long khz;
+
+	if(CPU_HAS(TSC)) {
+		for(i=0; i<CAL_RUNS; i++) {
+			pit2_start(CAL_COUNT);
+			t0 = rdtsc();
+			while(!(inb(PORTB) & PORTB_T2OUT));
+			cyc = rdtsc() - t0;
+			/* interruptions (SMIs) only ever make it longer */
+			if(cyc < best) best = cyc;
 		}
+		cpu_freq_hz = cycles_hz = (uint64_t)best * (1000 / CAL_MSEC);
+		use_tsc = 1;
 	} else {
-		tsum = evlist->dt;
-		node = evlist;
+		cycles_hz = OSC_FREQ_HZ;
+	}
 
-		while(node->next && ticks > tsum + node->next->dt) {
-			tsum += node->next->dt;
-			node = node->next;
-		}
+	ns_mult = calc_ns_mult(cycles_hz);
+	cyc_mult = udiv64((uint64_t)cycles_hz << CYC_SHIFT, 1000000000);
 
-		ev->next = node->next;
-		node->next = ev;
+	if(use_tsc) {
+		tsc_clock.hz = cycles_hz;
+		clock = &tsc_clock;
+	}
+	clk_mult = ns_mult;
+	clk_base = clock->read();
+	ns_base = 0;
+	wheel_time = 0;
+
+	if(use_tsc) {
+		khz = udiv64(cpu_freq_hz, 1000);
+		printf("CPU: %s family %d model %d, %lu.%02lu MHz\n", cpu_info.vendor,
+				cpu_info.family, cpu_info.model, khz / 1000, (khz % 1000) / 10);
+	} else {
+		printf("CPU: no TSC, using the PIT as the time base\n");
+	}
+
+#ifdef TIMER_TICKLESS
+	if(use_tsc) {
+		tickless = 1;
+		program_oneshot();
+	}
+#endif
+}
+
+/* nanoseconds per cycle in NS_SHIFT fixed point. Frequencies above 4.29GHz
+ * don't fit in the 32-bit divisor of udiv64, so both sides are scaled down
+ * until they do.
+ */
+static uint32_t calc_ns_mult(uint64_t hz)
+{
+	uint64_t n = (uint64_t)1000000000 << NS_SHIFT;
+
+	while(hz >> 32) {
+		hz >>= 1;
+		n >>= 1;
+	}
+	return udiv64(n, hz);
+}
+
+unsigned long get_ticks(void)
+{
+	if(tickless) {
+		return udiv64(get_time_ns(), 1000000000 / TICK_FREQ_HZ);
+	}
+	return nticks;
+}
+
+uint64_t get_cycles(void)
+{
+	return use_tsc ? rdtsc() : clock->read();
+}
+
+uint64_t get_time_ns(void)
+{
+	return ns_base + mul_shr(clock->read() - clk_base, clk_mult, NS_SHIFT);
+}
+
+uint64_t cycles_to_ns(uint64_t cyc)
+{
+	return mul_shr(cyc, ns_mult, NS_SHIFT);
+}
+
+void ndelay(unsigned long nsec)
+{
+	uint64_t cyc, end;
 
-		/* fix the relative times */
-		ev->dt = ticks - tsum;
-		if(ev->next) {
-			ev->next->dt -= ev->dt;
+	if(use_tsc) {
+		end = rdtsc() + mul_shr(nsec, cyc_mult, CYC_SHIFT);
+		while(rdtsc() < end);
+		return;
+	}
+
+	cyc = mul_shr(nsec, PIT_NS_MULT, 32);
+
+	while(cyc > 0) {
+		unsigned int count = cyc > 0xffff ? 0xffff : cyc;
+		pit2_start(count);
+		while(!(inb(PORTB) & PORTB_T2OUT));
+		cyc -= count;
+	}
+}
+
+void udelay(unsigned long usec)
+{
+	while(usec > 1000000) {
+		ndelay(1000000000);
+		usec -= 1000000;
+	}
+	ndelay(usec * 1000);
+}
+
+/* fallback cycle counter without a TSC: count PIT oscillator periods, from
+ * nticks and the current position of channel 0 within the tick.
+ */
+static uint64_t pit_cycles(void)
+{
+	static uint64_t last;
+	int intr_state, status, count, pos;
+	uint64_t res;
+
+	intr_state = get_intr_flag();
+	disable_intr();
+
+	outb(CMD_RDBACK | RDBACK_CHAN(0), PORT_CMD);
+	status = inb(PORT_DATA0);
+	count = inb(PORT_DATA0);
+	count |= inb(PORT_DATA0) << 8;
+
+	/* in square wave mode the counter runs down twice per tick, by 2, with
+	 * the output high during the first half.
+	 */
+	pos = (reload_count - count) / 2;
+	if(!(status & STATUS_OUT)) {
+		pos += reload_count / 2;
+	}
+	res = (uint64_t)nticks * reload_count + pos;
+
+	/* the counter might have wrapped before the interrupt incremented nticks */
+	if(res < last) {
+		res = last;
+	}
+	last = res;
+
+	set_intr_flag(intr_state);
+	return res;
+}
+
+/* start PIT channel 2 counting down from count in one-shot mode. Its output,
+ * readable from port B, goes high when it reaches 0.
+ */
+static void pit2_start(unsigned int count)
+{
+	unsigned char pb = inb(PORTB) & ~(PORTB_SPKR | PORTB_T2GATE);
+
+	outb(pb, PORTB);
+	outb(CMD_CHAN2 | CMD_ACCESS_BOTH | CMD_OP_INT_TERM, PORT_CMD);
+	outb(count & 0xff, PORT_DATA2);
+	outb((count >> 8) & 0xff, PORT_DATA2);
+	outb(pb | PORTB_T2GATE, PORTB);
+}
+
+void set_alarm(struct alarm *al, unsigned long msec, alarm_func_t func, void *ctx)
+{
+	add_alarm(al, (uint64_t)msec * 1000000, 0, func, ctx);
+}
+
+void set_alarm_usec(struct alarm *al, unsigned long usec, alarm_func_t func, void *ctx)
+{
+	add_alarm(al, (uint64_t)usec * 1000, 0, func, ctx);
+}
+
+void set_periodic_alarm(struct alarm *al, unsigned long msec, alarm_func_t func, void *ctx)
+{
+	uint64_t period = (uint64_t)msec * 1000000;
+	add_alarm(al, period, period, func, ctx);
+}
+
+int cancel_alarm(struct alarm *al)
+{
+	int iflag, res;
+
+	iflag = get_intr_flag();
+	disable_intr();
+
+	if((res = al->pprev != 0)) {
+		unlink_alarm(al);
+	}
+	al->period = 0;
+
+	set_intr_flag(iflag);
+	return res;
+}
+
+void sleep(unsigned long msec)
+{
+	volatile int done = 0;
+	struct alarm al = {0};
+	int iflag;
+
+	/* the alarm would only run after we return, so all we can do is spin */
+	if(in_deferred() || in_intr()) {
+		while(msec--) {
+			udelay(1000);
 		}
+		return;
 	}
 
+	iflag = get_intr_flag();
+	disable_intr();
+	set_alarm(&al, msec, wake_sleeper, (void*)&done);
+	while(!done) {
+		/* sti takes effect after the next instruction, so the wakeup can't
+		 * slip in between checking done and halting.
+		 */
+		asm volatile("sti\n\thlt\n\tcli\n\t");
+	}
 	set_intr_flag(iflag);
 }
 
-void cancel_alarm(void (*func)(void))
+int sys_sleep(int sec)
+{
+	sleep(sec * 1000);
+	return 0;
+}
+
+static void wake_sleeper(void *ctx)
+{
+	*(volatile int*)ctx = 1;
+}
+
+static void add_alarm(struct alarm *al, uint64_t delay, uint64_t period,
+		alarm_func_t func, void *ctx)
 {
 	int iflag;
-	struct timer_event *ev, *node;
-	struct timer_event dummy;
 
 	iflag = get_intr_flag();
 	disable_intr();
 
-	dummy.next = evlist;
-	node = &dummy;
-	while(node->next) {
-		ev = node->next;
-		if(ev->func == func) {
-			/* found it */
-			if(ev->next) {
-				ev->next->dt += ev->dt;
-			}
-			node->next = ev->next;
-			free(ev);
-			break;
-		}
-		node = node->next;
+	if(al->pprev) {
+		unlink_alarm(al);
+	}
+	al->func = func;
+	al->ctx = ctx;
+	al->when = get_time_ns() + delay;
+	al->period = period;
+	insert_alarm(al);
+
+	/* new earliest deadline, the one-shot timer must fire earlier */
+	if(tickless && (int32_t)(al->expires - prog_unit) < 0) {
+		program_oneshot();
 	}
 
 	set_intr_flag(iflag);
 }
 
+/* place an alarm in the wheel slot matching its deadline. Each level has
+ * slots ALARM_RES_SHIFT + 8 + 6 * (level - 1) bits wider than the previous
+ * one, and alarms move down a level when the lower level wraps around.
+ */
+static void insert_alarm(struct alarm *al)
+{
+	uint32_t exp, delta;
+	struct alarm **slot;
+
+	/* round up, so that the alarm never fires early */
+	exp = (al->when + ALARM_RES - 1) >> ALARM_RES_SHIFT;
+	if((int32_t)(exp - wheel_time) < 0) {
+		exp = wheel_time;	/* already due, run on the next step */
+	}
+	al->expires = exp;
+	delta = exp - wheel_time;
+
+	if(delta < WHEEL0_SIZE) {
+		slot = wheel0 + (exp & WHEEL0_MASK);
+	} else if(delta < 1 << WHEEL_BITS(1)) {
+		slot = wheel[0] + WHEEL_IDX(exp, 0);
+	} else if(delta < 1 << WHEEL_BITS(2)) {
+		slot = wheel[1] + WHEEL_IDX(exp, 1);
+	} else if(delta < 1 << WHEEL_BITS(3)) {
+		slot = wheel[2] + WHEEL_IDX(exp, 2);
+	} else {
+		slot = wheel[3] + WHEEL_IDX(exp, 3);
+	}
+
+	if((al->next = *slot)) {
+		al->next->pprev = &al->next;
+	}
+	al->pprev = slot;
+	*slot = al;
+}
+
+static void unlink_alarm(struct alarm *al)
+{
+	if(al->next) {
+		al->next->pprev = al->pprev;
+	}
+	*al->pprev = al->next;
+	al->pprev = 0;
+	al->next = 0;
+}
+
+/* move the alarms of a higher level slot down, returns the slot index */
+static int cascade(int level, int idx)
+{
+	struct alarm *al, *list = wheel[level][idx];
+
+	wheel[level][idx] = 0;
+	while(list) {
+		al = list;
+		list = list->next;
+		insert_alarm(al);
+	}
+	return idx;
+}
+
+/* process the wheel up to the current time */
+static void run_alarms(void)
+{
+	uint32_t cur, now = get_time_ns() >> ALARM_RES_SHIFT;
+	struct alarm *al;
+
+	while((int32_t)(now - wheel_time) >= 0) {
+		cur = wheel_time;
+		if(!(cur & WHEEL0_MASK) && !cascade(0, WHEEL_IDX(cur, 0)) &&
+				!cascade(1, WHEEL_IDX(cur, 1)) && !cascade(2, WHEEL_IDX(cur, 2))) {
+			cascade(3, WHEEL_IDX(cur, 3));
+		}
+		/* anything re-inserted while running this slot goes to the next one */
+		wheel_time++;
+
+		while((al = wheel0[cur & WHEEL0_MASK])) {
+			unlink_alarm(al);
+			if(al->period) {
+				/* next deadline based on the previous one, to avoid drifting */
+				al->when += al->period;
+				insert_alarm(al);
+			}
+			/* callbacks run with interrupts enabled */
+			enable_intr();
+			al->func(al->ctx);
+			disable_intr();
+		}
+	}
+}
+
 static void timer_handler(int inum)
 {
-	nticks++;
+	timer_event();
+}
+
+void timer_event(void)
+{
+	if(tickless) {
+		nticks = get_ticks();
+	} else {
+		nticks++;
+	}
 
-	if(evlist) {
-		evlist->dt--;
+	queue_work(&timer_wq, &alarm_work, alarm_work_func, 0);
+}
 
-		while(evlist && evlist->dt <= 0) {
-			struct timer_event *ev = evlist;
-			evlist = evlist->next;
+static void alarm_work_func(void *arg)
+{
+	int iflag = get_intr_flag();
+	disable_intr();
+
+	run_alarms();
+	if(tickless) {
+		program_oneshot();
+	}
 
-			ev->func();
-			free(ev);
+	set_intr_flag(iflag);
+}
+
+/* program the next timer interrupt at the next non-empty slot of the first
+ * level, or when it wraps around and has to pick up alarms from the next
+ * level. So even with no pending alarms, there's a wakeup every 67ms, keeping
+ * nticks fresh.
+ */
+static void program_oneshot(void)
+{
+	int i;
+	uint32_t u = wheel_time;
+	int32_t du;
+	uint64_t now;
+	int64_t delta;
+
+	for(i=0; i<WHEEL0_SIZE; i++) {
+		if(wheel0[u & WHEEL0_MASK] || !(u & WHEEL0_MASK)) {
+			break;
 		}
+		u++;
 	}
+	prog_unit = u;
+
+	now = get_time_ns();
+	du = u - (uint32_t)(now >> ALARM_RES_SHIFT);
+	delta = ((int64_t)du << ALARM_RES_SHIFT) - (int64_t)(now & (ALARM_RES - 1));
+	evsrc->oneshot(delta > 0 ? delta : 0);
+}
+
+/* the PIT count is 16 bits, so it can't wait for more than about 55ms */
+static void pit_oneshot(uint64_t delta)
+{
+	uint64_t count = mul_shr(delta, PIT_NS_MULT, 32) + 1;
+	if(count > 0xffff) count = 0xffff;
+
+	outb(CMD_CHAN0 | CMD_ACCESS_BOTH | CMD_OP_INT_TERM, PORT_CMD);
+	outb(count & 0xff, PORT_DATA0);
+	outb((count >> 8) & 0xff, PORT_DATA0);
+}
+
+static void pit_periodic(unsigned long hz)
+{
+	/* calculate the reload count: round(osc / freq) */
+	reload_count = DIV_ROUND(OSC_FREQ_HZ, hz);
+
+	/* set the mode to square wave for channel 0, both low
+	 * and high reload count bytes will follow...
+	 */
+	outb(CMD_CHAN0 | CMD_ACCESS_BOTH | CMD_OP_SQWAVE, PORT_CMD);
+
+	/* write the low and high bytes of the reload count to the
+	 * port for channel 0
+	 */
+	outb(reload_count & 0xff, PORT_DATA0);
+	outb((reload_count >> 8) & 0xff, PORT_DATA0);
+}
+
+static void pit_stop(void)
+{
+	mask_irq(0);
+}
+
+static uint64_t tsc_read(void)
+{
+	return rdtsc();
 }
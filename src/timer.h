@@ -18,25 +18,112 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #ifndef _TIMER_H_
 #define _TIMER_H_
 
+#include <inttypes.h>
 #include "config.h"
 
 #define MSEC_TO_TICKS(ms)	((ms) * TICK_FREQ_HZ / 1000)
 #define TICKS_TO_MSEC(tk)	((tk) * 1000 / TICK_FREQ_HZ)
 
+/* ticks since init_timer. In tickless mode it's only updated when the timer
+ * interrupt fires, use get_ticks to read the current value.
+ */
 volatile unsigned long nticks;
 
+/* frequency of the get_cycles counter: the calibrated TSC frequency, or the
+ * frequency of the clock source on CPUs without a TSC.
+ */
+uint64_t cycles_hz;
+/* calibrated CPU clock frequency, 0 if the CPU has no TSC */
+uint64_t cpu_freq_hz;
+
 void init_timer(void);
 
-/*
-int sys_sleep(int sec);
-void sleep(unsigned long msec);
-*/
+unsigned long get_ticks(void);
 
-/* schedule a function to be called 'msec' milliseconds into the future
- * warning: this function will be called directly from the timer interrupt, and
- * must be extremely quick.
+uint64_t get_cycles(void);
+/* nanoseconds since init_timer */
+uint64_t get_time_ns(void);
+uint64_t cycles_to_ns(uint64_t cyc);
+
+/* busy-wait delays. Without a TSC they're timed by PIT channel 2, and each
+ * call has a few microseconds of I/O overhead.
+ */
+void ndelay(unsigned long nsec);
+void udelay(unsigned long usec);
+
+/* timer interrupt source. The PIT is used by default, and other drivers can
+ * take over with set_timer_evsrc. Their interrupt handler must call
+ * timer_event, which queues the alarm processing as deferred work.
+ */
+struct timer_evsrc {
+	const char *name;
+	/* interrupt once, delta nanoseconds from now. The source may fire earlier
+	 * if delta is more than it can handle.
+	 */
+	void (*oneshot)(uint64_t delta);
+	/* interrupt hz times per second */
+	void (*periodic)(unsigned long hz);
+	/* stop interrupting, another source is taking over */
+	void (*stop)(void);
+};
+
+/* switch to another timer interrupt source. Not possible while the PIT is
+ * also the clock. Returns -1 on failure.
+ */
+int set_timer_evsrc(struct timer_evsrc *es);
+struct timer_evsrc *get_timer_evsrc(void);
+void timer_event(void);
+/* program the event source again, after its driver had to stop it for a
+ * while. Missed deadlines fire right away.
  */
-void set_alarm(unsigned long msec, void (*func)(void));
-void cancel_alarm(void (*func)(void));
+void timer_restart(void);
+
+/* time base of get_time_ns: the TSC, or the PIT on CPUs without one. Other
+ * drivers can take over with set_timer_clock. Switching from the PIT to
+ * another clock enables tickless mode, if configured.
+ */
+struct timer_clock {
+	const char *name;
+	uint64_t (*read)(void);		/* free-running counter */
+	uint64_t hz;				/* counter frequency, at least 1MHz */
+};
+
+int set_timer_clock(struct timer_clock *clk);
+struct timer_clock *get_timer_clock(void);
+
+typedef void (*alarm_func_t)(void *ctx);
+
+/* alarm handle, allocated by the caller. A zeroed struct alarm is a valid
+ * inactive alarm. The fields are private to the timer code.
+ */
+struct alarm {
+	uint64_t when;		/* deadline in get_time_ns nanoseconds */
+	uint64_t period;	/* 0 for one-shot alarms */
+	uint32_t expires;	/* deadline in alarm wheel slots */
+	alarm_func_t func;
+	void *ctx;
+	struct alarm *next, **pprev;
+};
+
+/* schedule func(ctx) to be called after a delay, or every msec milliseconds
+ * for periodic alarms. Periodic alarms are scheduled relative to their
+ * previous deadline, so they don't drift. Setting an alarm which is already
+ * pending reschedules it. Alarm resolution is 262us.
+ * func is called from deferred work after the timer interrupt (see workq.h),
+ * with interrupts enabled. It must not wait, and should be quick, since it
+ * delays the alarms after it.
+ */
+void set_alarm(struct alarm *al, unsigned long msec, alarm_func_t func, void *ctx);
+void set_alarm_usec(struct alarm *al, unsigned long usec, alarm_func_t func, void *ctx);
+void set_periodic_alarm(struct alarm *al, unsigned long msec, alarm_func_t func, void *ctx);
+/* returns 1 if the alarm was pending, 0 otherwise */
+int cancel_alarm(struct alarm *al);
+
+/* halt the CPU until msec milliseconds have passed. Alarms run as deferred
+ * work, so when called from deferred work (including alarm callbacks) or an
+ * interrupt handler, it busy-waits instead, and nothing else runs meanwhile.
+ */
+void sleep(unsigned long msec);
+int sys_sleep(int sec);
 
 #endif	/* _TIMER_H_ */
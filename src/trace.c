@@ -0,0 +1,106 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "config.h"
+#include "trace.h"
+#include "timer.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "serial.h"
+#include "panic.h"
+#include "asmops.h"
+
+struct trace_rec {
+	uint64_t time;
+	const char *name;
+	int type;
+	long val;
+};
+
+
+static struct trace_rec *tbuf[MAX_CPUS];
+/* count of events written to each buffer, wraps around TRACE_BUF_SIZE */
+static volatile int twidx[MAX_CPUS];
+
+
+void trace_start(void)
+{
+	int i;
+
+	trace_enabled = 0;
+
+	for(i=0; i<num_cpus; i++) {
+		if(!tbuf[i] && !(tbuf[i] = malloc(TRACE_BUF_SIZE * sizeof *tbuf[i]))) {
+			panic("failed to allocate trace buffer (%d bytes)\n", TRACE_BUF_SIZE * sizeof *tbuf[i]);
+		}
+		twidx[i] = 0;
+	}
+
+	trace_enabled = 1;
+}
+
+void trace_stop(void)
+{
+	trace_enabled = 0;
+}
+
+void trace_event(int type, const char *name, long val)
+{
+	int cpu = cpu_index();
+	struct trace_rec *rec;
+
+	if(!tbuf[cpu]) return;
+
+	/* interrupts might record events in the middle of this one */
+	rec = tbuf[cpu] + (atomic_add(twidx + cpu, 1) & (TRACE_BUF_SIZE - 1));
+	rec->time = get_cycles();
+	rec->name = name;
+	rec->type = type;
+	rec->val = val;
+}
+
+void trace_dump(void)
+{
+	int i, j, start, end;
+	struct trace_rec *rec;
+	static char line[128];
+
+	trace_stop();
+
+	sprintf(line, "trace: begin khz %lu cpus %d\n", (unsigned long)udiv64(cycles_hz, 1000),
+			num_cpus);
+	ser_dump(line);
+
+	for(i=0; i<num_cpus; i++) {
+		if(!tbuf[i]) continue;
+
+		end = twidx[i];
+		start = end > TRACE_BUF_SIZE ? end - TRACE_BUF_SIZE : 0;
+		for(j=start; j<end; j++) {
+			rec = tbuf[i] + (j & (TRACE_BUF_SIZE - 1));
+			sprintf(line, "T %d %c %ld %x%08x %s\n", i, rec->type, rec->val,
+					(unsigned int)(rec->time >> 32), (unsigned int)rec->time,
+					rec->name ? rec->name : "-");
+			ser_dump(line);
+		}
+	}
+	ser_dump("trace: end\n");
+}
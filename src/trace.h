@@ -0,0 +1,62 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef TRACE_H_
+#define TRACE_H_
+
+/* event tracing. While enabled, events are stamped with get_cycles and
+ * recorded in a ring buffer of each processor, which keeps the most recent
+ * TRACE_BUF_SIZE events. The dump can be converted to the Chrome/Perfetto
+ * trace format by tools/trace/trace2json. When tracing is disabled, each
+ * trace point costs a single test and branch.
+ */
+
+/* event types, the same as the Chrome trace event phases */
+#define TRACE_BEGIN		'B'
+#define TRACE_END		'E'
+#define TRACE_INSTANT	'i'
+#define TRACE_COUNTER	'C'
+
+/* set by trace_start, also tested by trace points in assembly */
+volatile int trace_enabled;
+
+#define TRACE_EVENT(type, name, val) \
+	do { \
+		if(trace_enabled) trace_event(type, name, val); \
+	} while(0)
+
+/* trace_begin/trace_end mark a span, and must nest properly on each processor.
+ * Names must be static strings, only the pointer is recorded.
+ */
+#define trace_begin(name)			TRACE_EVENT(TRACE_BEGIN, name, 0)
+#define trace_end()					TRACE_EVENT(TRACE_END, 0, 0)
+#define trace_instant(name)			TRACE_EVENT(TRACE_INSTANT, name, 0)
+#define trace_counter(name, val)	TRACE_EVENT(TRACE_COUNTER, name, val)
+
+/* start tracing, discarding any previous events */
+void trace_start(void);
+void trace_stop(void);
+
+/* record an event, regardless of trace_enabled. Safe to call from interrupt
+ * handlers and from any processor.
+ */
+void trace_event(int type, const char *name, long val);
+
+/* stop tracing and write the recorded events to the serial port */
+void trace_dump(void);
+
+#endif	/* TRACE_H_ */
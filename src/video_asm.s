@@ -17,6 +17,16 @@
 
 	.global wait_vsync
 wait_vsync:
+	# trace_begin("wait_vsync"), see trace.h
+	cmpl $0, trace_enabled
+	jz 1f
+	pushl $0
+	pushl $vsync_trace_name
+	# TRACE_BEGIN
+	pushl $0x42
+	call trace_event
+	add $12, %esp
+1:
 	mov $0x3da, %dx
 0:	in %dx, %al
 	and $8, %al
@@ -24,7 +34,17 @@ wait_vsync:
 0:	in %dx, %al
 	and $8, %al
 	jz 0b
-	ret
+
+	# trace_end()
+	cmpl $0, trace_enabled
+	jz 1f
+	pushl $0
+	pushl $0
+	# TRACE_END
+	pushl $0x45
+	call trace_event
+	add $12, %esp
+1:	ret
 
 	.global set_pal_entry
 set_pal_entry:
@@ -42,3 +62,6 @@ set_pal_entry:
 	shr $2, %al
 	out %al, %dx
 	ret
+
+	.section .rodata
+vsync_trace_name: .asciz "wait_vsync"
@@ -0,0 +1,160 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include "workq.h"
+#include "intr.h"
+#include "timer.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "asmops.h"
+#include "trace.h"
+
+static struct workq *wqlist, *wqtail;
+static volatile int num_pending;
+static int running;
+
+
+void init_workq(struct workq *wq, const char *name)
+{
+	int iflag;
+
+	wq->name = name;
+	wq->head = 0;
+	wq->next = 0;
+	wq->num_runs = 0;
+	wq->total_lat = wq->max_lat = 0;
+
+	iflag = get_intr_flag();
+	disable_intr();
+	if(wqlist) {
+		wqtail->next = wq;
+		wqtail = wq;
+	} else {
+		wqlist = wqtail = wq;
+	}
+	set_intr_flag(iflag);
+}
+
+/* items are pushed on the head of the queue with compare and swap, which is
+ * safe against both interrupts and other processors without any locks.
+ */
+int queue_work(struct workq *wq, struct work *w, work_func_t func, void *arg)
+{
+	void *head;
+
+	if(atomic_xchg(&w->pending, 1)) {
+		return 0;
+	}
+	w->func = func;
+	w->arg = arg;
+	w->queued = get_cycles();
+
+	do {
+		head = wq->head;
+		w->next = head;
+	} while(atomic_cmpxchg_ptr(&wq->head, head, w) != head);
+
+	atomic_add(&num_pending, 1);
+	return 1;
+}
+
+int work_pending(void)
+{
+	return num_pending;
+}
+
+int in_deferred(void)
+{
+	return running;
+}
+
+void run_deferred(void)
+{
+	int iflag;
+	uint64_t lat;
+	struct workq *wq;
+	struct work *w, *list, *next;
+
+	if(running || cpu_index() != 0) return;
+	running = 1;
+
+	iflag = get_intr_flag();
+	enable_intr();
+
+	while(num_pending) {
+		for(wq=wqlist; wq; wq=wq->next) {
+			if(!wq->head) continue;
+
+			/* take the whole list, and reverse it to run in FIFO order */
+			list = 0;
+			w = atomic_xchg_ptr(&wq->head, 0);
+			while(w) {
+				next = w->next;
+				w->next = list;
+				list = w;
+				w = next;
+			}
+
+			while(list) {
+				w = list;
+				list = list->next;
+
+				lat = get_cycles() - w->queued;
+				wq->num_runs++;
+				wq->total_lat += lat;
+				if(lat > wq->max_lat) wq->max_lat = lat;
+
+				atomic_add(&num_pending, -1);
+				/* clear pending first, so it can be queued again while running */
+				w->pending = 0;
+				trace_begin(wq->name);
+				w->func(w->arg);
+				trace_end();
+			}
+		}
+	}
+
+	set_intr_flag(iflag);
+	running = 0;
+}
+
+void workq_print_stats(void)
+{
+	struct workq *wq;
+	unsigned long avg, max;
+
+	printf("work queue latency:\n");
+	for(wq=wqlist; wq; wq=wq->next) {
+		avg = wq->num_runs ? udiv64(cycles_to_ns(udiv64(wq->total_lat, wq->num_runs)), 1000) : 0;
+		max = udiv64(cycles_to_ns(wq->max_lat), 1000);
+		printf("  %-10s: %8lu runs, avg %6lu us, max %6lu us\n", wq->name, wq->num_runs, avg, max);
+	}
+}
+
+void workq_reset_stats(void)
+{
+	struct workq *wq;
+	int iflag = get_intr_flag();
+	disable_intr();
+
+	for(wq=wqlist; wq; wq=wq->next) {
+		wq->num_runs = 0;
+		wq->total_lat = wq->max_lat = 0;
+	}
+	set_intr_flag(iflag);
+}
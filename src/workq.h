@@ -0,0 +1,68 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef WORKQ_H_
+#define WORKQ_H_
+
+#include <inttypes.h>
+
+typedef void (*work_func_t)(void *arg);
+
+/* deferred work item, allocated by the caller. A zeroed struct work is a
+ * valid idle work item. The fields are private to the work queue code.
+ */
+struct work {
+	work_func_t func;
+	void *arg;
+	volatile int pending;
+	uint64_t queued;	/* get_cycles when it was queued */
+	struct work *next;
+};
+
+struct workq {
+	const char *name;
+	void *volatile head;	/* queued items, newest first */
+	struct workq *next;
+
+	/* cycles between queueing and running */
+	unsigned long num_runs;
+	uint64_t total_lat, max_lat;
+};
+
+/* register a work queue. Queues are run in the order they were registered */
+void init_workq(struct workq *wq, const char *name);
+
+/* queue func(arg) to run later, with interrupts enabled: right after the
+ * outermost interrupt handler returns, or from the idle loop. Can be called
+ * from interrupt handlers and from any processor, but work only runs on the
+ * boot processor, and must not wait (see thread.h). Returns 0 if the item was
+ * already pending, in which case it will run only once.
+ */
+int queue_work(struct workq *wq, struct work *w, work_func_t func, void *arg);
+
+/* run all pending work. Does nothing if called recursively, or on any
+ * processor other than the boot processor.
+ */
+void run_deferred(void);
+int work_pending(void);
+/* nonzero while run_deferred is running work, on any processor */
+int in_deferred(void);
+
+void workq_print_stats(void);
+void workq_reset_stats(void);
+
+#endif	/* WORKQ_H_ */
@@ -0,0 +1,103 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <string.h>
+#include <stdint.h>
+#include "lz4enc.h"
+
+#define HASH_BITS	12
+#define MIN_MATCH	4
+#define MAX_OFFS	65535
+#define LAST_LITERALS	5
+#define MATCH_LIMIT		12
+
+#define READ32(p)	((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | \
+		((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+
+static unsigned char *put_len(unsigned char *op, unsigned char *oend, int len)
+{
+	while(len >= 255) {
+		if(op >= oend) return 0;
+		*op++ = 255;
+		len -= 255;
+	}
+	if(op >= oend) return 0;
+	*op++ = len;
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, int srcsz, unsigned char *dest, int destsz)
+{
+	int htab[1 << HASH_BITS];
+	int i, ip = 0, anchor = 0, ref, litlen, mlen;
+	uint32_t seq, h;
+	unsigned char *op = dest, *oend = dest + destsz, *token;
+
+	for(i=0; i<(1 << HASH_BITS); i++) {
+		htab[i] = -1;
+	}
+
+	while(ip < srcsz - MATCH_LIMIT) {
+		seq = READ32(src + ip);
+		h = (seq * 2654435761u) >> (32 - HASH_BITS);
+		ref = htab[h];
+		htab[h] = ip;
+
+		if(ref < 0 || ip - ref > MAX_OFFS || READ32(src + ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		mlen = MIN_MATCH;
+		while(ip + mlen < srcsz - LAST_LITERALS && src[ref + mlen] == src[ip + mlen]) {
+			mlen++;
+		}
+
+		/* emit a sequence: token, literals, offset, match length */
+		litlen = ip - anchor;
+		if(op + 1 + litlen + 2 > oend) return -1;
+		token = op++;
+		*token = (litlen >= 15 ? 15 : litlen) << 4;
+		if(litlen >= 15 && !(op = put_len(op, oend, litlen - 15))) return -1;
+		if(op + litlen + 2 > oend) return -1;
+		memcpy(op, src + anchor, litlen);
+		op += litlen;
+
+		*op++ = (ip - ref) & 0xff;
+		*op++ = (ip - ref) >> 8;
+
+		*token |= mlen - MIN_MATCH >= 15 ? 15 : mlen - MIN_MATCH;
+		if(mlen - MIN_MATCH >= 15 && !(op = put_len(op, oend, mlen - MIN_MATCH - 15))) {
+			return -1;
+		}
+
+		ip += mlen;
+		anchor = ip;
+	}
+
+	/* the last sequence is only literals */
+	litlen = srcsz - anchor;
+	if(op >= oend) return -1;
+	token = op++;
+	*token = (litlen >= 15 ? 15 : litlen) << 4;
+	if(litlen >= 15 && !(op = put_len(op, oend, litlen - 15))) return -1;
+	if(op + litlen > oend) return -1;
+	memcpy(op, src + anchor, litlen);
+	op += litlen;
+
+	return op - dest;
+}
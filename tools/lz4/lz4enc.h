@@ -0,0 +1,29 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef LZ4ENC_H_
+#define LZ4ENC_H_
+
+/* worst case compressed size for incompressible data */
+#define LZ4_BOUND(sz)	((sz) + (sz) / 255 + 16)
+
+/* greedy single-pass LZ4 block compressor (raw block format, no frame header).
+ * Returns the compressed size, or -1 if it doesn't fit in destsz bytes.
+ */
+int lz4_compress(const unsigned char *src, int srcsz, unsigned char *dest, int destsz);
+
+#endif	/* LZ4ENC_H_ */
@@ -0,0 +1,92 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+/* lz4img - host tool which compresses the main kernel binary for the second
+ * stage boot loader. The output is a 12 byte header: "LZ4K", compressed size,
+ * uncompressed size (little endian), followed by a single LZ4 block.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "lz4enc.h"
+
+static void write_u32(FILE *fp, unsigned long x);
+
+int main(int argc, char **argv)
+{
+	FILE *fp;
+	long size;
+	int csize;
+	unsigned char *src, *dest;
+
+	if(argc != 3) {
+		fprintf(stderr, "usage: %s <input> <output>\n", argv[0]);
+		return 1;
+	}
+
+	if(!(fp = fopen(argv[1], "rb"))) {
+		fprintf(stderr, "failed to open %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+
+	if(!(src = malloc(size + 1)) || !(dest = malloc(LZ4_BOUND(size)))) {
+		fprintf(stderr, "failed to allocate buffers\n");
+		return 1;
+	}
+	if(fread(src, 1, size, fp) != size) {
+		fprintf(stderr, "failed to read %s\n", argv[1]);
+		return 1;
+	}
+	fclose(fp);
+
+	if((csize = lz4_compress(src, size, dest, LZ4_BOUND(size))) == -1) {
+		fprintf(stderr, "compression failed\n");
+		return 1;
+	}
+
+	if(!(fp = fopen(argv[2], "wb"))) {
+		fprintf(stderr, "failed to open %s for writing: %s\n", argv[2], strerror(errno));
+		return 1;
+	}
+	fwrite("LZ4K", 1, 4, fp);
+	write_u32(fp, csize);
+	write_u32(fp, size);
+	fwrite(dest, 1, csize, fp);
+	if(ferror(fp)) {
+		fprintf(stderr, "failed to write %s\n", argv[2]);
+		fclose(fp);
+		remove(argv[2]);
+		return 1;
+	}
+	fclose(fp);
+
+	printf("lz4img: %ld bytes compressed to %d (%d sectors saved)\n", size, csize,
+			(int)((size + 511) / 512 - (csize + 12 + 511) / 512));
+	return 0;
+}
+
+static void write_u32(FILE *fp, unsigned long x)
+{
+	fputc(x & 0xff, fp);
+	fputc((x >> 8) & 0xff, fp);
+	fputc((x >> 16) & 0xff, fp);
+	fputc((x >> 24) & 0xff, fp);
+}
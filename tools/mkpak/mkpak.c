@@ -0,0 +1,362 @@
+/*
+pcboot - bootable PC demo/game kernel
+Copyright (C) 2018-2019  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY, without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+/* mkpak - host tool which packs files into a pcboot asset archive.
+ * See src/fspak.c for a description of the archive format.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "lz4enc.h"
+
+#define PAK_ALIGN	4096
+#define HDR_SIZE	16
+#define ENT_SIZE	20
+/* compressed files are split in blocks of this size, must match src/fspak.c */
+#define BLOCK_SIZE	16384
+
+struct file {
+	char *path;		/* path on the host */
+	char *name;		/* name in the archive */
+	uint32_t hash;
+	uint32_t name_offs, offs, size;
+	uint32_t csize;	/* compressed size, or 0 if stored uncompressed */
+	unsigned char *data;
+};
+
+static int add_path(const char *path, const char *name);
+static int add_file(const char *path, const char *name, long size);
+static int write_pak(FILE *fp);
+static int load_file(struct file *f);
+static void compress_file(struct file *f);
+static uint32_t name_hash(const char *name);
+static int cmp_files(const void *a, const void *b);
+static void write_u32(FILE *fp, uint32_t x);
+static void pad(FILE *fp, long offs, long align);
+
+static struct file *files;
+static int num_files, max_files;
+static int compress;
+
+int main(int argc, char **argv)
+{
+	int i;
+	const char *outfile = "assets.pak";
+	FILE *fp;
+
+	for(i=1; i<argc; i++) {
+		if(argv[i][0] == '-') {
+			if(strcmp(argv[i], "-o") == 0 && argv[i + 1]) {
+				outfile = argv[++i];
+			} else if(strcmp(argv[i], "-z") == 0) {
+				compress = 1;
+			} else {
+				fprintf(stderr, "usage: %s [-z] [-o <archive>] <file/dir> ...\n", argv[0]);
+				fprintf(stderr, " -z: LZ4-compress files which get smaller\n");
+				return strcmp(argv[i], "-h") == 0 ? 0 : 1;
+			}
+		} else {
+			if(add_path(argv[i], 0) == -1) {
+				return 1;
+			}
+		}
+	}
+
+	/* the kernel finds files by binary search on the name hash */
+	qsort(files, num_files, sizeof *files, cmp_files);
+
+	for(i=1; i<num_files; i++) {
+		if(strcasecmp(files[i].name, files[i - 1].name) == 0) {
+			fprintf(stderr, "duplicate archive name: %s (%s and %s)\n", files[i].name,
+					files[i - 1].path, files[i].path);
+			return 1;
+		}
+	}
+
+	if(!(fp = fopen(outfile, "wb"))) {
+		fprintf(stderr, "failed to open %s for writing: %s\n", outfile, strerror(errno));
+		return 1;
+	}
+	if(write_pak(fp) == -1) {
+		fclose(fp);
+		remove(outfile);
+		return 1;
+	}
+	fclose(fp);
+	return 0;
+}
+
+/* add a file or a directory tree. Files named on the command line are stored
+ * with their path as given, files in directories relative to that directory.
+ */
+static int add_path(const char *path, const char *name)
+{
+	struct stat st;
+	DIR *dir;
+	struct dirent *dent;
+	char *fpath, *fname;
+	int res = 0;
+
+	if(stat(path, &st) == -1) {
+		fprintf(stderr, "failed to stat %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if(!S_ISDIR(st.st_mode)) {
+		if(!name) {
+			name = path;
+			while(name[0] == '.' && name[1] == '/') name += 2;
+			while(*name == '/') name++;
+		}
+		return add_file(path, name, st.st_size);
+	}
+
+	if(!(dir = opendir(path))) {
+		fprintf(stderr, "failed to open directory %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while((dent = readdir(dir))) {
+		if(dent->d_name[0] == '.') continue;
+
+		fpath = malloc(strlen(path) + strlen(dent->d_name) + 2);
+		sprintf(fpath, "%s/%s", path, dent->d_name);
+		if(name) {
+			fname = malloc(strlen(name) + strlen(dent->d_name) + 2);
+			sprintf(fname, "%s/%s", name, dent->d_name);
+		} else {
+			fname = strdup(dent->d_name);
+		}
+
+		res = add_path(fpath, fname);
+		free(fpath);
+		free(fname);
+		if(res == -1) break;
+	}
+	closedir(dir);
+	return res;
+}
+
+static int add_file(const char *path, const char *name, long size)
+{
+	struct file *f;
+
+	if(size > 0x7fffffff) {
+		fprintf(stderr, "%s: file too large\n", path);
+		return -1;
+	}
+
+	if(num_files >= max_files) {
+		int newsz = max_files ? max_files * 2 : 32;
+		void *tmp = realloc(files, newsz * sizeof *files);
+		if(!tmp) {
+			perror("failed to allocate file list");
+			return -1;
+		}
+		files = tmp;
+		max_files = newsz;
+	}
+	f = files + num_files++;
+
+	f->path = strdup(path);
+	f->name = strdup(name);
+	f->hash = name_hash(name);
+	f->size = size;
+	return 0;
+}
+
+static int write_pak(FILE *fp)
+{
+	int i;
+	long offs, names_size = 0, total_size = 0, total_stored = 0;
+	uint32_t stored;
+
+	for(i=0; i<num_files; i++) {
+		if(load_file(files + i) == -1) {
+			return -1;
+		}
+		if(compress) {
+			compress_file(files + i);
+		}
+		total_size += files[i].size;
+		total_stored += files[i].csize ? files[i].csize : files[i].size;
+	}
+	if(compress) {
+		printf("mkpak: %d files, %ld bytes compressed to %ld\n", num_files, total_size,
+				total_stored);
+	}
+
+	/* layout: header, index, names, then the file data, each file starting
+	 * at a 4k boundary.
+	 */
+	offs = HDR_SIZE + num_files * ENT_SIZE;
+	for(i=0; i<num_files; i++) {
+		files[i].name_offs = offs + names_size;
+		names_size += strlen(files[i].name) + 1;
+	}
+	offs += names_size;
+	for(i=0; i<num_files; i++) {
+		offs = (offs + PAK_ALIGN - 1) & ~(long)(PAK_ALIGN - 1);
+		files[i].offs = offs;
+		offs += files[i].csize ? files[i].csize : files[i].size;
+	}
+
+	fwrite("PAK0", 1, 4, fp);
+	write_u32(fp, num_files);
+	write_u32(fp, HDR_SIZE);
+	write_u32(fp, offs);
+
+	for(i=0; i<num_files; i++) {
+		write_u32(fp, files[i].hash);
+		write_u32(fp, files[i].name_offs);
+		write_u32(fp, files[i].offs);
+		write_u32(fp, files[i].size);
+		write_u32(fp, files[i].csize);
+	}
+	for(i=0; i<num_files; i++) {
+		fwrite(files[i].name, 1, strlen(files[i].name) + 1, fp);
+	}
+
+	for(i=0; i<num_files; i++) {
+		pad(fp, ftell(fp), PAK_ALIGN);
+
+		stored = files[i].csize ? files[i].csize : files[i].size;
+		fwrite(files[i].data, 1, stored, fp);
+	}
+
+	if(ferror(fp)) {
+		fprintf(stderr, "failed to write archive\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int load_file(struct file *f)
+{
+	FILE *fp;
+
+	if(!(f->data = malloc(f->size ? f->size : 1))) {
+		fprintf(stderr, "failed to allocate %lu bytes for %s\n", (unsigned long)f->size, f->path);
+		return -1;
+	}
+	if(!(fp = fopen(f->path, "rb"))) {
+		fprintf(stderr, "failed to open %s: %s\n", f->path, strerror(errno));
+		return -1;
+	}
+	if(fread(f->data, 1, f->size, fp) != f->size) {
+		fprintf(stderr, "failed to read %s\n", f->path);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+	return 0;
+}
+
+/* compressed files start with a seek table of nblk + 1 offsets, relative to
+ * the start of the file data, followed by the LZ4 blocks. Every block but the
+ * last decompresses to BLOCK_SIZE bytes. Blocks which don't compress are
+ * stored as-is, which is detected by their size being the uncompressed size.
+ * If the whole file doesn't get smaller, it's left uncompressed.
+ */
+static void compress_file(struct file *f)
+{
+	int i, nblk, blksz, csz;
+	uint32_t offs;
+	unsigned char *buf, *src, *dest;
+
+	nblk = (f->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if(!nblk) return;
+
+	if(!(buf = malloc((nblk + 1) * 4 + f->size))) {
+		fprintf(stderr, "failed to allocate compression buffer for %s\n", f->path);
+		return;
+	}
+
+	offs = (nblk + 1) * 4;
+	for(i=0; i<nblk; i++) {
+		src = f->data + i * BLOCK_SIZE;
+		blksz = f->size - i * BLOCK_SIZE;
+		if(blksz > BLOCK_SIZE) blksz = BLOCK_SIZE;
+
+		dest = buf + offs;
+		/* must fit in the space left, and be smaller than the raw block */
+		if((csz = lz4_compress(src, blksz, dest, blksz - 1)) == -1) {
+			memcpy(dest, src, blksz);
+			csz = blksz;
+		}
+
+		buf[i * 4] = offs;
+		buf[i * 4 + 1] = offs >> 8;
+		buf[i * 4 + 2] = offs >> 16;
+		buf[i * 4 + 3] = offs >> 24;
+		offs += csz;
+	}
+	buf[nblk * 4] = offs;
+	buf[nblk * 4 + 1] = offs >> 8;
+	buf[nblk * 4 + 2] = offs >> 16;
+	buf[nblk * 4 + 3] = offs >> 24;
+
+	if(offs >= f->size) {
+		free(buf);
+		return;
+	}
+	free(f->data);
+	f->data = buf;
+	f->csize = offs;
+}
+
+/* case-insensitive FNV-1a, must match the one in src/fspak.c */
+static uint32_t name_hash(const char *name)
+{
+	uint32_t h = 2166136261u;
+
+	while(*name) {
+		h = (h ^ (unsigned char)tolower(*name++)) * 16777619u;
+	}
+	return h;
+}
+
+static int cmp_files(const void *a, const void *b)
+{
+	const struct file *fa = a;
+	const struct file *fb = b;
+
+	if(fa->hash != fb->hash) {
+		return fa->hash < fb->hash ? -1 : 1;
+	}
+	return strcasecmp(fa->name, fb->name);
+}
+
+static void write_u32(FILE *fp, uint32_t x)
+{
+	fputc(x & 0xff, fp);
+	fputc((x >> 8) & 0xff, fp);
+	fputc((x >> 16) & 0xff, fp);
+	fputc((x >> 24) & 0xff, fp);
+}
+
+static void pad(FILE *fp, long offs, long align)
+{
+	while(offs++ & (align - 1)) {
+		fputc(0, fp);
+	}
+}